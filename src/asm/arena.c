@@ -0,0 +1,99 @@
+/*
+ * Bump allocator
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "arena.h"
+
+#define CHUNK_SIZE 0x10000
+
+/* Alignment suitable for any object allocated by the assembler */
+#define ALIGN (sizeof(union { long l; double d; void *p; }))
+
+struct s16_arena_chunk {
+	struct s16_arena_chunk *next;
+};
+
+void arena_init(struct s16_arena *arena)
+{
+	arena->head = NULL;
+	arena->cur = NULL;
+	arena->ptr = NULL;
+	arena->end = NULL;
+}
+
+void *arena_alloc(struct s16_arena *arena, size_t size)
+{
+	struct s16_arena_chunk *chunk;
+	size_t chunk_size;
+	void *ptr;
+
+	size = (size + ALIGN - 1) & ~(ALIGN - 1);
+
+	if ((size_t) (arena->end - arena->ptr) < size) {
+		/* Oversized allocations get a chunk of their own */
+		chunk_size = size > CHUNK_SIZE / 4 ? size : CHUNK_SIZE;
+
+		chunk = malloc(ALIGN + chunk_size);
+		if (!chunk)
+			abort();
+		chunk->next = arena->head;
+		arena->head = chunk;
+
+		if (chunk_size != CHUNK_SIZE)
+			return (char *) chunk + ALIGN;
+
+		arena->cur = chunk;
+		arena->ptr = (char *) chunk + ALIGN;
+		arena->end = arena->ptr + chunk_size;
+	}
+
+	ptr = arena->ptr;
+	arena->ptr += size;
+	return ptr;
+}
+
+char *arena_strndup(struct s16_arena *arena, const char *str, size_t len)
+{
+	char *copy;
+
+	copy = arena_alloc(arena, len + 1);
+	memcpy(copy, str, len);
+	copy[len] = 0;
+	return copy;
+}
+
+void arena_reset(struct s16_arena *arena)
+{
+	struct s16_arena_chunk *chunk;
+
+	while (arena->head) {
+		chunk = arena->head->next;
+		if (arena->head != arena->cur)
+			free(arena->head);
+		arena->head = chunk;
+	}
+
+	arena->head = arena->cur;
+	if (arena->cur) {
+		arena->cur->next = NULL;
+		arena->ptr = (char *) arena->cur + ALIGN;
+		arena->end = arena->ptr + CHUNK_SIZE;
+	}
+}
+
+void arena_free(struct s16_arena *arena)
+{
+	struct s16_arena_chunk *chunk;
+
+	while (arena->head) {
+		chunk = arena->head->next;
+		free(arena->head);
+		arena->head = chunk;
+	}
+
+	arena->cur = NULL;
+	arena->ptr = NULL;
+	arena->end = NULL;
+}
@@ -0,0 +1,38 @@
+#ifndef ARENA_H
+#define ARENA_H
+
+struct s16_arena_chunk;
+
+/*
+ * Bump allocator, everything allocated from it is released at once
+ */
+struct s16_arena {
+	/* All chunks, and the one currently bumped from */
+	struct s16_arena_chunk *head, *cur;
+	char *ptr, *end;
+};
+
+void arena_init(struct s16_arena *arena);
+
+/*
+ * Allocate size bytes, aborts if out of memory
+ */
+void *arena_alloc(struct s16_arena *arena, size_t size);
+
+/*
+ * Copy len bytes of str into the arena and NUL-terminate them
+ */
+char *arena_strndup(struct s16_arena *arena, const char *str, size_t len);
+
+/*
+ * Release everything allocated from an arena, but keep one chunk around
+ *  so reusing the arena does not go back to malloc
+ */
+void arena_reset(struct s16_arena *arena);
+
+/*
+ * Release all memory allocated from an arena
+ */
+void arena_free(struct s16_arena *arena);
+
+#endif
@@ -0,0 +1,194 @@
+/*
+ * Assembler benchmark, times tokenize, genast and assemble separately and
+ *  reports lines/s and peak memory for each phase
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <vec.h>
+#include "arena.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parser.h"
+#include "../lib/symtab.h"
+#include "../lib/dbginfo.h"
+#include "insn.h"
+
+enum { LEX, PARSE, ENCODE, PHASE_COUNT };
+
+static const char *phase_name[PHASE_COUNT] = {
+	"tokenize", "genast", "assemble"
+};
+
+static char *readfile(const char *path, size_t *size)
+{
+	FILE *fp;
+	char *str;
+	long len;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+
+	if (-1 == fseek(fp, 0, SEEK_END) || -1 == (len = ftell(fp))
+			|| NULL == (str = malloc(len + 1))) {
+		fclose(fp);
+		return NULL;
+	}
+
+	rewind(fp);
+	*size = fread(str, 1, len, fp);
+	str[*size] = 0;
+	fclose(fp);
+	return str;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Peak resident set size so far in KiB */
+static long peak_rss(void)
+{
+	struct rusage ru;
+
+	getrusage(RUSAGE_SELF, &ru);
+	return ru.ru_maxrss;
+}
+
+/*
+ * Run all phases once, the time of each is stored in elapsed and the peak
+ *  RSS after it in rss
+ */
+static int run(char *str, s16_tokenizer lex, int outfd,
+	double elapsed[PHASE_COUNT], long rss[PHASE_COUNT])
+{
+	struct s16_arena arena;
+	struct s16_intern names;
+	tokvec toks;
+	struct s16_ast ast;
+	double start;
+	long line;
+	int ret;
+
+	arena_init(&arena);
+	intern_init(&names);
+	tokvec_init(&toks);
+	initast(&ast);
+
+	start = now();
+	ret = lex(str, &line, &arena, &names, &toks);
+	elapsed[LEX] = now() - start;
+	rss[LEX] = peak_rss();
+	if (-1 == ret)
+		goto done;
+
+	start = now();
+	ret = genast(toks.arr, &line, &ast);
+	elapsed[PARSE] = now() - start;
+	rss[PARSE] = peak_rss();
+	if (-1 == ret)
+		goto done;
+
+	start = now();
+	ret = assemble(&ast, &names, outfd, -1, 0, &line);
+	elapsed[ENCODE] = now() - start;
+	rss[ENCODE] = peak_rss();
+
+done:
+	if (-1 == ret)
+		fprintf(stderr, "Error on line %ld\n", line);
+	freeast(&ast);
+	tokvec_free(&toks);
+	intern_free(&names);
+	arena_free(&arena);
+	return ret;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, runs, i, j, outfd;
+	s16_tokenizer lex;
+	char *str, *p;
+	size_t size, lines;
+	double elapsed[PHASE_COUNT], best[PHASE_COUNT], total;
+	long rss[PHASE_COUNT], scratch[PHASE_COUNT], base_rss;
+
+	runs = 5;
+	lex = tokenize;
+
+	while (-1 != (opt = getopt(argc, argv, "hn:S")))
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		case 'S':
+			lex = tokenize_std;
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind >= argc || runs < 1)
+		goto print_usage;
+
+	str = readfile(argv[optind], &size);
+	if (!str) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	for (lines = 0, p = str; (p = strchr(p, '\n')); ++p)
+		++lines;
+	if (size && '\n' != str[size - 1])
+		++lines;
+
+	outfd = open("/dev/null", O_WRONLY);
+	if (-1 == outfd) {
+		perror("/dev/null");
+		return 1;
+	}
+
+	/* Peak memory is only meaningful for the first run */
+	base_rss = peak_rss();
+	for (i = 0; i < runs; ++i) {
+		if (-1 == run(str, lex, outfd, elapsed, i ? scratch : rss))
+			return 1;
+		for (j = 0; j < PHASE_COUNT; ++j)
+			if (!i || elapsed[j] < best[j])
+				best[j] = elapsed[j];
+	}
+
+	printf("%s: %zu lines, %zu bytes, best of %d runs\n",
+		argv[optind], lines, size, runs);
+	printf("%-10s %10s %14s %10s %12s\n",
+		"phase", "ms", "lines/s", "MB/s", "peak KiB");
+	for (total = 0, j = 0; j < PHASE_COUNT; ++j) {
+		total += best[j];
+		printf("%-10s %10.2f %14.0f %10.1f %12ld\n", phase_name[j],
+			best[j] * 1e3, lines / best[j], size / best[j] / 1e6,
+			rss[j] - base_rss);
+	}
+	printf("%-10s %10.2f %14.0f %10.1f %12ld\n", "total",
+		total * 1e3, lines / total, size / total / 1e6,
+		rss[PHASE_COUNT - 1] - base_rss);
+
+	close(outfd);
+	free(str);
+	return 0;
+
+print_usage:
+	fprintf(stderr, "Usage %s [-n RUNS] [-S] FILE\n", argv[0]);
+	return 1;
+}
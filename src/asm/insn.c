@@ -8,28 +8,43 @@
 #include <string.h>
 #include <unistd.h>
 #include <vec.h>
-#include <map.h>
-#include <djb2.h>
+#include "arena.h"
+#include "intern.h"
 #include "lexer.h"
 #include "parser.h"
-
-VEC_GEN(uint16_t, w)
-MAP_GEN(char *, uint16_t, djb2_hash, !strcmp, sym)
+#include "../lib/symtab.h"
+#include "../lib/dbginfo.h"
+#include "../lib/obj.h"
+#include "insn.h"
 
 static int assemble_const
-	(struct s16_parse_token *ptok, symmap *symtab, wvec *buf)
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
 {
 	uint16_t *p;
+	struct s16_fixup fixup;
 
-	p = buf->arr + buf->n - 1;
+	p = enc->code.arr + enc->code.n - 1;
 
 	if (OPERAND_CONSTANT == ptok->type) {
 		*p = (uint16_t) ptok->data.l;
 	} else if (OPERAND_LABEL == ptok->type) {
-		if (!symmap_get(symtab, ptok->data.s, p)) {
-			fprintf(stderr, "Undefined label %s\n",  ptok->data.s);
+		if (-1 != enc->idents.arr[ptok->data.id].addr && !enc->relocatable) {
+			*p = enc->idents.arr[ptok->data.id].addr;
+			return 0;
+		}
+
+		if (!enc->backpatch && !enc->relocatable) {
+			fprintf(stderr, "Undefined label %s\n",
+				INTERN_NAME(enc->names, ptok->data.id));
 			return -1;
 		}
+
+		/* Forward or relocated reference, patched once the address is known */
+		fixup.word = enc->code.n - 1;
+		fixup.line = enc->line;
+		fixup.label = ptok->data.id;
+		fixvec_add(&enc->fixups, fixup);
 	} else {
 		fprintf(stderr, "Invalid constant or label\n");
 		return -1;
@@ -39,7 +54,8 @@ static int assemble_const
 }
 
 static int assemble_d
-	(struct s16_parse_token *ptok, symmap *symtab, wvec *buf)
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
 {
 	uint16_t *p;
 
@@ -48,13 +64,14 @@ static int assemble_d
 		return -1;
 	}
 
-	p = buf->arr + buf->n - 1;
+	p = enc->code.arr + enc->code.n - 1;
 	*p |= (uint16_t) ptok->data.l << 8;
 	return 0;
 }
 
 static int assemble_a
-	(struct s16_parse_token *ptok, symmap *symtab, wvec *buf)
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
 {
 	uint16_t *p;
 
@@ -63,13 +80,14 @@ static int assemble_a
 		return -1;
 	}
 
-	p = buf->arr + buf->n - 1;
+	p = enc->code.arr + enc->code.n - 1;
 	*p |= (uint16_t) ptok->data.l << 4;
 	return 0;
 }
 
 static int assemble_b
-	(struct s16_parse_token *ptok, symmap *symtab, wvec *buf)
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
 {
 	uint16_t *p;
 
@@ -78,27 +96,97 @@ static int assemble_b
 		return -1;
 	}
 
-	p = buf->arr + buf->n - 1;
+	p = enc->code.arr + enc->code.n - 1;
 	*p |= (uint16_t) ptok->data.l;
 	return 0;
 }
 
 static int assemble_ea
-	(struct s16_parse_token *ptok, symmap *symtab, wvec *buf)
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
 {
+	struct s16_parse_token *disp;
+
 	if (OPERAND_EADDRESS != ptok->type) {
 		fprintf(stderr, "Invalid effective address\n");
 		return -1;
 	}
 
-	if (-1 == assemble_a(ptok->children[1], symtab, buf))
+	disp = AST_CHILD(ast, ptok);
+	if (-1 == assemble_a(ast, AST_NEXT(ast, disp), enc))
+		return -1;
+	wvec_add(&enc->code, 0); /* NOTE: add 0 to avoid windback for displacement */
+	return assemble_const(ast, disp, enc);
+}
+
+static int assemble_xa
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
+{
+	if (OPERAND_REGISTER != ptok->type) {
+		fprintf(stderr, "Invalid register\n");
+		return -1;
+	}
+
+	/* NOTE: Ra always comes first in the second word of EXP instructions */
+	wvec_add(&enc->code, (uint16_t) ptok->data.l << 12);
+	return 0;
+}
+
+static int assemble_xb
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
+{
+	uint16_t *p;
+
+	if (OPERAND_REGISTER != ptok->type) {
+		fprintf(stderr, "Invalid register\n");
 		return -1;
-	wvec_add(buf, 0); /* NOTE: add 0 to avoid windback for displacement */
-	return assemble_const(ptok->children[0], symtab, buf);
+	}
+
+	p = enc->code.arr + enc->code.n - 1;
+	*p |= (uint16_t) ptok->data.l << 8;
+	return 0;
+}
+
+static int assemble_p
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
+{
+	uint16_t *p;
+
+	if (OPERAND_CONSTANT != ptok->type
+			|| ptok->data.l < 0 || ptok->data.l > 15) {
+		fprintf(stderr, "Invalid shift or bit number\n");
+		return -1;
+	}
+
+	p = enc->code.arr + enc->code.n - 1;
+	*p |= (uint16_t) ptok->data.l << 4;
+	return 0;
+}
+
+static int assemble_w
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
+{
+	uint16_t *p;
+
+	if (OPERAND_CONSTANT != ptok->type
+			|| ptok->data.l < 1 || ptok->data.l > 16) {
+		fprintf(stderr, "Invalid field width\n");
+		return -1;
+	}
+
+	/* NOTE: widths 1 through 16 are stored as 0 through 15 */
+	p = enc->code.arr + enc->code.n - 1;
+	*p |= (uint16_t) ptok->data.l - 1;
+	return 0;
 }
 
 static int assemble_ascii
-	(struct s16_parse_token *ptok, symmap *symtab, wvec *buf)
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
 {
 	char *str;
 
@@ -108,16 +196,33 @@ static int assemble_ascii
 	}
 
 	/* NOTE: get rid of non-existent opcode the assembler wrote */
-	buf->n -= 1;
+	enc->code.n -= 1;
 	for (str = ptok->data.s; *str; ++str)
-		wvec_add(buf, *str);
-	wvec_add(buf, 0);
+		wvec_add(&enc->code, *str);
+	wvec_add(&enc->code, 0);
+
+	return 0;
+}
+
+static int assemble_global
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc)
+{
+	if (OPERAND_LABEL != ptok->type) {
+		fprintf(stderr, "Invalid label\n");
+		return -1;
+	}
+
+	/* NOTE: exports take no space, only matter in relocatable objects */
+	enc->code.n -= 1;
+	enc->idents.arr[ptok->data.id].global = 1;
 
 	return 0;
 }
 
 typedef int (*s16_operand)
-	(struct s16_parse_token *ptok, symmap *symtab, wvec *buf);
+	(struct s16_ast *ast, struct s16_parse_token *ptok,
+		struct s16_encoder *enc);
 
 struct s16_opdef {
 	char *mnemonic;
@@ -128,10 +233,10 @@ struct s16_opdef {
 	/* Number of operands */
 	size_t operand_cnt;
 	/* What each operand to be assembled as */
-	s16_operand operands[3];
+	s16_operand operands[4];
 };
 
-static struct s16_opdef opdefs[] = {
+static const struct s16_opdef opdefs[] = {
 	/* RRR instructions */
 	{ "add"  , 1, 0x0000, 3, { assemble_d, assemble_a, assemble_b } },
 	{ "sub"  , 1, 0x1000, 3, { assemble_d, assemble_a, assemble_b } },
@@ -148,6 +253,19 @@ static struct s16_opdef opdefs[] = {
 	{ "addc" , 1, 0xc000, 3, { assemble_d, assemble_a, assemble_b } },
 	{ "trap" , 1, 0xd000, 3, { assemble_d, assemble_a, assemble_b } },
 
+	/* EXP instructions */
+	{ "shiftl" , 2, 0xe000, 3, { assemble_d, assemble_xa, assemble_p } },
+	{ "shiftr" , 2, 0xe001, 3, { assemble_d, assemble_xa, assemble_p } },
+	{ "shiftra", 2, 0xe002, 3, { assemble_d, assemble_xa, assemble_p } },
+	{ "rotl"   , 2, 0xe003, 3, { assemble_d, assemble_xa, assemble_p } },
+	{ "rotr"   , 2, 0xe004, 3, { assemble_d, assemble_xa, assemble_p } },
+	{ "extract", 2, 0xe005, 4,
+		{ assemble_d, assemble_xa, assemble_p, assemble_w } },
+	{ "insert" , 2, 0xe006, 4,
+		{ assemble_d, assemble_xa, assemble_p, assemble_w } },
+	{ "bcopy"  , 2, 0xe007, 3, { assemble_d, assemble_xa, assemble_xb } },
+	{ "bfill"  , 2, 0xe008, 3, { assemble_d, assemble_xa, assemble_xb } },
+
 	/* RX instructions */
 	{ "lea"   , 2, 0xf000, 2, { assemble_d, assemble_ea } },
 	{ "load"  , 2, 0xf001, 2, { assemble_d, assemble_ea } },
@@ -170,60 +288,590 @@ static struct s16_opdef opdefs[] = {
 	/* Assembler commands */
 	{ "data", 1, 0x0000, 1, { assemble_const } },
 	{ "ascii", 1, 0x0000, 1, { assemble_ascii } },
+	{ "global", 0, 0x0000, 1, { assemble_global } },
+};
+
+#include "ophash.h"
+
+/*
+ * Find the opdefs index of a mnemonic, -1 if there is no such instruction
+ */
+static int lookup(const char *name, size_t len)
+{
+	int op;
+
+	if (len < OPHASH_MIN || len > OPHASH_MAX)
+		return -1;
+
+	op = ophash_table[OPHASH(name, len)];
+	if (-1 == op || strcmp(opdefs[op].mnemonic, name))
+		return -1;
+
+	return op;
+}
+
+long insn_length(struct s16_intern *names, struct s16_ast *ast,
+	struct s16_parse_token *ptok)
+{
+	const struct s16_opdef *opdef;
+	struct s16_parse_token *operand;
+	int op;
+
+	op = lookup(INTERN_NAME(names, ptok->data.id),
+		INTERN_LEN(names, ptok->data.id));
+	if (-1 == op)
+		return -1;
+	opdef = &opdefs[op];
+
+	if (assemble_ascii == opdef->operands[0]) {
+		operand = AST_CHILD(ast, ptok);
+		if (!operand || OPERAND_STRING_LITERAL != operand->type)
+			return -1;
+		return strlen(operand->data.s) + 1;
+	}
+	return opdef->length;
+}
+
+/*
+ * Instruction as insn_movable() sees it
+ */
+struct s16_flow {
+	/* Index into opdefs */
+	int op;
+	/* Register of each operand, 0 if it is not one */
+	uint8_t reg[4];
+	/* Effective address, a label id or a constant off ea_reg */
+	_Bool ea_label;
+	long ea_disp;
+	uint8_t ea_reg;
+	/* Starts a run of data words holding a numeric one other than 0 */
+	_Bool numeric_run;
+	/* Registers that may hold a numeric constant or point into such a
+	 *  run on entry, R0 is always numeric */
+	uint16_t num, ptr;
+	_Bool seen, queued;
 };
 
-#define ARRAY_SIZE(x) (sizeof(x) / sizeof(*x))
+VEC_GEN(struct s16_flow, flow)
+VEC_GEN(size_t, idx)
+
+#define NO_FLOW SIZE_MAX
+#define BIT(r) ((uint16_t) 1 << (r))
 
-static struct s16_opdef *lookup(const char *opcode)
+/*
+ * Whether an opdefs entry is an assembler command rather than an instruction
+ */
+static _Bool is_data(int op)
 {
+	return assemble_const == opdefs[op].operands[0]
+		|| assemble_ascii == opdefs[op].operands[0]
+		|| assemble_global == opdefs[op].operands[0];
+}
+
+/*
+ * Merge the registers flowing into an instruction, queueing it on change
+ */
+static void flow_to(flowvec *flows, idxvec *queue, size_t i,
+	uint16_t num, uint16_t ptr)
+{
+	struct s16_flow *f;
+
+	if (i >= flows->n)
+		return;
+	f = &flows->arr[i];
+	if (f->seen && (f->num | num) == f->num && (f->ptr | ptr) == f->ptr)
+		return;
+	f->seen = 1;
+	f->num |= num;
+	f->ptr |= ptr;
+	if (!f->queued) {
+		f->queued = 1;
+		idxvec_add(queue, i);
+	}
+}
+
+/*
+ * Record an OPCODE node, labels referenced other than as a direct jump
+ *  target are marked in taken
+ * Returns -1 if it is not a valid instruction
+ */
+static int flow_add(flowvec *flows, uint8_t *taken, struct s16_intern *names,
+	struct s16_ast *ast, struct s16_parse_token *ptok)
+{
+	const struct s16_opdef *opdef;
+	struct s16_parse_token *operand, *disp, *reg;
+	struct s16_flow f;
+	size_t k;
+
+	memset(&f, 0, sizeof f);
+	f.op = lookup(INTERN_NAME(names, ptok->data.id),
+		INTERN_LEN(names, ptok->data.id));
+	if (-1 == f.op)
+		return -1;
+	opdef = &opdefs[f.op];
+
+	operand = AST_CHILD(ast, ptok);
+	for (k = 0; k < opdef->operand_cnt; ++k) {
+		if (!operand)
+			return -1;
+
+		if (OPERAND_REGISTER == operand->type) {
+			f.reg[k] = operand->data.l;
+		} else if (OPERAND_LABEL == operand->type) {
+			taken[operand->data.id] = 1;
+		} else if (OPERAND_EADDRESS == operand->type) {
+			disp = AST_CHILD(ast, operand);
+			reg = disp ? AST_NEXT(ast, disp) : NULL;
+			if (!reg || OPERAND_REGISTER != reg->type)
+				return -1;
+			f.ea_reg = reg->data.l;
+			f.ea_label = OPERAND_LABEL == disp->type;
+			f.ea_disp = f.ea_label ? disp->data.id : disp->data.l;
+			/* NOTE: jumps and jal are opcodes f003 and up */
+			if (f.ea_label && (f.ea_reg || (opdef->opcode & 0xff) < 3))
+				taken[disp->data.id] = 1;
+		}
+
+		operand = AST_NEXT(ast, operand);
+	}
+
+	if (assemble_const == opdef->operands[0])
+		f.numeric_run = OPERAND_CONSTANT == AST_CHILD(ast, ptok)->type
+			&& 0 != (uint16_t) AST_CHILD(ast, ptok)->data.l;
+	flowvec_add(flows, f);
+	return 0;
+}
+
+/*
+ * Run a single instruction on the registers flowing into it and pass them
+ *  on to where it may continue
+ * Returns -1 if it uses a numeric constant as an address
+ */
+static int flow_step(flowvec *flows, idxvec *queue, idxvec *labels,
+	size_t i, uint16_t *jumped_num, uint16_t *jumped_ptr)
+{
+	const struct s16_opdef *opdef;
+	struct s16_flow *f;
+	uint16_t num, ptr, n, p;
+	_Bool fall, computed;
+	size_t target;
+	int kind;
+
+	f = &flows->arr[i];
+	f->queued = 0;
+	opdef = &opdefs[f->op];
+	num = f->num;
+	ptr = f->ptr;
+	fall = 1;
+	computed = 0;
+	target = NO_FLOW;
+
+#define NUM(r) (!!(num & BIT(r)))
+#define PTR(r) (!!(ptr & BIT(r)))
+#define SET(r, isnum, isptr) \
+	(num = (num & ~BIT(r)) | ((isnum) ? BIT(r) : 0), \
+	 ptr = (ptr & ~BIT(r)) | ((isptr) ? BIT(r) : 0))
+
+	kind = opdef->opcode >> 12;
+	if (is_data(f->op)) {
+		/* Data, which the program is assumed not to run */
+	} else if (0xd == kind) {
+		/* trap R0 exits, the others only touch memory */
+		fall = 0 != f->reg[0];
+	} else if (0x4 == kind) {
+		SET(15, 0, 0);
+	} else if (kind < 0xe) {
+		/* Numeric only if every source is, pointers stay pointers */
+		n = NUM(f->reg[1]) && (0x8 == kind || NUM(f->reg[2]));
+		p = PTR(f->reg[1]) || (0x8 != kind && PTR(f->reg[2]));
+		if (kind <= 0x3 || 0xc == kind)
+			SET(15, n, 0);
+		SET(f->reg[0], n, p);
+	} else if (0xe == kind) {
+		switch (opdef->opcode & 0xff) {
+		case 0x7:
+			if (NUM(f->reg[0]) || NUM(f->reg[1]))
+				return -1;
+			break;
+		case 0x8:
+			if (NUM(f->reg[0]))
+				return -1;
+			break;
+		case 0x6:
+			SET(f->reg[0], NUM(f->reg[0]) && NUM(f->reg[1]),
+				PTR(f->reg[0]) || PTR(f->reg[1]));
+			break;
+		default:
+			SET(f->reg[0], NUM(f->reg[1]), PTR(f->reg[1]));
+			break;
+		}
+	} else {
+		/* RX, the effective address is numeric off a numeric base */
+		n = !f->ea_label && NUM(f->ea_reg);
+		p = (f->ea_label && NO_FLOW != labels->arr[f->ea_disp]
+				&& labels->arr[f->ea_disp] < flows->n
+				&& flows->arr[labels->arr[f->ea_disp]].numeric_run)
+			|| PTR(f->ea_reg);
+		switch (opdef->opcode & 0xff) {
+		case 0x0:
+			SET(f->reg[0], n, p);
+			break;
+		case 0x1:
+			if (n)
+				return -1;
+			SET(f->reg[0], p, 0);
+			break;
+		case 0x2:
+			if (n)
+				return -1;
+			break;
+		default:
+			if (n)
+				return -1;
+			if (0x8 == (opdef->opcode & 0xff))
+				SET(f->reg[0], 0, 0);
+			fall = 0x3 != (opdef->opcode & 0xff);
+			if (f->ea_label && !f->ea_reg)
+				target = labels->arr[f->ea_disp];
+			else
+				computed = 1;
+			break;
+		}
+	}
+
+#undef NUM
+#undef PTR
+#undef SET
+
+	num |= BIT(0);
+	ptr &= ~BIT(0);
+	if (fall)
+		flow_to(flows, queue, i + 1, num, ptr);
+	if (NO_FLOW != target)
+		flow_to(flows, queue, target, num, ptr);
+	if (computed) {
+		*jumped_num |= num;
+		*jumped_ptr |= ptr;
+	}
+	return 0;
+}
+
+_Bool insn_movable(struct s16_intern *names, struct s16_ast *ast)
+{
+	struct s16_parse_token *ptok;
+	flowvec flows;
+	idxvec labels, queue, computed;
+	uint8_t *taken;
+	uint16_t jumped_num, jumped_ptr;
+	size_t node, i;
+	_Bool movable;
+
+	flowvec_init(&flows);
+	idxvec_init(&labels);
+	idxvec_init(&queue);
+	idxvec_init(&computed);
+	taken = calloc(names->atoms.n + 1, 1);
+	if (!taken)
+		abort();
+	for (i = 0; i < names->atoms.n; ++i)
+		idxvec_add(&labels, NO_FLOW);
+
+	movable = 0;
+	for (node = AST_ROOT(ast)->child; node; node = ptok->next) {
+		ptok = &ast->nodes.arr[node];
+		if (LABEL == ptok->type)
+			labels.arr[ptok->data.id] = flows.n;
+		else if (-1 == flow_add(&flows, taken, names, ast, ptok))
+			goto done;
+	}
+
+	/* A run is numeric if any of its words is, whichever label starts it */
+	for (i = flows.n; i-- > 1;)
+		if (is_data(flows.arr[i].op) && is_data(flows.arr[i - 1].op))
+			flows.arr[i - 1].numeric_run |= flows.arr[i].numeric_run;
+
+	/*
+	 * Jumps through a register may land after any call, or on any label
+	 *  whose address is taken
+	 */
+	for (i = 0; i < flows.n; ++i)
+		if (0xf008 == opdefs[flows.arr[i].op].opcode && i + 1 < flows.n)
+			idxvec_add(&computed, i + 1);
+	for (i = 0; i < labels.n; ++i)
+		if (taken[i] && NO_FLOW != labels.arr[i])
+			idxvec_add(&computed, labels.arr[i]);
+
+	jumped_num = 0;
+	jumped_ptr = 0;
+	flow_to(&flows, &queue, 0, BIT(0), 0);
+	while (queue.n) {
+		while (queue.n) {
+			i = queue.arr[--queue.n];
+			if (-1 == flow_step(&flows, &queue, &labels, i,
+					&jumped_num, &jumped_ptr))
+				goto done;
+		}
+
+		/* NOTE: unchanged registers queue nothing, which ends the loop */
+		if (jumped_num)
+			for (i = 0; i < computed.n; ++i)
+				flow_to(&flows, &queue, computed.arr[i],
+					jumped_num, jumped_ptr);
+	}
+	movable = 1;
+
+done:
+	flowvec_free(&flows);
+	idxvec_free(&labels);
+	idxvec_free(&queue);
+	idxvec_free(&computed);
+	free(taken);
+	return movable;
+}
+
+void encoder_init
+	(struct s16_encoder *enc, struct s16_intern *names, _Bool backpatch)
+{
+	enc->names = names;
+	identvec_init(&enc->idents);
+	wvec_init(&enc->code);
+	symvec_init(&enc->syms);
+	linevec_init(&enc->lines);
+	enc->line = 0;
+	enc->backpatch = backpatch;
+	enc->relocatable = 0;
+	fixvec_init(&enc->fixups);
+}
+
+void encoder_free(struct s16_encoder *enc)
+{
+	identvec_free(&enc->idents);
+	wvec_free(&enc->code);
+	symvec_free(&enc->syms);
+	linevec_free(&enc->lines);
+	fixvec_free(&enc->fixups);
+}
+
+void encoder_sync(struct s16_encoder *enc)
+{
+	struct s16_ident ident;
+	uint32_t id;
+
+	ident.addr = -1;
+	ident.global = 0;
+	for (id = enc->idents.n; id < enc->names->atoms.n; ++id) {
+		ident.op = lookup(INTERN_NAME(enc->names, id),
+			INTERN_LEN(enc->names, id));
+		identvec_add(&enc->idents, ident);
+	}
+}
+
+static void define_label(struct s16_encoder *enc, uint32_t id, uint16_t address)
+{
+	s16sym sym;
+
+	enc->idents.arr[id].addr = address;
+
+	sym.addr = address;
+	sym.len = INTERN_LEN(enc->names, id);
+	sym.name = INTERN_NAME(enc->names, id);
+	symvec_add(&enc->syms, sym);
+}
+
+int encode
+	(struct s16_encoder *enc, struct s16_ast *ast, struct s16_parse_token *ptok)
+{
+	const struct s16_opdef *opdef;
+	struct s16_parse_token *operand;
+	s16line line;
+	size_t j;
+
+	if (-1 == enc->idents.arr[ptok->data.id].op) {
+		fprintf(stderr, "Unkonwn instruction %s\n",
+			INTERN_NAME(enc->names, ptok->data.id));
+		return -1;
+	}
+	opdef = &opdefs[enc->idents.arr[ptok->data.id].op];
+
+	if (ptok->child_cnt != opdef->operand_cnt) {
+		fprintf(stderr,
+			"Invalid number of operands for %s\n", opdef->mnemonic);
+		return -1;
+	}
+
+	if (opdef->length) {
+		line.addr = enc->code.n;
+		line.line = enc->line;
+		linevec_add(&enc->lines, line);
+	}
+
+	wvec_add(&enc->code, opdef->opcode);
+
+	operand = AST_CHILD(ast, ptok);
+	for (j = 0; j < opdef->operand_cnt; ++j) {
+		if (-1 == opdef->operands[j](ast, operand, enc))
+			return -1;
+		operand = AST_NEXT(ast, operand);
+	}
+
+	return 0;
+}
+
+/*
+ * Convert the image to big-endian and write it out in one go
+ */
+static int write_image(int outfd, wvec *code)
+{
+	uint8_t *buf;
+	size_t j, off;
+	ssize_t len;
+
+	buf = malloc(code->n * 2);
+	if (!buf && code->n)
+		abort();
+
+	for (j = 0; j < code->n; ++j) {
+		buf[j * 2] = code->arr[j] >> 8;
+		buf[j * 2 + 1] = code->arr[j];
+	}
+
+	for (off = 0; off < code->n * 2; off += len) {
+		len = write(outfd, buf + off, code->n * 2 - off);
+		if (-1 == len) {
+			free(buf);
+			return -1;
+		}
+	}
+
+	free(buf);
+	return 0;
+}
+
+static int finish(struct s16_encoder *enc, int outfd, int dbgfd)
+{
+	if (-1 == write_image(outfd, &enc->code)) {
+		perror("output");
+		return -1;
+	}
+
+	if (-1 != dbgfd && -1 == dbginfo_write(dbgfd,
+			enc->syms.arr, enc->syms.n, enc->lines.arr, enc->lines.n))
+		perror("debug info");
+
+	return 0;
+}
+
+/*
+ * Write a relocatable object, every label reference has become a fixup
+ */
+static int write_object(struct s16_encoder *enc, int outfd)
+{
+	uint32_t *index, id;
+	struct s16_ident *ident;
+	struct s16_fixup *fixup;
+	objsymvec syms;
+	relocvec relocs;
+	s16objsym sym;
+	s16reloc reloc;
 	size_t i;
+	int ret;
+
+	index = malloc(enc->idents.n * sizeof *index + 1);
+	if (!index)
+		abort();
+	objsymvec_init(&syms);
+	relocvec_init(&relocs);
+	ret = -1;
+
+	/* Every identifier used as a label becomes a symbol */
+	for (id = 0; id < enc->idents.n; ++id) {
+		ident = &enc->idents.arr[id];
+		index[id] = UINT32_MAX;
+		if (-1 == ident->addr && !ident->global)
+			continue;
+
+		if (-1 == ident->addr) {
+			fprintf(stderr, "Undefined global %s\n",
+				INTERN_NAME(enc->names, id));
+			goto done;
+		}
 
-	for (i = 0; i < ARRAY_SIZE(opdefs); ++i) {
-		if (!strcmp(opdefs[i].mnemonic, opcode))
-			return &opdefs[i];
+		sym.name = INTERN_NAME(enc->names, id);
+		sym.len = INTERN_LEN(enc->names, id);
+		sym.flags = OBJSYM_DEFINED | (ident->global ? OBJSYM_GLOBAL : 0);
+		sym.value = ident->addr;
+		index[id] = syms.n;
+		objsymvec_add(&syms, sym);
 	}
 
-	return NULL;
+	/* Undefined labels are left for the linker to resolve */
+	for (fixup = enc->fixups.arr;
+			fixup < enc->fixups.arr + enc->fixups.n; ++fixup) {
+		if (UINT32_MAX == index[fixup->label]) {
+			sym.name = INTERN_NAME(enc->names, fixup->label);
+			sym.len = INTERN_LEN(enc->names, fixup->label);
+			sym.flags = 0;
+			sym.value = 0;
+			index[fixup->label] = syms.n;
+			objsymvec_add(&syms, sym);
+		}
+
+		reloc.word = fixup->word;
+		reloc.sym = index[fixup->label];
+		relocvec_add(&relocs, reloc);
+	}
+
+	for (i = 0; i < relocs.n; ++i)
+		enc->code.arr[relocs.arr[i].word] = 0;
+
+	ret = obj_write(outfd, enc->code.arr, enc->code.n,
+		syms.arr, syms.n, relocs.arr, relocs.n);
+	if (-1 == ret)
+		perror("output");
+
+done:
+	free(index);
+	objsymvec_free(&syms);
+	relocvec_free(&relocs);
+	return ret;
 }
 
-void assemble(struct s16_parse_token *root, int outfd)
+int assemble(struct s16_ast *ast, struct s16_intern *names,
+	int outfd, int dbgfd, _Bool object, long *line)
 {
 	uint16_t address;
-	symmap labels;
-	wvec code;
-	size_t i, j;
-	struct s16_opdef *opdef;
-	uint8_t tmp;
+	struct s16_encoder enc;
+	struct s16_parse_token *ptok, *operand;
+	const struct s16_opdef *opdef;
 
 	address = 0;
-	symmap_init(&labels);
-	wvec_init(&code);
+	encoder_init(&enc, names, 0);
+	encoder_sync(&enc);
+	enc.relocatable = object;
 
 	/* First stage */
-	for (i = 0; i < root->child_cnt; ++i)
-		switch (root->children[i]->type) {
+	for (ptok = AST_CHILD(ast, AST_ROOT(ast)); ptok;
+			ptok = AST_NEXT(ast, ptok))
+		switch (ptok->type) {
 		case LABEL:
-			symmap_put(&labels, root->children[i]->data.s, address);
+			define_label(&enc, ptok->data.id, address);
 			break;
-		case OPCODE:;
-			const char *opcode = root->children[i]->data.s;
-
-			opdef = lookup(opcode);
-			if (!opdef) {
-				fprintf(stderr,
-					"Unkonwn instruction %s\n", opcode);
-				goto done;
+		case OPCODE:
+			*line = ptok->line;
+			if (-1 == enc.idents.arr[ptok->data.id].op) {
+				fprintf(stderr, "Unkonwn instruction %s\n",
+					INTERN_NAME(names, ptok->data.id));
+				goto err;
 			}
+			opdef = &opdefs[enc.idents.arr[ptok->data.id].op];
 
 			/* Special length handling for string literals */
-			if (!strcmp(opcode, "ascii")) {
-				struct s16_parse_token *operand;
-
-				if (root->children[i]->child_cnt < 1 ||
-						(operand = root->children[i]->children[0])->type
+			if (assemble_ascii == opdef->operands[0]) {
+				if (ptok->child_cnt < 1 ||
+						(operand = AST_CHILD(ast, ptok))->type
 						!= OPERAND_STRING_LITERAL) {
 					fprintf(stderr, "Invalid string literal!\n");
-					goto done;
+					goto err;
 				}
 
 				address += strlen(operand->data.s) + 1; // +1 for NUL
@@ -237,35 +885,112 @@ void assemble(struct s16_parse_token *root, int outfd)
 		}
 
 	/* Second stage */
-	for (i = 0; i < root->child_cnt; ++i)
-		if (OPCODE == root->children[i]->type) {
-			// printf("%d %s\n", i, root->children[i]->data.s);
-
-			opdef = lookup(root->children[i]->data.s);
-			if (root->children[i]->child_cnt != opdef->operand_cnt) {
-				fprintf(stderr,
-					"Invalid number of operands for %s\n", opdef->mnemonic);
-				goto done;
-			}
+	for (ptok = AST_CHILD(ast, AST_ROOT(ast)); ptok;
+			ptok = AST_NEXT(ast, ptok))
+		if (OPCODE == ptok->type) {
+			enc.line = *line = ptok->line;
+			if (-1 == encode(&enc, ast, ptok))
+				goto err;
+		}
 
-			wvec_add(&code, opdef->opcode);
+	*line = 0;
+	if (object ? -1 == write_object(&enc, outfd)
+			: -1 == finish(&enc, outfd, dbgfd))
+		goto err;
 
-			for (j = 0; j < opdef->operand_cnt; ++j) {
-				if (-1 == opdef->operands[j]
-						(root->children[i]->children[j], &labels, &code))
-					goto done;
+	encoder_free(&enc);
+	return 0;
+
+err:
+	encoder_free(&enc);
+	return -1;
+}
+
+int assemble_stream
+	(FILE *in, s16_tokenizer lex, int outfd, int dbgfd, long *line)
+{
+	struct s16_encoder enc;
+	struct s16_intern names;
+	struct s16_arena arena;
+	tokvec toks;
+	struct s16_ast ast;
+	struct s16_parse_token *ptok;
+	struct s16_fixup *fixup;
+	struct s16_ident *ident;
+	char *buf;
+	size_t size;
+	long tmp;
+
+	intern_init(&names);
+	encoder_init(&enc, &names, 1);
+	arena_init(&arena);
+	tokvec_init(&toks);
+	initast(&ast);
+	buf = NULL;
+	size = 0;
+	*line = 0;
+
+	/* Encode line by line, only the image and label names are kept */
+	while (-1 != getline(&buf, &size, in)) {
+		enc.line = ++*line;
+		arena_reset(&arena);
+		toks.n = 0;
+
+		if (-1 == lex(buf, &tmp, &arena, &names, &toks)
+				|| -1 == genast(toks.arr, &tmp, &ast))
+			goto err;
+		encoder_sync(&enc);
+
+		for (ptok = AST_CHILD(&ast, AST_ROOT(&ast)); ptok;
+				ptok = AST_NEXT(&ast, ptok))
+			switch (ptok->type) {
+			case LABEL:
+				define_label(&enc, ptok->data.id, enc.code.n);
+				break;
+			case OPCODE:
+				if (-1 == encode(&enc, &ast, ptok))
+					goto err;
+				break;
+			default:
+				break;
 			}
-		}
+	}
 
-	/* Convert to big-endian and write to output */
-	for (i = 0; i < code.n; ++i) {
-		tmp = code.arr[i] >> 8;
-		write(outfd, &tmp, 1);
-		tmp = code.arr[i];
-		write(outfd, &tmp, 1);
+	if (ferror(in)) {
+		perror("input");
+		goto err;
 	}
 
-done:
-	symmap_free(&labels);
-	wvec_free(&code);
+	/* Backpatch forward references */
+	for (fixup = enc.fixups.arr;
+			fixup < enc.fixups.arr + enc.fixups.n; ++fixup) {
+		ident = &enc.idents.arr[fixup->label];
+		if (-1 == ident->addr) {
+			fprintf(stderr, "Undefined label %s\n",
+				INTERN_NAME(&names, fixup->label));
+			*line = fixup->line;
+			goto err;
+		}
+		enc.code.arr[fixup->word] = ident->addr;
+	}
+
+	if (-1 == finish(&enc, outfd, dbgfd))
+		goto err;
+
+	free(buf);
+	freeast(&ast);
+	tokvec_free(&toks);
+	arena_free(&arena);
+	encoder_free(&enc);
+	intern_free(&names);
+	return 0;
+
+err:
+	free(buf);
+	freeast(&ast);
+	tokvec_free(&toks);
+	arena_free(&arena);
+	encoder_free(&enc);
+	intern_free(&names);
+	return -1;
 }
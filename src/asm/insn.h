@@ -0,0 +1,113 @@
+#ifndef INSN_H
+#define INSN_H
+
+VEC_GEN(uint16_t, w)
+
+/*
+ * What an interned identifier means to the encoder
+ */
+struct s16_ident {
+	/* Label address, -1 if not defined (yet) */
+	int32_t addr;
+	/* Index into opdefs, -1 if not a mnemonic */
+	int8_t op;
+	/* Exported with global */
+	_Bool global;
+};
+
+VEC_GEN(struct s16_ident, ident)
+
+/*
+ * Reference to a label that was not yet defined when it was encoded
+ */
+struct s16_fixup {
+	/* Index of the word to patch */
+	size_t word;
+	/* Source line of the reference */
+	long line;
+	uint32_t label;
+};
+
+VEC_GEN(struct s16_fixup, fix)
+
+/*
+ * Encoder state, see encoder_init
+ */
+struct s16_encoder {
+	/* Identifier names, and their meaning indexed by id */
+	struct s16_intern *names;
+	identvec idents;
+	/* Encoded image */
+	wvec code;
+	/* Debug info */
+	symvec syms;
+	linevec lines;
+	/* Line being encoded */
+	long line;
+	/* Record undefined labels as fixups instead of failing */
+	_Bool backpatch;
+	/* Record every label reference as a fixup, for relocatable objects */
+	_Bool relocatable;
+	fixvec fixups;
+};
+
+/*
+ * Set up an encoder for identifiers interned into names, with backpatch set
+ *  references to undefined labels are recorded in fixups instead of failing
+ */
+void encoder_init
+	(struct s16_encoder *enc, struct s16_intern *names, _Bool backpatch);
+
+/*
+ * Catch up with identifiers interned since the last call, mnemonics are
+ *  resolved here once instead of on every use
+ */
+void encoder_sync(struct s16_encoder *enc);
+
+/*
+ * Encode a single OPCODE node at the end of the image
+ */
+int encode
+	(struct s16_encoder *enc, struct s16_ast *ast, struct s16_parse_token *ptok);
+
+void encoder_free(struct s16_encoder *enc);
+
+/*
+ * Number of words an OPCODE node encodes to, -1 if it is not an instruction
+ *  or assembler command
+ */
+long insn_length(struct s16_intern *names, struct s16_ast *ast,
+	struct s16_parse_token *ptok);
+
+/*
+ * Whether the code of an AST may move without breaking the program, names
+ *  is the intern table it was tokenized into
+ *  Numeric constants are followed through registers from lea and numeric
+ *  data words, other than 0, loaded directly or through a pointer into
+ *  their run. Code is not movable if any of them can end up as the
+ *  address of a jump, load, store or block operation, as that address
+ *  would point elsewhere afterwards. Neither is code with invalid
+ *  instructions. Values are not followed through other memory
+ */
+_Bool insn_movable(struct s16_intern *names, struct s16_ast *ast);
+
+/*
+ * Encode an AST in two passes and write the image to outfd, names is the
+ *  intern table its identifiers were tokenized into
+ *  Debug info is written to dbgfd unless it is -1
+ *  With object set a relocatable object is written instead of an image
+ *  On error -1 is returned and *line is set to the offending line
+ */
+int assemble(struct s16_ast *ast, struct s16_intern *names,
+	int outfd, int dbgfd, _Bool object, long *line);
+
+/*
+ * Tokenize with lex, parse and encode a source file one line at a time
+ *  Forward label references are backpatched once the whole file is read,
+ *  so memory use is proportional to the image rather than the source
+ *  On error -1 is returned and *line is set to the offending line
+ */
+int assemble_stream
+	(FILE *in, s16_tokenizer lex, int outfd, int dbgfd, long *line);
+
+#endif
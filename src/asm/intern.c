@@ -0,0 +1,89 @@
+/*
+ * Identifier interning
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vec.h>
+#include "arena.h"
+#include "intern.h"
+
+#define INITIAL_SIZE 256
+
+static uint32_t hash(const char *str, size_t len)
+{
+	uint32_t h;
+
+	/* djb2 over an explicit length, identifiers are not NUL-terminated */
+	for (h = 5381; len; --len)
+		h = h * 33 + (unsigned char) *str++;
+	return h;
+}
+
+void intern_init(struct s16_intern *tab)
+{
+	atomvec_init(&tab->atoms);
+	tab->size = INITIAL_SIZE;
+	tab->slots = calloc(tab->size, sizeof *tab->slots);
+	if (!tab->slots)
+		abort();
+	arena_init(&tab->arena);
+}
+
+static void grow(struct s16_intern *tab)
+{
+	size_t i, j;
+
+	free(tab->slots);
+	tab->size *= 2;
+	tab->slots = calloc(tab->size, sizeof *tab->slots);
+	if (!tab->slots)
+		abort();
+
+	/* Rehashing is cheap, every atom remembers its hash */
+	for (i = 0; i < tab->atoms.n; ++i) {
+		j = tab->atoms.arr[i].hash & (tab->size - 1);
+		while (tab->slots[j].id)
+			j = (j + 1) & (tab->size - 1);
+		tab->slots[j].hash = tab->atoms.arr[i].hash;
+		tab->slots[j].id = i + 1;
+	}
+}
+
+uint32_t intern(struct s16_intern *tab, const char *str, size_t len)
+{
+	struct s16_atom atom, *p;
+	uint32_t h;
+	size_t j;
+
+	h = hash(str, len);
+	for (j = h & (tab->size - 1); tab->slots[j].id;
+			j = (j + 1) & (tab->size - 1)) {
+		if (tab->slots[j].hash != h)
+			continue;
+		p = &tab->atoms.arr[tab->slots[j].id - 1];
+		if (p->len == len && !memcmp(p->name, str, len))
+			return tab->slots[j].id - 1;
+	}
+
+	atom.name = arena_strndup(&tab->arena, str, len);
+	atom.len = len;
+	atom.hash = h;
+	atomvec_add(&tab->atoms, atom);
+	tab->slots[j].hash = h;
+	tab->slots[j].id = tab->atoms.n;
+
+	/* Keep the load factor at or below a half */
+	if (2 * tab->atoms.n > tab->size)
+		grow(tab);
+
+	return tab->atoms.n - 1;
+}
+
+void intern_free(struct s16_intern *tab)
+{
+	atomvec_free(&tab->atoms);
+	free(tab->slots);
+	arena_free(&tab->arena);
+}
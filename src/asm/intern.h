@@ -0,0 +1,47 @@
+#ifndef INTERN_H
+#define INTERN_H
+
+struct s16_atom {
+	const char *name;
+	size_t len;
+	uint32_t hash;
+};
+
+VEC_GEN(struct s16_atom, atom)
+
+/*
+ * Open addressing slot, the hash is kept inline so probing past other
+ *  identifiers does not touch the atoms
+ */
+struct s16_intern_slot {
+	uint32_t hash;
+	/* Atom index + 1, 0 if the slot is empty */
+	uint32_t id;
+};
+
+/*
+ * String interning table, every distinct identifier is hashed and copied
+ *  once and from then on referred to by its index into atoms
+ */
+struct s16_intern {
+	atomvec atoms;
+	struct s16_intern_slot *slots;
+	size_t size;
+	struct s16_arena arena;
+};
+
+#define INTERN_NAME(tab, id) \
+	((tab)->atoms.arr[id].name)
+#define INTERN_LEN(tab, id) \
+	((tab)->atoms.arr[id].len)
+
+void intern_init(struct s16_intern *tab);
+
+/*
+ * Return the id of the len bytes at str, adding them if not yet present
+ */
+uint32_t intern(struct s16_intern *tab, const char *str, size_t len);
+
+void intern_free(struct s16_intern *tab);
+
+#endif
@@ -0,0 +1,684 @@
+/*
+ * Profile-guided code layout for s16asm -f
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vec.h>
+#include "arena.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parser.h"
+#include "../lib/symtab.h"
+#include "../lib/dbginfo.h"
+#include "insn.h"
+#include "layout.h"
+
+#define PROFILE_WORDS 0x10000
+#define NONE SIZE_MAX
+
+/* Instructions that end a basic block, or only hold data */
+enum s16_lkind {
+	L_CODE,
+	L_DATA,
+	L_JUMP,
+	L_JCOND,
+	L_EXIT, /* trap R0 always exits */
+};
+
+struct s16_block {
+	/* Root list entries making it up, [first, end) */
+	size_t first, end;
+	/* A label at its start, NONE if it has none yet */
+	size_t label;
+	/* Label node made up for it, 0 if none */
+	size_t label_node;
+	/* Executions of its first instruction */
+	unsigned long count;
+	/* Entry of the jump ending it and what kind it is, L_CODE if none */
+	size_t jump;
+	enum s16_lkind term;
+	/* Blocks jumped and fallen through to, NONE if there are none */
+	size_t target, fall;
+	/* How often each of those was taken */
+	unsigned long taken, fallen;
+	/* Holds no instructions */
+	_Bool data;
+	/* Neighbours in its chain, NONE at either end */
+	size_t prev, next;
+	/* Union-find parent, the root stands for the chain */
+	size_t chain;
+};
+
+VEC_GEN(struct s16_block, block)
+VEC_GEN(size_t, idx)
+
+/*
+ * Control flow edge, weighted by how often it was taken
+ */
+struct s16_edge {
+	unsigned long weight;
+	size_t src, dst;
+};
+
+/*
+ * Chain in the order it is laid out
+ */
+struct s16_chain {
+	size_t head;
+	/* Entry chain, hot code, data, cold code, the chain that must end */
+	int rank;
+	unsigned long heat;
+};
+
+/* What to do with the jump ending a block once it is laid out */
+enum s16_fix {
+	FIX_NONE,
+	FIX_INVERT,
+	FIX_ADD_JUMP,
+	FIX_DROP_JUMP,
+};
+
+struct s16_layout {
+	struct s16_ast *ast;
+	struct s16_intern *names;
+	unsigned long *counts, *taken;
+
+	/* Root list entries, and the address each one had */
+	idxvec entries;
+	idxvec addrs;
+	blockvec blocks;
+	/* Block started by each label, NONE if undefined, indexed by id */
+	idxvec label_block;
+
+	uint32_t jump_id;
+	/* Labels made up so far */
+	size_t fresh;
+};
+
+#define NODE(l, i) \
+	(&(l)->ast->nodes.arr[i])
+
+static const struct {
+	const char *mnemonic;
+	enum s16_lkind kind;
+	/* Jump on the opposite condition */
+	const char *inverse;
+} kinds[] = {
+	{ "data", L_DATA, NULL }, { "ascii", L_DATA, NULL },
+	{ "global", L_DATA, NULL },
+	{ "trap", L_EXIT, NULL }, { "jump", L_JUMP, NULL },
+	{ "jumpc0", L_JCOND, "jumpc1" }, { "jumpc1", L_JCOND, "jumpc0" },
+	{ "jumpf", L_JCOND, "jumpt" }, { "jumpt", L_JCOND, "jumpf" },
+	{ "jumplt", L_JCOND, "jumpge" }, { "jumpge", L_JCOND, "jumplt" },
+	{ "jumple", L_JCOND, "jumpgt" }, { "jumpgt", L_JCOND, "jumple" },
+	{ "jumpne", L_JCOND, "jumpeq" }, { "jumpeq", L_JCOND, "jumpne" },
+};
+
+#define KIND_CNT (sizeof kinds / sizeof *kinds)
+
+static uint32_t intern_str(struct s16_intern *names, const char *str)
+{
+	return intern(names, str, strlen(str));
+}
+
+static int classify(struct s16_layout *l, size_t node)
+{
+	size_t i;
+
+	for (i = 0; i < KIND_CNT; ++i)
+		if (intern_str(l->names, kinds[i].mnemonic) == NODE(l, node)->data.id)
+			return i;
+	return -1;
+}
+
+static enum s16_lkind kind_of(struct s16_layout *l, size_t node)
+{
+	size_t reg;
+	int i;
+
+	i = classify(l, node);
+	if (-1 == i)
+		return L_CODE;
+
+	if (L_EXIT == kinds[i].kind) {
+		reg = NODE(l, node)->child;
+		if (!reg || OPERAND_REGISTER != NODE(l, reg)->type
+				|| 0 != NODE(l, reg)->data.l)
+			return L_CODE;
+	}
+	return kinds[i].kind;
+}
+
+/*
+ * Label id of a "label[R0]" operand, NONE if it is anything else
+ */
+static size_t target(struct s16_layout *l, size_t node)
+{
+	size_t ea, disp;
+
+	for (ea = NODE(l, node)->child; ea; ea = NODE(l, ea)->next)
+		if (OPERAND_EADDRESS == NODE(l, ea)->type)
+			break;
+	if (!ea)
+		return NONE;
+
+	disp = NODE(l, ea)->child;
+	if (OPERAND_LABEL != NODE(l, disp)->type
+			|| 0 != NODE(l, NODE(l, disp)->next)->data.l)
+		return NONE;
+	return NODE(l, disp)->data.id;
+}
+
+static int load_profile(struct s16_layout *l, const char *profile)
+{
+	FILE *file;
+	char buf[128];
+	unsigned long addr, count, taken;
+	long line;
+
+	file = fopen(profile, "r");
+	if (!file) {
+		perror(profile);
+		return -1;
+	}
+
+	/* NOTE: timed profiles have a cycles column, which is not needed */
+	for (line = 1; fgets(buf, sizeof buf, file); ++line) {
+		if (3 != sscanf(buf, "%lx %lu %lu", &addr, &count, &taken)) {
+			fprintf(stderr, "%s: Invalid profile on line %ld\n",
+				profile, line);
+			fclose(file);
+			return -1;
+		}
+		if (addr < PROFILE_WORDS) {
+			l->counts[addr] = count;
+			l->taken[addr] = taken;
+		}
+	}
+
+	fclose(file);
+	return 0;
+}
+
+/*
+ * Collect the root list with the address of every entry, -1 if some
+ *  instruction is invalid
+ */
+static int scan(struct s16_layout *l)
+{
+	size_t node, addr;
+	long len;
+
+	addr = 0;
+	for (node = AST_ROOT(l->ast)->child; node; node = NODE(l, node)->next) {
+		idxvec_add(&l->entries, node);
+		idxvec_add(&l->addrs, addr);
+		if (OPCODE != NODE(l, node)->type)
+			continue;
+
+		/* NOTE: the encoder reports invalid instructions later on */
+		len = insn_length(l->names, l->ast, NODE(l, node));
+		if (-1 == len)
+			return -1;
+		addr += len;
+	}
+
+	return 0;
+}
+
+static unsigned long count_at(struct s16_layout *l, size_t entry)
+{
+	size_t addr;
+
+	addr = l->addrs.arr[entry];
+	return addr < PROFILE_WORDS ? l->counts[addr] : 0;
+}
+
+/*
+ * Split the program into basic blocks, each starts at a label or after
+ *  a jump. Calls do not end a block, their return lands right after them
+ */
+static void split(struct s16_layout *l)
+{
+	struct s16_block block, *b;
+	size_t i, node, label, last, addr;
+	_Bool ends;
+	enum s16_lkind kind;
+
+	ends = 1;
+	for (i = 0; i < l->entries.n; ++i) {
+		node = l->entries.arr[i];
+		if (ends || (LABEL == NODE(l, node)->type
+				&& LABEL != NODE(l, l->entries.arr[i - 1])->type)) {
+			block.first = i;
+			block.end = i;
+			block.label = NONE;
+			block.label_node = 0;
+			block.count = 0;
+			block.jump = NONE;
+			block.term = L_CODE;
+			block.target = NONE;
+			block.fall = NONE;
+			block.taken = 0;
+			block.fallen = 0;
+			block.data = 1;
+			block.prev = NONE;
+			block.next = NONE;
+			block.chain = l->blocks.n;
+			blockvec_add(&l->blocks, block);
+		}
+
+		b = &l->blocks.arr[l->blocks.n - 1];
+		b->end = i + 1;
+		ends = 0;
+
+		if (LABEL == NODE(l, node)->type) {
+			if (NONE == b->label)
+				b->label = NODE(l, node)->data.id;
+			l->label_block.arr[NODE(l, node)->data.id] = l->blocks.n - 1;
+			continue;
+		}
+
+		kind = kind_of(l, node);
+		if (L_DATA != kind && b->data) {
+			b->data = 0;
+			b->count = count_at(l, i);
+		}
+		if (L_JUMP == kind || L_JCOND == kind || L_EXIT == kind) {
+			b->jump = i;
+			b->term = kind;
+			ends = 1;
+		}
+	}
+
+	/* Successors and how often control went there */
+	for (i = 0; i < l->blocks.n; ++i) {
+		b = &l->blocks.arr[i];
+		if (b->data)
+			continue;
+
+		if (L_JUMP != b->term && L_EXIT != b->term && i + 1 < l->blocks.n)
+			b->fall = i + 1;
+		if (L_JUMP == b->term || L_JCOND == b->term) {
+			label = target(l, l->entries.arr[b->jump]);
+			if (NONE != label)
+				b->target = l->label_block.arr[label];
+
+			addr = l->addrs.arr[b->jump];
+			if (addr < PROFILE_WORDS) {
+				b->taken = l->taken[addr];
+				if (L_JCOND == b->term && l->counts[addr] > b->taken)
+					b->fallen = l->counts[addr] - b->taken;
+			}
+			continue;
+		}
+
+		if (L_EXIT == b->term)
+			continue;
+
+		/* Executions of the last instruction */
+		for (last = b->end; last-- > b->first;)
+			if (OPCODE == NODE(l, l->entries.arr[last])->type) {
+				b->fallen = count_at(l, last);
+				break;
+			}
+	}
+}
+
+static size_t find(struct s16_layout *l, size_t b)
+{
+	while (l->blocks.arr[b].chain != b) {
+		l->blocks.arr[b].chain =
+			l->blocks.arr[l->blocks.arr[b].chain].chain;
+		b = l->blocks.arr[b].chain;
+	}
+	return b;
+}
+
+static void link(struct s16_layout *l, size_t src, size_t dst)
+{
+	l->blocks.arr[src].next = dst;
+	l->blocks.arr[dst].prev = src;
+	l->blocks.arr[find(l, dst)].chain = find(l, src);
+}
+
+static int edge_cmp(const void *a, const void *b)
+{
+	const struct s16_edge *x = a, *y = b;
+
+	if (x->weight != y->weight)
+		return x->weight < y->weight ? 1 : -1;
+	if (x->src != y->src)
+		return x->src < y->src ? -1 : 1;
+	return x->dst < y->dst ? -1 : x->dst > y->dst;
+}
+
+static int chain_cmp(const void *a, const void *b)
+{
+	const struct s16_chain *x = a, *y = b;
+
+	if (x->rank != y->rank)
+		return x->rank - y->rank;
+	if (x->heat != y->heat)
+		return x->heat < y->heat ? 1 : -1;
+	return x->head < y->head ? -1 : x->head > y->head;
+}
+
+/*
+ * Whether chain c holds block b
+ */
+static _Bool holds(struct s16_layout *l, size_t c, size_t b)
+{
+	return NONE != b && find(l, b) == c;
+}
+
+/*
+ * Greedily chain blocks along the heaviest edges first, Pettis-Hansen style
+ *  The entry block stays at the head of its chain, and a block that may
+ *  fall off the end of the program at the tail of the last one
+ */
+static void form_chains(struct s16_layout *l, size_t last)
+{
+	struct s16_edge *edges, edge;
+	struct s16_block *b;
+	size_t i, n, a, c;
+
+	/* Data that follows data stays together */
+	for (i = 1; i < l->blocks.n; ++i)
+		if (l->blocks.arr[i - 1].data && l->blocks.arr[i].data)
+			link(l, i - 1, i);
+
+	edges = malloc(2 * l->blocks.n * sizeof *edges);
+	if (!edges)
+		abort();
+
+	n = 0;
+	for (i = 0; i < l->blocks.n; ++i) {
+		b = &l->blocks.arr[i];
+		edge.src = i;
+		if (NONE != b->target && b->taken) {
+			edge.dst = b->target;
+			edge.weight = b->taken;
+			edges[n++] = edge;
+		}
+		if (NONE != b->fall && b->fallen) {
+			edge.dst = b->fall;
+			edge.weight = b->fallen;
+			edges[n++] = edge;
+		}
+	}
+	qsort(edges, n, sizeof *edges, edge_cmp);
+
+	for (i = 0; i < n; ++i) {
+		edge = edges[i];
+		if (0 == edge.dst || edge.src == edge.dst || edge.src == last
+				|| l->blocks.arr[edge.dst].data
+				|| NONE != l->blocks.arr[edge.src].next
+				|| NONE != l->blocks.arr[edge.dst].prev)
+			continue;
+
+		a = find(l, edge.src);
+		c = find(l, edge.dst);
+		if (a == c)
+			continue;
+		/* The entry chain is laid out first, it cannot end the program */
+		if ((holds(l, a, 0) && holds(l, c, last))
+				|| (holds(l, c, 0) && holds(l, a, last)))
+			continue;
+
+		link(l, edge.src, edge.dst);
+	}
+
+	free(edges);
+}
+
+/*
+ * Label for the start of block b, made up if it has none
+ */
+static size_t block_label(struct s16_layout *l, size_t b)
+{
+	char name[32];
+	uint32_t id;
+
+	if (NONE != l->blocks.arr[b].label)
+		return l->blocks.arr[b].label;
+
+	/* NOTE: source identifiers cannot start with a dot */
+	do {
+		sprintf(name, ".L%zu", l->fresh++);
+		id = intern_str(l->names, name);
+	} while (id + 1 != l->names->atoms.n
+			|| (id < l->label_block.n && NONE != l->label_block.arr[id]));
+
+	l->blocks.arr[b].label = id;
+	l->blocks.arr[b].label_node = allocnode(l->ast, LABEL, dataid(id));
+	return id;
+}
+
+/*
+ * Build "jump label[R0]" on the given line
+ */
+static size_t make_jump(struct s16_layout *l, size_t label, long line)
+{
+	size_t jump, ea, disp, reg;
+
+	jump = allocnode(l->ast, OPCODE, dataid(l->jump_id));
+	ea = allocnode(l->ast, OPERAND_EADDRESS, datanull);
+	disp = allocnode(l->ast, OPERAND_LABEL, dataid(label));
+	reg = allocnode(l->ast, OPERAND_REGISTER, datalong(0));
+
+	NODE(l, jump)->line = line;
+	NODE(l, jump)->child = ea;
+	NODE(l, jump)->child_cnt = 1;
+	NODE(l, ea)->child = disp;
+	NODE(l, ea)->child_cnt = 2;
+	NODE(l, disp)->next = reg;
+	return jump;
+}
+
+/*
+ * Append node to the root list, *last is its last node so far
+ */
+static void append(struct s16_layout *l, size_t *last, size_t node)
+{
+	if (*last)
+		NODE(l, *last)->next = node;
+	else
+		AST_ROOT(l->ast)->child = node;
+	++AST_ROOT(l->ast)->child_cnt;
+	*last = node;
+}
+
+int layout(struct s16_ast *ast, struct s16_intern *names,
+	const char *profile, const char *path, FILE *report)
+{
+	struct s16_layout l;
+	struct s16_chain *chains, chain;
+	struct s16_block *b;
+	size_t i, j, k, n, last, node, ea, label, *order, *added;
+	size_t inverted, jumps, dropped, moved;
+	unsigned long before, after, w;
+	enum s16_fix *fix;
+	int kind, ret;
+
+	l.ast = ast;
+	l.names = names;
+	l.fresh = 0;
+	l.counts = calloc(PROFILE_WORDS, sizeof *l.counts);
+	l.taken = calloc(PROFILE_WORDS, sizeof *l.taken);
+	if (!l.counts || !l.taken)
+		abort();
+	idxvec_init(&l.entries);
+	idxvec_init(&l.addrs);
+	blockvec_init(&l.blocks);
+	idxvec_init(&l.label_block);
+	chains = NULL;
+	order = NULL;
+	added = NULL;
+	fix = NULL;
+
+	ret = load_profile(&l, profile);
+	if (-1 == ret)
+		goto done;
+
+	l.jump_id = intern_str(names, "jump");
+	for (i = 0; i < KIND_CNT; ++i)
+		intern_str(names, kinds[i].mnemonic);
+	for (i = 0; i < KIND_CNT; ++i)
+		if (kinds[i].inverse)
+			intern_str(names, kinds[i].inverse);
+	for (i = 0; i < names->atoms.n; ++i)
+		idxvec_add(&l.label_block, NONE);
+
+	/* Absolute addresses would not move with the code */
+	if (!insn_movable(names, ast) || -1 == scan(&l)) {
+		if (report)
+			fprintf(report, "%s: absolute addresses in use or invalid "
+				"instructions, keeping the layout\n", path);
+		goto done;
+	}
+
+	split(&l);
+	n = l.blocks.n;
+	if (n < 2)
+		goto done;
+
+	/* Code that may fall off the end has to stay there */
+	last = l.blocks.arr[n - 1].data || L_JUMP == l.blocks.arr[n - 1].term
+		|| L_EXIT == l.blocks.arr[n - 1].term ? NONE : n - 1;
+	form_chains(&l, last);
+
+	/* Rank the chains by how hot their code, or data, is */
+	chains = calloc(n, sizeof *chains);
+	if (!chains)
+		abort();
+	for (i = 0; i < n; ++i) {
+		b = &l.blocks.arr[i];
+		chains[find(&l, i)].heat += b->count;
+
+		/* Data is as hot as the code that refers to it */
+		for (j = b->first; j < b->end; ++j) {
+			node = l.entries.arr[j];
+			if (OPCODE != NODE(&l, node)->type)
+				continue;
+			for (ea = NODE(&l, node)->child; ea; ea = NODE(&l, ea)->next) {
+				label = OPERAND_EADDRESS == NODE(&l, ea)->type
+					? NODE(&l, ea)->child : ea;
+				if (OPERAND_LABEL != NODE(&l, label)->type)
+					continue;
+				label = l.label_block.arr[NODE(&l, label)->data.id];
+				if (NONE != label && l.blocks.arr[label].data)
+					chains[find(&l, label)].heat += count_at(&l, j);
+			}
+		}
+	}
+
+	k = 0;
+	for (i = 0; i < n; ++i) {
+		if (NONE != l.blocks.arr[i].prev)
+			continue;
+		chain.head = i;
+		chain.heat = chains[find(&l, i)].heat;
+		if (holds(&l, find(&l, i), 0))
+			chain.rank = 0;
+		else if (holds(&l, find(&l, i), last))
+			chain.rank = 4;
+		else if (l.blocks.arr[i].data)
+			chain.rank = 2;
+		else
+			chain.rank = chain.heat ? 1 : 3;
+		if (3 == chain.rank)
+			chain.heat = 0;
+		chains[k++] = chain;
+	}
+	qsort(chains, k, sizeof *chains, chain_cmp);
+
+	order = malloc(n * sizeof *order);
+	if (!order)
+		abort();
+	for (i = 0, j = 0; i < k; ++i)
+		for (node = chains[i].head; NONE != node;
+				node = l.blocks.arr[node].next)
+			order[j++] = node;
+
+	/* Decide how each block gets to its successors in the new order */
+	fix = calloc(n, sizeof *fix);
+	added = calloc(n, sizeof *added);
+	if (!fix || !added)
+		abort();
+	inverted = jumps = dropped = moved = 0;
+	before = after = 0;
+	for (i = 0; i < n; ++i) {
+		b = &l.blocks.arr[order[i]];
+		j = i + 1 < n ? order[i + 1] : NONE;
+		moved += order[i] != i;
+		before += b->taken;
+
+		if (L_JCOND == b->term && NONE != b->target && NONE != b->fall
+				&& b->fall != j && b->target == j) {
+			/* Jump to what used to follow on the opposite condition */
+			fix[order[i]] = FIX_INVERT;
+			label = block_label(&l, b->fall);
+			node = l.entries.arr[b->jump];
+			kind = classify(&l, node);
+			NODE(&l, node)->data.id =
+				intern_str(names, kinds[kind].inverse);
+			for (ea = NODE(&l, node)->child; ea; ea = NODE(&l, ea)->next)
+				if (OPERAND_EADDRESS == NODE(&l, ea)->type)
+					NODE(&l, NODE(&l, ea)->child)->data.id = label;
+			++inverted;
+			w = b->fallen;
+		} else if (L_JUMP == b->term && NONE != b->target
+				&& b->target == j) {
+			fix[order[i]] = FIX_DROP_JUMP;
+			++dropped;
+			w = 0;
+		} else if (NONE != b->fall && b->fall != j) {
+			fix[order[i]] = FIX_ADD_JUMP;
+			label = block_label(&l, b->fall);
+			added[order[i]] = make_jump(&l, label,
+				NODE(&l, l.entries.arr[b->end - 1])->line);
+			++jumps;
+			w = b->taken + b->fallen;
+		} else {
+			w = b->taken;
+		}
+		after += w;
+	}
+
+	/* Relink the root list in the new order */
+	node = 0;
+	AST_ROOT(ast)->child_cnt = 0;
+	for (i = 0; i < n; ++i) {
+		b = &l.blocks.arr[order[i]];
+		if (b->label_node)
+			append(&l, &node, b->label_node);
+		for (j = b->first; j < b->end; ++j)
+			if (FIX_DROP_JUMP != fix[order[i]] || j != b->jump)
+				append(&l, &node, l.entries.arr[j]);
+		if (added[order[i]])
+			append(&l, &node, added[order[i]]);
+	}
+	NODE(&l, node)->next = 0;
+
+	if (report)
+		fprintf(report, "%s: moved %zu of %zu blocks, inverted %zu jumps, "
+			"added %zu and removed %zu, taken jumps %lu -> %lu\n",
+			path, moved, n, inverted, jumps, dropped, before, after);
+
+done:
+	free(fix);
+	free(added);
+	free(order);
+	free(chains);
+	idxvec_free(&l.label_block);
+	blockvec_free(&l.blocks);
+	idxvec_free(&l.addrs);
+	idxvec_free(&l.entries);
+	free(l.taken);
+	free(l.counts);
+	return ret;
+}
@@ -0,0 +1,16 @@
+#ifndef LAYOUT_H
+#define LAYOUT_H
+
+/*
+ * Reorder the basic blocks of an AST after an execution profile written by
+ *  s16emu -p for the same source, so the hottest jumps fall through and hot
+ *  data follows hot code. Conditional jumps are inverted and jumps added
+ *  wherever needed to keep the control flow, the entry stays at address 0
+ * A summary is written to report unless it is NULL, programs with absolute
+ *  addresses are left alone as with peephole()
+ * Returns -1 if the profile could not be read, 0 otherwise
+ */
+int layout(struct s16_ast *ast, struct s16_intern *names,
+	const char *profile, const char *path, FILE *report);
+
+#endif
@@ -0,0 +1,139 @@
+/*
+ * Lexer throughput benchmark, runs the lexer and the one it replaced over the
+ *  same input and reports MB/s for each
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <vec.h>
+#include "arena.h"
+#include "intern.h"
+#include "lexer.h"
+
+/* The previous lexer, see lexer_old.c */
+int tokenize_old(char *str, long *line, struct s16_arena *arena,
+	struct s16_intern *names, tokvec *toks);
+
+static char *readfile(const char *path, size_t *size)
+{
+	FILE *fp;
+	char *str;
+	long len;
+
+	fp = fopen(path, "rb");
+	if (!fp)
+		return NULL;
+
+	if (-1 == fseek(fp, 0, SEEK_END) || -1 == (len = ftell(fp))
+			|| NULL == (str = malloc(len + 1))) {
+		fclose(fp);
+		return NULL;
+	}
+
+	rewind(fp);
+	*size = fread(str, 1, len, fp);
+	str[*size] = 0;
+	fclose(fp);
+	return str;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Tokenize str runs times, returns MB/s or a negative number on error
+ *  The token count of the last run is stored in *tok_cnt
+ */
+static double bench(s16_tokenizer fn, char *str, size_t size, int runs,
+	size_t *tok_cnt)
+{
+	struct s16_arena arena;
+	struct s16_intern names;
+	tokvec toks;
+	double start, total;
+	long line;
+	int i, ret;
+
+	total = 0;
+	for (i = 0; i < runs; ++i) {
+		arena_init(&arena);
+		intern_init(&names);
+		tokvec_init(&toks);
+
+		start = now();
+		ret = fn(str, &line, &arena, &names, &toks);
+		total += now() - start;
+
+		*tok_cnt = toks.n;
+		tokvec_free(&toks);
+		intern_free(&names);
+		arena_free(&arena);
+
+		if (-1 == ret) {
+			fprintf(stderr, "Error on line %ld\n", line);
+			return -1;
+		}
+	}
+
+	return size * (double) runs / total / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, runs;
+	char *str;
+	size_t size, new_cnt, old_cnt;
+	double new_rate, old_rate;
+
+	runs = 10;
+
+	while (-1 != (opt = getopt(argc, argv, "hn:")))
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind >= argc || runs < 1)
+		goto print_usage;
+
+	str = readfile(argv[optind], &size);
+	if (!str) {
+		perror(argv[optind]);
+		return 1;
+	}
+
+	new_rate = bench(tokenize, str, size, runs, &new_cnt);
+	old_rate = bench(tokenize_old, str, size, runs, &old_cnt);
+	free(str);
+	if (new_rate < 0 || old_rate < 0)
+		return 1;
+
+	printf("%zu bytes, %zu tokens, %d runs\n", size, new_cnt, runs);
+	printf("lexer:    %8.1f MB/s\n", new_rate);
+	printf("previous: %8.1f MB/s\n", old_rate);
+
+	if (new_cnt != old_cnt) {
+		fprintf(stderr, "Token count mismatch: %zu vs %zu\n",
+			new_cnt, old_cnt);
+		return 1;
+	}
+
+	return 0;
+
+print_usage:
+	fprintf(stderr, "Usage %s [-n RUNS] FILE\n", argv[0]);
+	return 1;
+}
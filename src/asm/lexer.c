@@ -8,47 +8,60 @@
 #include <stdlib.h>
 #include <string.h>
 #include <vec.h>
+#include "arena.h"
+#include "intern.h"
 #include "lexer.h"
 
-VEC_GEN(char, c)
+/*
+ * Skip blanks
+ */
+static char *span_space(char *str)
+{
+	while (' ' == *str || '\t' == *str || '\v' == *str || '\f' == *str)
+		++str;
+	return str;
+}
 
-/* NOTE: start with the longest for greedy matching */
-static char *regs[] = {
-	"15", "14", "13", "12", "11", "10", "9", "8",
-	"7", "6", "5", "4", "3", "2", "1", "0", NULL
-};
+/*
+ * Find the end of an identifier, [_0-9A-Za-z]
+ */
+static char *span_identifier(char *str)
+{
+	while ('_' == *str || isalnum((unsigned char) *str))
+		++str;
+	return str;
+}
 
 static int getregister(char *str, char **endptr)
 {
-	int i;
+	int reg;
 
-	switch (*str) {
-	case 'r':
-	case 'R':
-		++str;
-		for (i = 0; regs[i]; ++i)
-			if (!strncmp(regs[i], str, strlen(regs[i]))) {
-				if (endptr)
-					*endptr = str + strlen(regs[i]);
-				return 15 - i;
-			}
-	}
+	if (('r' != *str && 'R' != *str) || !isdigit((unsigned char) str[1]))
+		return -1;
 
-	return -1;
+	/* NOTE: greedy, R10 to R15 take two digits and anything else one */
+	reg = str[1] - '0';
+	str += 2;
+	if (1 == reg && '0' <= *str && *str <= '5')
+		reg = 10 + *str++ - '0';
+
+	if (endptr)
+		*endptr = str;
+
+	return reg;
 }
 
-static char *getidentifier(char *str, char **endptr)
+static uint32_t getidentifier
+	(struct s16_intern *names, char *str, char **endptr)
 {
 	char *ptr;
 
-	for (ptr = str; *ptr; ++ptr)
-		if ('_' != *ptr && !isalnum(*ptr))
-			break;
+	ptr = span_identifier(str);
 
 	if (endptr)
 		*endptr = ptr;
 
-	return strndup(str, ptr - str);
+	return intern(names, str, ptr - str);
 }
 
 static long getdigit(char digit)
@@ -89,24 +102,18 @@ static long getlong(char *str, char **endptr, int base)
 
 	result = 0;
 
-	/* Find the last valid digit */
+	/* Accumulate up to the first invalid digit */
 	for (ptr = str; *ptr; ++ptr) {
 		tmp = getdigit(*ptr);
 		if (-1 == tmp || tmp >= base)
 			break;
+		result = result * base + tmp;
 	}
 
 	/* Store endptr if requested */
 	if (endptr)
 		*endptr = ptr;
 
-	/* Calculate conversion */
-	tmp = 1;
-	while (--ptr >= str) {
-		result += getdigit(*ptr) * tmp;
-		tmp *= base;
-	}
-
 	return result;
 }
 
@@ -211,58 +218,58 @@ static int getcharacter(char *str, char **endptr)
 	return ch;
 }
 
-static char *getstrliteral(char *str, char **endptr)
+static char *getstrliteral
+	(struct s16_arena *arena, char *str, char **endptr)
 {
-	cvec tmp;
+	char *end, *buf, *out;
 	int ch;
 
 	if ('"' != *str++)
 		return NULL;
 
-	cvec_init(&tmp);
+	/* The decoded literal is never longer than its source */
+	for (end = str; *end && *end != '"'; ++end)
+		if ('\\' == *end && end[1])
+			++end;
+	out = buf = arena_alloc(arena, end - str + 1);
 
 	while (*str && *str != '"') {
 		ch = getcharacter(str, &str);
 		if (-1 == ch)
 			break;
-		cvec_add(&tmp, ch);
+		*out++ = ch;
 	}
 
-	if ('"' != *str++) {
-		cvec_free(&tmp);
+	if ('"' != *str++)
 		return NULL;
-	}
 
 	if (endptr)
 		*endptr = str;
 
-	cvec_add(&tmp, 0); /* NUL-terminate buffer */
-	return tmp.arr;
+	*out = 0; /* NUL-terminate buffer */
+	return buf;
 }
 
 static void append_token(
-	struct s16_lex_token ***next,
+	tokvec *toks,
 	enum s16_lex_type type,
 	union s16_lex_data data)
 {
-	**next = malloc(sizeof(struct s16_lex_token));
-	(**next)->type = type;
-	(**next)->data = data;
-	(**next)->next = NULL;
+	struct s16_lex_token tok;
 
-	*next = &(**next)->next;
+	tok.type = type;
+	tok.data = data;
+	tokvec_add(toks, tok);
 }
 
-struct s16_lex_token *tokenize(char *str, long *line)
+int tokenize(char *str, long *line, struct s16_arena *arena,
+	struct s16_intern *names, tokvec *toks)
 {
-	struct s16_lex_token *head, **next;
 	long tmp;
-	char *stmp;
-
-	head = NULL;
-	next = &head; /* First "next" pointer is written to the head itself */
+	char *stmp, *end;
 
 	*line = 1;
+	end = str + strlen(str);
 
 	while (*str)
 		switch (*str) {
@@ -271,13 +278,13 @@ struct s16_lex_token *tokenize(char *str, long *line)
 		case '\t':
 		case '\v':
 		case '\f':
-			++str;
+			str = span_space(str);
 			break;
 
 		/* Comment */
 		case ';':
-			while (*str && '\n' != *str)
-				++str;
+			stmp = memchr(str, '\n', end - str);
+			str = stmp ? stmp : end;
 			break;
 
 		/* Punctuators */
@@ -285,18 +292,18 @@ struct s16_lex_token *tokenize(char *str, long *line)
 		case ',':
 		case '[':
 		case ']':
-			append_token(&next, PUNCTUATOR, datachar(*str++));
+			append_token(toks, PUNCTUATOR, datachar(*str++));
 			break;
 
 		/* Newlines */
 		case '\r':
 			if ('\n' == *++str)
 				++str;
-			append_token(&next, PUNCTUATOR, datachar('\n'));
+			append_token(toks, PUNCTUATOR, datachar('\n'));
 			++*line;
 			break;
 		case '\n':
-			append_token(&next, PUNCTUATOR, datachar(*str++));
+			append_token(toks, PUNCTUATOR, datachar(*str++));
 			++*line;
 			break;
 
@@ -304,16 +311,16 @@ struct s16_lex_token *tokenize(char *str, long *line)
 		case '\'':
 			tmp = getcharacter(str, &str);
 			if (-1 == tmp || '\'' != *str++)
-				goto err;
-			append_token(&next, CONSTANT, datalong(tmp));
+				return -1;
+			append_token(toks, CONSTANT, datalong(tmp));
 			break;
 
 		/* String literal */
 		case '\"':
-			stmp = getstrliteral(str, &str);
+			stmp = getstrliteral(arena, str, &str);
 			if (!stmp)
-				goto err;
-			append_token(&next, STRING_LITERAL, datastr(stmp));
+				return -1;
+			append_token(toks, STRING_LITERAL, datastr(stmp));
 			break;
 
 		default:
@@ -321,40 +328,141 @@ struct s16_lex_token *tokenize(char *str, long *line)
 
 			/* Register */
 			if (-1 != tmp)
-				append_token(&next, REGISTER, datalong(tmp));
+				append_token(toks, REGISTER, datalong(tmp));
 
 			/* Identifier */
-			else if ('_' == *str || isalpha(*str))
-				append_token(&next, IDENTIFIER,
-					datastr(getidentifier(str, &str)));
+			else if ('_' == *str || isalpha((unsigned char) *str))
+				append_token(toks, IDENTIFIER,
+					dataid(getidentifier(names, str, &str)));
 
 			/* Constant */
-			else if ('-' == *str || '+' == *str || isdigit(*str))
-				append_token(&next, CONSTANT,
+			else if ('-' == *str || '+' == *str
+					|| isdigit((unsigned char) *str))
+				append_token(toks, CONSTANT,
 					datalong(getconst(str, &str)));
 
 			/* Invalid token */
 			else
-				goto err;
+				return -1;
 		}
 
-	return head;
+	append_token(toks, END, datanull);
+	return 0;
+}
+
+/*
+ * Fields of the standard syntax are separated by blanks and end the line at
+ *  a comment
+ */
+#define IS_FIELD_END(c) \
+	(!(c) || ' ' == (c) || '\t' == (c) || '\v' == (c) || '\f' == (c) \
+		|| '\r' == (c) || '\n' == (c) || ';' == (c))
 
-err:
-	freetokens(head);
-	return NULL;
+static char *span_blank(char *str)
+{
+	while (' ' == *str || '\t' == *str || '\v' == *str || '\f' == *str
+			|| '\r' == *str)
+		++str;
+	return str;
 }
 
-void freetokens(struct s16_lex_token *head)
+static int getstdconst(char *str, char **endptr, long *val)
 {
-	struct s16_lex_token *tmp;
-
-	while (head) {
-		tmp = head->next;
-		if (IDENTIFIER == head->type
-				|| STRING_LITERAL == head->type)
-			free(head->data.s);
-		free(head);
-		head = tmp;
+	char *ptr;
+	_Bool sign;
+
+	/* NOTE: unlike the flexible syntax a leading 0 does not mean octal */
+	sign = 0;
+	if ('$' == *str) {
+		*val = getlong(++str, &ptr, 16);
+	} else if ('#' == *str) {
+		*val = getlong(++str, &ptr, 2);
+	} else {
+		if ('-' == *str || '+' == *str)
+			sign = '-' == *str++;
+		*val = getlong(str, &ptr, 10);
 	}
+
+	if (ptr == str)
+		return -1;
+	if (sign)
+		*val = -*val;
+
+	*endptr = ptr;
+	return 0;
+}
+
+int tokenize_std(char *str, long *line, struct s16_arena *arena,
+	struct s16_intern *names, tokvec *toks)
+{
+	long tmp;
+	char *end;
+
+	*line = 1;
+	end = str + strlen(str);
+
+	while (*str) {
+		/* Label, if the line does not start with a blank */
+		if ('_' == *str || isalpha((unsigned char) *str)) {
+			append_token(toks, IDENTIFIER,
+				dataid(getidentifier(names, str, &str)));
+			append_token(toks, PUNCTUATOR, datachar(':'));
+			if (!IS_FIELD_END(*str))
+				return -1;
+		} else if (!IS_FIELD_END(*str)) {
+			return -1;
+		}
+
+		/* Opcode */
+		str = span_blank(str);
+		if ('_' == *str || isalpha((unsigned char) *str)) {
+			append_token(toks, IDENTIFIER,
+				dataid(getidentifier(names, str, &str)));
+			if (!IS_FIELD_END(*str))
+				return -1;
+
+			/* Operands, without blanks in between */
+			str = span_blank(str);
+			while (!IS_FIELD_END(*str))
+				switch (*str) {
+				case ',':
+				case '[':
+				case ']':
+					append_token(toks, PUNCTUATOR, datachar(*str++));
+					break;
+
+				default:
+					tmp = getregister(str, &str);
+
+					/* Register */
+					if (-1 != tmp)
+						append_token(toks, REGISTER, datalong(tmp));
+
+					/* Label */
+					else if ('_' == *str || isalpha((unsigned char) *str))
+						append_token(toks, IDENTIFIER,
+							dataid(getidentifier(names, str, &str)));
+
+					/* Constant */
+					else if (-1 != getstdconst(str, &str, &tmp))
+						append_token(toks, CONSTANT, datalong(tmp));
+
+					/* Invalid token */
+					else
+						return -1;
+				}
+		} else if (!IS_FIELD_END(*str)) {
+			return -1;
+		}
+
+		/* Anything after the operand field is a comment */
+		str = memchr(str, '\n', end - str);
+		if (!str)
+			break;
+		append_token(toks, PUNCTUATOR, datachar(*str++));
+		++*line;
+	}
+
+	append_token(toks, END, datanull);
+	return 0;
 }
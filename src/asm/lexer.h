@@ -7,15 +7,18 @@ enum s16_lex_type {
 	REGISTER,       /* Register */
 	CONSTANT,       /* Numeric or character constant */
 	STRING_LITERAL, /* String literal */
+	END,            /* Sentinel after the last token */
 };
 
 union s16_lex_data {
-	char *s; /* IDENTIFIER and STRING_LITERAL */
-	char  c; /* PUCTUATOR */
-	long  l; /* REGISTER and CONSTANT */
+	uint32_t id; /* IDENTIFIER, index into the intern table */
+	char    *s;  /* STRING_LITERAL */
+	char     c;  /* PUCTUATOR */
+	long     l;  /* REGISTER and CONSTANT */
 };
 
 #define datanull    ((union s16_lex_data) { .s = NULL })
+#define dataid(x)   ((union s16_lex_data) { .id = x })
 #define datastr(x)  ((union s16_lex_data) { .s = x })
 #define datachar(x) ((union s16_lex_data) { .c = x })
 #define datalong(x) ((union s16_lex_data) { .l = x })
@@ -23,29 +26,41 @@ union s16_lex_data {
 struct s16_lex_token {
 	enum s16_lex_type type;
 	union s16_lex_data data;
-	struct s16_lex_token *next;
 };
 
+VEC_GEN(struct s16_lex_token, tok)
+
+#define IS_END(tok) \
+	(END == (tok)->type)
 #define IS_IDENTIFIER(tok) \
-	(tok && IDENTIFIER == (tok)->type)
+	(IDENTIFIER == (tok)->type)
 #define IS_REGISTER(tok) \
-	(tok && REGISTER == (tok)->type)
+	(REGISTER == (tok)->type)
 #define IS_CONSTANT(tok) \
-	(tok && CONSTANT == (tok)->type)
+	(CONSTANT == (tok)->type)
 #define IS_STRING_LITERAL(tok) \
-	(tok && STRING_LITERAL == (tok)->type)
+	(STRING_LITERAL == (tok)->type)
 #define IS_PUNCTUATOR(tok, x) \
-	(tok && PUNCTUATOR == (tok)->type && x == (tok)->data.c)
+	(PUNCTUATOR == (tok)->type && x == (tok)->data.c)
 
 /*
- * Tokenize a NUL-terminted input string
- *  On error NULL is returned and *line is set to the offending line
+ * Tokenize a NUL-terminted input string into a contiguous array ending in an
+ *  END token, identifiers are interned into names and string literals are
+ *  allocated from the arena
+ * On error -1 is returned and *line is set to the offending line
  */
-struct s16_lex_token *tokenize(char *str, long *line);
+int tokenize(char *str, long *line, struct s16_arena *arena,
+	struct s16_intern *names, tokvec *toks);
 
 /*
- * Free a linked list of tokens
+ * Same as tokenize, but for the column-based "standard" Sigma16 syntax
+ *  understood by tools/stdasm.py, the token stream is the same as for the
+ *  equivalent flexible syntax
  */
-void freetokens(struct s16_lex_token *head);
+int tokenize_std(char *str, long *line, struct s16_arena *arena,
+	struct s16_intern *names, tokvec *toks);
+
+typedef int (*s16_tokenizer)(char *str, long *line, struct s16_arena *arena,
+	struct s16_intern *names, tokvec *toks);
 
 #endif
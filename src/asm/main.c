@@ -1,6 +1,6 @@
 /*
- * Flexible Sigma16 assembler, if you want to assemble a Sigma16 file from
- *  the CS1S course at UofG you are probably looking for "tools/stdasm.py"
+ * Flexible Sigma16 assembler, files in the standard syntax used by the CS1S
+ *  course at UofG can be assembled with -S
  */
 
 #include <stdio.h>
@@ -8,9 +8,20 @@
 #include <stdlib.h>
 #include <string.h>
 #include <fcntl.h>
+#include <libgen.h>
+#include <pthread.h>
 #include <unistd.h>
+#include <vec.h>
+#include "arena.h"
+#include "intern.h"
 #include "lexer.h"
 #include "parser.h"
+#include "../lib/symtab.h"
+#include "../lib/dbginfo.h"
+#include "insn.h"
+#include "watch.h"
+#include "peephole.h"
+#include "layout.h"
 
 static char *readfile(char *path)
 {
@@ -42,29 +53,271 @@ err_close:
 }
 
 /*
- * Instruction encoder
+ * How every file of a run is assembled
  */
-void assemble(struct s16_parse_token *root, int outfd);
+struct s16_options {
+	s16_tokenizer lex;
+	_Bool stream, object;
+	/* Run the peephole pass */
+	_Bool optimize;
+	/* Execution profile to lay the code out after, NULL if none */
+	const char *profile;
+};
 
-
-int main(int argc, char *argv[])
+/*
+ * Assemble one source file into an image or a relocatable object, errors
+ *  and what the optional passes changed are reported on stderr
+ */
+static int assemble_file(char *path, const struct s16_options *opts,
+	int outfd, int dbgfd)
 {
-	int opt, outfd;
-	char *outfile;
 	char *str;
-
+	FILE *in;
 	long line;
-	struct s16_lex_token *tok;
-	struct s16_parse_token *root;
+	int ret;
+
+	struct s16_arena arena;
+	struct s16_intern names;
+	tokvec toks;
+	struct s16_ast ast;
+
+	/* Streaming mode reads the file one line at a time */
+	if (opts->stream) {
+		in = fopen(path, "r");
+		if (!in) {
+			perror(path);
+			return -1;
+		}
+
+		ret = assemble_stream(in, opts->lex, outfd, dbgfd, &line);
+		fclose(in);
+		goto done;
+	}
+
+	str = readfile(path);
+	if (!str) {
+		perror(path);
+		return -1;
+	}
+
+	arena_init(&arena);
+	intern_init(&names);
+	tokvec_init(&toks);
+	initast(&ast);
+
+	/* Lexical analysis, AST generation and encoding */
+	ret = opts->lex(str, &line, &arena, &names, &toks);
+	if (-1 != ret)
+		ret = genast(toks.arr, &line, &ast);
+
+	/* The profile refers to addresses before any other change */
+	if (-1 != ret && opts->profile) {
+		line = 0;
+		ret = layout(&ast, &names, opts->profile, path, stderr);
+	}
+	if (-1 != ret && opts->optimize)
+		peephole(&ast, &names, path, stderr);
+	if (-1 != ret)
+		ret = assemble(&ast, &names, outfd, dbgfd, opts->object, &line);
+
+	freeast(&ast);
+	tokvec_free(&toks);
+	intern_free(&names);
+	arena_free(&arena);
+	free(str);
+
+done:
+	if (-1 == ret && line)
+		fprintf(stderr, "%s: Error on line %ld\n", path, line);
+	else if (-1 == ret)
+		fprintf(stderr, "%s: Error\n", path);
+	return ret;
+}
+
+/*
+ * Files assembled into an output directory, shared by the worker threads
+ */
+struct s16_batch {
+	char **paths;
+	int cnt;
+	/* Next path to be picked up */
+	int next;
+	pthread_mutex_t lock;
+
+	const char *outdir;
+	const struct s16_options *opts;
+	_Bool dbginfo;
+	/* Number of files that failed */
+	int failed;
+};
+
+/*
+ * Open DIR/NAME.EXT where NAME is path's file name without its extension
+ */
+static int openoutput(const char *dir, char *path, const char *ext)
+{
+	char *copy, *name, *dot, *out;
+	int fd;
+
+	copy = strdup(path);
+	if (!copy)
+		abort();
+	name = basename(copy);
+	dot = strrchr(name, '.');
+	if (dot && dot != name)
+		*dot = 0;
+
+	out = malloc(strlen(dir) + strlen(name) + strlen(ext) + 3);
+	if (!out)
+		abort();
+	sprintf(out, "%s/%s.%s", dir, name, ext);
+
+	fd = open(out, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+	if (-1 == fd)
+		perror(out);
+
+	free(out);
+	free(copy);
+	return fd;
+}
+
+static void *worker(void *arg)
+{
+	struct s16_batch *batch;
+	int i, outfd, dbgfd, ret;
+
+	batch = arg;
+
+	for (;;) {
+		pthread_mutex_lock(&batch->lock);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+		if (i >= batch->cnt)
+			break;
+
+		ret = -1;
+		dbgfd = -1;
+		outfd = openoutput(batch->outdir, batch->paths[i],
+			batch->opts->object ? "o" : "bin");
+		if (-1 == outfd)
+			goto fail;
+		if (batch->dbginfo) {
+			dbgfd = openoutput(batch->outdir, batch->paths[i], "dbg");
+			if (-1 == dbgfd)
+				goto fail;
+		}
+
+		ret = assemble_file(batch->paths[i], batch->opts, outfd, dbgfd);
+
+	fail:
+		if (-1 != outfd)
+			close(outfd);
+		if (-1 != dbgfd)
+			close(dbgfd);
+		if (-1 == ret) {
+			pthread_mutex_lock(&batch->lock);
+			++batch->failed;
+			pthread_mutex_unlock(&batch->lock);
+		}
+	}
+
+	return NULL;
+}
+
+/*
+ * Assemble every file of the batch on a pool of jobs threads
+ */
+static int assemble_batch(struct s16_batch *batch, int jobs)
+{
+	pthread_t *threads;
+	int i, started;
+
+	if (jobs > batch->cnt)
+		jobs = batch->cnt;
+
+	threads = malloc(jobs * sizeof *threads);
+	if (!threads)
+		abort();
+
+	pthread_mutex_init(&batch->lock, NULL);
+	batch->next = 0;
+	batch->failed = 0;
+
+	/* If some threads fail to start the rest just do more of the work */
+	for (started = 0; started < jobs; ++started)
+		if (pthread_create(&threads[started], NULL, worker, batch))
+			break;
+	if (!started)
+		worker(batch);
+	for (i = 0; i < started; ++i)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&batch->lock);
+	free(threads);
+	return batch->failed ? -1 : 0;
+}
+
+int main(int argc, char *argv[])
+{
+	int opt, outfd, dbgfd, jobs, ret;
+	char *outfile, *dbgfile;
+	_Bool watch;
+	struct s16_options opts;
+	struct s16_batch batch;
 
 	outfile = NULL;
+	dbgfile = NULL;
+	dbgfd = -1;
+	watch = 0;
+	opts.lex = tokenize;
+	opts.stream = 0;
+	opts.object = 0;
+	opts.optimize = 0;
+	opts.profile = NULL;
+	batch.outdir = NULL;
+	batch.dbginfo = 0;
+	jobs = sysconf(_SC_NPROCESSORS_ONLN);
+	if (jobs < 1)
+		jobs = 1;
 
 	/* Parse arguments */
-	while (-1 != (opt = getopt(argc, argv, "ho:")))
+	while (-1 != (opt = getopt(argc, argv, "ho:d:swcSPf:O:gj:")))
 		switch (opt) {
 		case 'o':
 			outfile = optarg;
 			break;
+		case 'd':
+			dbgfile = optarg;
+			break;
+		case 's':
+			opts.stream = 1;
+			break;
+		case 'w':
+			watch = 1;
+			break;
+		case 'c':
+			opts.object = 1;
+			break;
+		case 'S':
+			opts.lex = tokenize_std;
+			break;
+		case 'P':
+			opts.optimize = 1;
+			break;
+		case 'f':
+			opts.profile = optarg;
+			break;
+		case 'O':
+			batch.outdir = optarg;
+			break;
+		case 'g':
+			batch.dbginfo = 1;
+			break;
+		case 'j':
+			jobs = atoi(optarg);
+			if (jobs < 1)
+				goto print_usage;
+			break;
 		default:
 		case 'h':
 			goto print_usage;
@@ -73,11 +326,34 @@ int main(int argc, char *argv[])
 	if (optind >= argc)
 		goto print_usage;
 
-	/* Open input file */
-	str = readfile(argv[optind]);
-	if (!str) {
-		perror(argv[optind]);
-		return 1;
+	/* Objects carry their own symbols and go through the two-pass encoder */
+	if (opts.object && (opts.stream || watch || dbgfile || batch.dbginfo))
+		goto print_usage;
+
+	/* The optional passes work on the whole program at once */
+	if ((opts.optimize || opts.profile) && (opts.stream || watch))
+		goto print_usage;
+
+	/* Several files go to an output directory, one file anywhere */
+	if (batch.outdir) {
+		/* A profile belongs to a single program */
+		if (outfile || dbgfile || watch || opts.profile)
+			goto print_usage;
+
+		batch.paths = argv + optind;
+		batch.cnt = argc - optind;
+		batch.opts = &opts;
+		return -1 == assemble_batch(&batch, jobs);
+	}
+
+	if (optind + 1 != argc || batch.dbginfo)
+		goto print_usage;
+
+	/* Watch mode keeps running and updates the output in place */
+	if (watch) {
+		if (!outfile || opts.stream)
+			goto print_usage;
+		return -1 == assemble_watch(argv[optind], opts.lex, outfile, dbgfile);
 	}
 
 	/* Open output file */
@@ -91,30 +367,31 @@ int main(int argc, char *argv[])
 		outfd = STDOUT_FILENO;
 	}
 
-	/* Lexical analysis */
-	tok = tokenize(str, &line);
-	if (!tok)
-		goto assemble_err;
-	/* Generate AST */
-	root = genast(tok, &line);
-	if (!root)
-		goto assemble_err;
-	/* Assemble AST */
-	assemble(root, outfd);
-
-	freetokens(tok);
-	freeast(root);
-	free(str);
-	close(outfd);
-	return 0;
+	/* Open debug info file */
+	if (dbgfile) {
+		dbgfd = open(dbgfile, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+		if (-1 == dbgfd) {
+			perror(dbgfile);
+			return 1;
+		}
+	}
 
-print_usage:
-	fprintf(stderr, "Usage %s [-o OUT] FILE\n", argv[0]);
-	return 1;
+	ret = assemble_file(argv[optind], &opts, outfd, dbgfd);
 
-assemble_err:
-	fprintf(stderr, "Error on line %ld\n", line);
-	free(str);
 	close(outfd);
+	if (-1 != dbgfd)
+		close(dbgfd);
+	return -1 == ret;
+
+print_usage:
+	fprintf(stderr,
+		"Usage %s [-S] [-s | [-P] [-f PROFILE]] [-o OUT] [-d DEBUGINFO] FILE\n"
+		"      %s [-S] [-P] [-f PROFILE] -c [-o OBJ] FILE\n"
+		"      %s [-S] -w -o OUT [-d DEBUGINFO] FILE\n"
+		"      %s [-S] [-s | -c] [-P] [-j JOBS] [-g] -O DIR FILE...\n"
+		"  -S  standard Sigma16 syntax instead of the flexible one\n"
+		"  -P  peephole optimisation, changes are listed on stderr\n"
+		"  -f  lay the code out after a profile written by s16emu -p\n",
+		argv[0], argv[0], argv[0], argv[0]);
 	return 1;
 }
@@ -0,0 +1,35 @@
+/* Generated by tools/ophash.py from insn.c, do not edit */
+#ifndef OPHASH_H
+#define OPHASH_H
+
+#define OPHASH_MIN 2
+#define OPHASH_MAX 7
+#define OPHASH_SIZE 128
+
+/* Only valid for OPHASH_MIN <= len <= OPHASH_MAX */
+#define OPHASH(s, len) \
+	(((len) * 1 + (unsigned char) (s)[0] * 2 + \
+		(unsigned char) (s)[(len) - 2] * 4 + \
+		(unsigned char) (s)[(len) - 1] * 24) & (OPHASH_SIZE - 1))
+
+/* Index into opdefs, or -1 if no mnemonic hashes to the slot */
+static const int8_t ophash_table[OPHASH_SIZE] = {
+	20, -1, 33, -1, -1, -1, 35, 23,
+	-1, -1, 34, -1, 26, -1, -1, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 22, -1, -1, -1,  8, 12, -1,
+	-1, -1, -1, -1, -1, -1, -1, -1,
+	-1, 29, -1, 25, -1, -1, -1, -1,
+	-1, -1, -1, -1, 38,  0, -1, -1,
+	-1, -1, -1, -1, -1, 19, -1, -1,
+	24, -1, -1, 39, -1, -1, -1,  7,
+	-1, -1, -1, -1, 10, 16, -1, -1,
+	-1,  2, -1, -1, -1, -1, 37, -1,
+	17, -1, -1,  5, 14,  9, -1, 11,
+	-1, 21, -1, -1, -1, -1, 27, -1,
+	18, -1, 32, -1, 15,  1, 36, -1,
+	13, -1, -1, -1, -1, -1, -1,  6,
+	40, 30, -1, 31, -1,  4, 28,  3,
+};
+
+#endif
@@ -4,109 +4,113 @@
 
 #include <stdint.h>
 #include <stdlib.h>
+#include <vec.h>
+#include "arena.h"
+#include "intern.h"
 #include "lexer.h"
 #include "parser.h"
 
-#include <stdio.h>
-
-static struct s16_parse_token *allocroot()
-{
-	struct s16_parse_token *token;
-
-	token = malloc(sizeof(struct s16_parse_token));
-	token->type = ROOT;
-	token->child_cnt = 0;
-	token->children = NULL;
-	return token;
-}
-
-static struct s16_parse_token *alloctoken
-	(enum s16_parse_type type, union s16_lex_data data)
+size_t allocnode
+	(struct s16_ast *ast, enum s16_parse_type type, union s16_lex_data data)
 {
-	struct s16_parse_token *token;
-
-	token = malloc(sizeof(struct s16_parse_token));
-	token->type = type;
-	token->data = data;
-	token->child_cnt = 0;
-	token->children = NULL;
-	return token;
+	struct s16_parse_token token;
+
+	token.type = type;
+	token.data = data;
+	token.line = 0;
+	token.child_cnt = 0;
+	token.child = 0;
+	token.next = 0;
+	nodevec_add(&ast->nodes, token);
+	return ast->nodes.n - 1;
 }
 
-static struct s16_parse_token *appendchild
-	(struct s16_parse_token *parent, enum s16_parse_type type,
-		union s16_lex_data data)
+/*
+ * Append a node to parent, *last tracks the last child so appending is O(1)
+ */
+static size_t appendchild
+	(struct s16_ast *ast, size_t parent, size_t *last,
+		enum s16_parse_type type, union s16_lex_data data)
 {
-	parent->children = reallocarray
-		(parent->children, ++parent->child_cnt, sizeof(parent->children[0]));
-	parent->children[parent->child_cnt - 1] = alloctoken(type, data);
-	return parent->children[parent->child_cnt - 1];
+	size_t node;
+
+	node = allocnode(ast, type, data);
+	if (*last)
+		ast->nodes.arr[*last].next = node;
+	else
+		ast->nodes.arr[parent].child = node;
+	++ast->nodes.arr[parent].child_cnt;
+	*last = node;
+	return node;
 }
 
-struct s16_parse_token *genast(struct s16_lex_token *tok, long *line)
+int genast(struct s16_lex_token *tok, long *line, struct s16_ast *ast)
 {
-	struct s16_parse_token *root, *opcode, *eaddress;
+	size_t root, label, opcode, eaddress;
+	size_t root_last, opcode_last, eaddress_last;
 
-	root = allocroot();
+	ast->nodes.n = 0;
+	root = allocnode(ast, ROOT, datanull);
+	root_last = 0;
 	*line = 1;
 
-	while (tok) {
+	while (!IS_END(tok)) {
 		/* Parse label if any */
-		if (IS_IDENTIFIER(tok) && IS_PUNCTUATOR(tok->next, ':')) {
-			appendchild(root, LABEL, tok->data);
-			tok = tok->next->next;
+		if (IS_IDENTIFIER(tok) && IS_PUNCTUATOR(tok + 1, ':')) {
+			label = appendchild(ast, root, &root_last, LABEL, tok->data);
+			ast->nodes.arr[label].line = *line;
+			tok += 2;
 		}
 
 		/* Opcode comes next */
 		if (IS_IDENTIFIER(tok)) {
-			opcode = appendchild(root, OPCODE, tok->data);
-			tok = tok->next;
+			opcode = appendchild(ast, root, &root_last, OPCODE, tok->data);
+			ast->nodes.arr[opcode].line = *line;
+			opcode_last = 0;
+			++tok;
 
-			while (!IS_PUNCTUATOR(tok, '\n')) {
+			/* NOTE: the last line need not end in a newline */
+			while (!IS_PUNCTUATOR(tok, '\n') && !IS_END(tok)) {
 				switch (tok->type) {
 				case IDENTIFIER:
-					if (IS_PUNCTUATOR(tok->next, '[')) {
-						eaddress = appendchild(opcode, OPERAND_EADDRESS, datanull);
-						appendchild(eaddress, OPERAND_LABEL, tok->data);
-						tok = tok->next->next;
-						if (!IS_REGISTER(tok) || !IS_PUNCTUATOR(tok->next, ']'))
-							goto err;
-						appendchild(eaddress, OPERAND_REGISTER, tok->data);
-						tok = tok->next->next;
-					} else {
-						appendchild(opcode, OPERAND_LABEL, tok->data);
-						tok = tok->next;
-					}
-					break;
 				case CONSTANT:
-					if (IS_PUNCTUATOR(tok->next, '[')) {
-						eaddress = appendchild(opcode, OPERAND_EADDRESS, datanull);
-						appendchild(eaddress, OPERAND_CONSTANT, tok->data);
-						tok = tok->next->next;
-						if (!IS_REGISTER(tok) || !IS_PUNCTUATOR(tok->next, ']'))
+					if (IS_PUNCTUATOR(tok + 1, '[')) {
+						eaddress = appendchild(ast, opcode, &opcode_last,
+							OPERAND_EADDRESS, datanull);
+						eaddress_last = 0;
+						appendchild(ast, eaddress, &eaddress_last,
+							IS_IDENTIFIER(tok) ? OPERAND_LABEL
+								: OPERAND_CONSTANT, tok->data);
+						tok += 2;
+						if (!IS_REGISTER(tok) || !IS_PUNCTUATOR(tok + 1, ']'))
 							goto err;
-						appendchild(eaddress, OPERAND_REGISTER, tok->data);
-						tok = tok->next->next;
+						appendchild(ast, eaddress, &eaddress_last,
+							OPERAND_REGISTER, tok->data);
+						tok += 2;
 					} else {
-						appendchild(opcode, OPERAND_CONSTANT, tok->data);
-						tok = tok->next;
+						appendchild(ast, opcode, &opcode_last,
+							IS_IDENTIFIER(tok) ? OPERAND_LABEL
+								: OPERAND_CONSTANT, tok->data);
+						++tok;
 					}
 					break;
 				case REGISTER:
-					appendchild(opcode, OPERAND_REGISTER, tok->data);
-					tok = tok->next;
+					appendchild(ast, opcode, &opcode_last,
+						OPERAND_REGISTER, tok->data);
+					++tok;
 					break;
 				case STRING_LITERAL:
-					appendchild(opcode, OPERAND_STRING_LITERAL, tok->data);
-					tok = tok->next;
+					appendchild(ast, opcode, &opcode_last,
+						OPERAND_STRING_LITERAL, tok->data);
+					++tok;
 					break;
 				default:
 					goto err;
 				}
 
 				if (IS_PUNCTUATOR(tok, ','))
-					tok = tok->next;
-				else if (!IS_PUNCTUATOR(tok, '\n'))
+					++tok;
+				else if (!IS_PUNCTUATOR(tok, '\n') && !IS_END(tok))
 					goto err;
 			}
 		}
@@ -114,29 +118,25 @@ struct s16_parse_token *genast(struct s16_lex_token *tok, long *line)
 		/* Skip all newlines */
 		if (IS_PUNCTUATOR(tok, '\n'))
 			while (IS_PUNCTUATOR(tok, '\n')) {
-				tok = tok->next;
+				++tok;
 				++*line;
 			}
-		else
+		else if (!IS_END(tok))
 			goto err;
 	}
 
-	return root;
+	return 0;
 
 err:
-	freeast(root);
-	return NULL;
+	return -1;
 }
 
-void freeast(struct s16_parse_token *root)
+void initast(struct s16_ast *ast)
 {
-	size_t i;
-
-	for (i = 0; i < root->child_cnt; ++i) {
-		freeast(root->children[i]);
-	}
+	nodevec_init(&ast->nodes);
+}
 
-	if (root->children)
-		free(root->children);
-	free(root);
+void freeast(struct s16_ast *ast)
+{
+	nodevec_free(&ast->nodes);
 }
@@ -17,20 +17,52 @@ struct s16_parse_token {
 	enum s16_parse_type type;
 	/* Token data (optional) */
 	union s16_lex_data data;
+	/* Source line of labels and opcodes */
+	long line;
 	/* Child count */
 	size_t child_cnt;
-	/* Children */
-	struct s16_parse_token **children;
+	/* Indices of the first child and the next sibling, 0 if none */
+	size_t child, next;
 };
 
+VEC_GEN(struct s16_parse_token, node)
+
+/*
+ * Flat AST, nodes refer to each other by index and the root is node 0
+ */
+struct s16_ast {
+	nodevec nodes;
+};
+
+#define AST_ROOT(ast) \
+	(&(ast)->nodes.arr[0])
+#define AST_CHILD(ast, ptok) \
+	((ptok)->child ? &(ast)->nodes.arr[(ptok)->child] : NULL)
+#define AST_NEXT(ast, ptok) \
+	((ptok)->next ? &(ast)->nodes.arr[(ptok)->next] : NULL)
+
+/*
+ * Create an empty AST
+ */
+void initast(struct s16_ast *ast);
+
+/*
+ * Allocate a node that is not linked into the tree yet, returns its index
+ *  NOTE: this may move the nodes, pointers to them must be looked up again
+ */
+size_t allocnode
+	(struct s16_ast *ast, enum s16_parse_type type, union s16_lex_data data);
+
 /*
- * Generate an AST out of a list of lexer tokens
+ * Generate an AST out of an END terminated array of lexer tokens
+ *  Any previous contents of the AST are discarded
+ *  On error -1 is returned and *line is set to the offending line
  */
-struct s16_parse_token *genast(struct s16_lex_token *tok, long *line);
+int genast(struct s16_lex_token *tok, long *line, struct s16_ast *ast);
 
 /*
  * Free an AST
  */
-void freeast(struct s16_parse_token *root);
+void freeast(struct s16_ast *ast);
 
 #endif
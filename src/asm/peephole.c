@@ -0,0 +1,385 @@
+/*
+ * Peephole optimiser for s16asm -P
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vec.h>
+#include "arena.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parser.h"
+#include "../lib/symtab.h"
+#include "../lib/dbginfo.h"
+#include "insn.h"
+#include "peephole.h"
+
+/* Instructions the rewrites care about */
+enum s16_pkind {
+	P_OTHER,
+	P_LEA,
+	P_LOAD,
+	P_STORE,
+	P_JUMP,  /* Unconditional jump */
+	P_JCOND, /* Conditional jumps and their aliases */
+	P_JAL,
+};
+
+struct s16_pinsn {
+	/* OPCODE node */
+	size_t node;
+	enum s16_pkind kind;
+	_Bool deleted;
+};
+
+VEC_GEN(struct s16_pinsn, pinsn)
+VEC_GEN(size_t, idx)
+
+struct s16_peephole {
+	struct s16_ast *ast;
+	struct s16_intern *names;
+	const char *path;
+	FILE *report;
+	size_t changes;
+
+	pinsnvec insns;
+	/* Instruction index each label points at, indexed by id */
+	idxvec labels;
+	uint32_t or_id;
+};
+
+#define NODE(p, i) \
+	(&(p)->ast->nodes.arr[i])
+#define NO_LABEL SIZE_MAX
+
+static uint32_t intern_str(struct s16_intern *names, const char *str)
+{
+	return intern(names, str, strlen(str));
+}
+
+static void note(struct s16_peephole *p, size_t node, const char *what)
+{
+	++p->changes;
+	if (p->report)
+		fprintf(p->report, "%s:%ld: %s\n", p->path, NODE(p, node)->line,
+			what);
+}
+
+/*
+ * Effective address operand of an RX instruction, 0 if there is none
+ */
+static size_t eaddress(struct s16_peephole *p, size_t node)
+{
+	size_t child;
+
+	for (child = NODE(p, node)->child; child; child = NODE(p, child)->next)
+		if (OPERAND_EADDRESS == NODE(p, child)->type)
+			return child;
+	return 0;
+}
+
+/*
+ * Label id of a "label[R0]" operand, NO_LABEL if it is anything else
+ */
+static size_t target(struct s16_peephole *p, size_t node)
+{
+	size_t ea, disp;
+
+	ea = eaddress(p, node);
+	if (!ea)
+		return NO_LABEL;
+	disp = NODE(p, ea)->child;
+	if (OPERAND_LABEL != NODE(p, disp)->type
+			|| 0 != NODE(p, NODE(p, disp)->next)->data.l)
+		return NO_LABEL;
+	return NODE(p, disp)->data.id;
+}
+
+/*
+ * First live instruction at or after i
+ */
+static size_t live(struct s16_peephole *p, size_t i)
+{
+	while (i < p->insns.n && p->insns.arr[i].deleted)
+		++i;
+	return i;
+}
+
+/*
+ * Instruction a label resolves to, taking deletions into account
+ */
+static size_t resolve(struct s16_peephole *p, size_t label)
+{
+	if (label >= p->labels.n || NO_LABEL == p->labels.arr[label])
+		return NO_LABEL;
+	return live(p, p->labels.arr[label]);
+}
+
+/*
+ * Turn "op Rd,disp[Ra]" into "or Rd,Rs,R0" in place, reusing its operands
+ */
+static void make_or(struct s16_peephole *p, size_t node, long rs)
+{
+	size_t ea, disp;
+
+	ea = eaddress(p, node);
+	disp = NODE(p, ea)->child;
+
+	NODE(p, node)->data.id = p->or_id;
+	NODE(p, node)->child_cnt = 3;
+
+	NODE(p, ea)->type = OPERAND_REGISTER;
+	NODE(p, ea)->data.l = rs;
+	NODE(p, ea)->child = 0;
+	NODE(p, ea)->child_cnt = 0;
+	NODE(p, ea)->next = disp;
+
+	NODE(p, disp)->type = OPERAND_REGISTER;
+	NODE(p, disp)->data.l = 0;
+	NODE(p, disp)->next = 0;
+}
+
+/*
+ * Retarget jumps to an unconditional jump at its final destination
+ */
+static void thread_jumps(struct s16_peephole *p)
+{
+	struct s16_pinsn *insn;
+	size_t label, next, t, steps, ea;
+
+	for (insn = p->insns.arr; insn < p->insns.arr + p->insns.n; ++insn) {
+		if (P_JUMP != insn->kind && P_JCOND != insn->kind
+				&& P_JAL != insn->kind)
+			continue;
+
+		label = target(p, insn->node);
+		if (NO_LABEL == label)
+			continue;
+
+		/* NOTE: the step limit ends cycles of jumps */
+		for (steps = 0; steps < p->insns.n; ++steps) {
+			t = resolve(p, label);
+			if (NO_LABEL == t || t >= p->insns.n
+					|| P_JUMP != p->insns.arr[t].kind)
+				break;
+			next = target(p, p->insns.arr[t].node);
+			if (NO_LABEL == next || next == label)
+				break;
+			label = next;
+		}
+
+		if (label != target(p, insn->node)) {
+			ea = eaddress(p, insn->node);
+			NODE(p, NODE(p, ea)->child)->data.id = label;
+			note(p, insn->node, "threaded jump through a jump");
+		}
+	}
+}
+
+/*
+ * Drop register copies that do nothing and shorten the others
+ */
+static void copies(struct s16_peephole *p)
+{
+	struct s16_pinsn *insn;
+	size_t ea, disp;
+	long rd, ra;
+
+	for (insn = p->insns.arr; insn < p->insns.arr + p->insns.n; ++insn) {
+		if (P_LEA != insn->kind || insn->deleted)
+			continue;
+
+		ea = eaddress(p, insn->node);
+		disp = NODE(p, ea)->child;
+		if (OPERAND_CONSTANT != NODE(p, disp)->type
+				|| 0 != NODE(p, disp)->data.l)
+			continue;
+
+		rd = NODE(p, NODE(p, insn->node)->child)->data.l;
+		ra = NODE(p, NODE(p, disp)->next)->data.l;
+		if (0 == rd || rd == ra) {
+			insn->deleted = 1;
+			note(p, insn->node, "removed lea that does nothing");
+		} else {
+			make_or(p, insn->node, ra);
+			note(p, insn->node, "shortened lea copy to or");
+		}
+	}
+}
+
+/*
+ * Remove jumps to the instruction right after them, back to front so runs
+ *  of them collapse
+ */
+static void jumps_to_next(struct s16_peephole *p)
+{
+	struct s16_pinsn *insn;
+	size_t label;
+
+	for (insn = p->insns.arr + p->insns.n; insn-- > p->insns.arr;) {
+		if (insn->deleted || (P_JUMP != insn->kind && P_JCOND != insn->kind))
+			continue;
+
+		label = target(p, insn->node);
+		if (NO_LABEL == label)
+			continue;
+
+		if (resolve(p, label) == live(p, insn - p->insns.arr + 1)) {
+			insn->deleted = 1;
+			note(p, insn->node, "removed jump to next instruction");
+		}
+	}
+}
+
+/*
+ * Forward the value of a store to a load of the same address right after
+ */
+static void store_load(struct s16_peephole *p)
+{
+	struct s16_pinsn *st, *ld;
+	size_t st_disp, ld_disp, i;
+	struct s16_parse_token *a, *b;
+	long rs, rd;
+
+	/* Every label that resolves somewhere */
+	uint8_t *targets;
+
+	targets = calloc(p->insns.n + 1, 1);
+	if (!targets)
+		abort();
+	for (i = 0; i < p->labels.n; ++i)
+		if (NO_LABEL != resolve(p, i))
+			targets[resolve(p, i)] = 1;
+
+	for (i = live(p, 0); i < p->insns.n; i = live(p, i + 1)) {
+		st = &p->insns.arr[i];
+		if (P_STORE != st->kind || live(p, i + 1) >= p->insns.n)
+			continue;
+		ld = &p->insns.arr[live(p, i + 1)];
+		if (P_LOAD != ld->kind || targets[ld - p->insns.arr])
+			continue;
+
+		/* Same displacement off the same register */
+		st_disp = NODE(p, eaddress(p, st->node))->child;
+		ld_disp = NODE(p, eaddress(p, ld->node))->child;
+		a = NODE(p, st_disp);
+		b = NODE(p, ld_disp);
+		if (a->type != b->type
+				|| (OPERAND_LABEL == a->type && a->data.id != b->data.id)
+				|| (OPERAND_CONSTANT == a->type
+					&& (uint16_t) a->data.l != (uint16_t) b->data.l)
+				|| NODE(p, a->next)->data.l != NODE(p, b->next)->data.l)
+			continue;
+
+		rs = NODE(p, NODE(p, st->node)->child)->data.l;
+		rd = NODE(p, NODE(p, ld->node)->child)->data.l;
+		if (0 == rd || rd == rs) {
+			ld->deleted = 1;
+			note(p, ld->node, "removed load of the value just stored");
+		} else {
+			make_or(p, ld->node, rs);
+			note(p, ld->node, "replaced load after store with or");
+		}
+	}
+
+	free(targets);
+}
+
+size_t peephole(struct s16_ast *ast, struct s16_intern *names,
+	const char *path, FILE *report)
+{
+	static const struct {
+		const char *mnemonic;
+		enum s16_pkind kind;
+	} kinds[] = {
+		{ "lea", P_LEA }, { "load", P_LOAD }, { "store", P_STORE },
+		{ "jump", P_JUMP }, { "jal", P_JAL },
+		{ "jumpc0", P_JCOND }, { "jumpc1", P_JCOND },
+		{ "jumpf", P_JCOND }, { "jumpt", P_JCOND },
+		{ "jumplt", P_JCOND }, { "jumple", P_JCOND },
+		{ "jumpne", P_JCOND }, { "jumpeq", P_JCOND },
+		{ "jumpge", P_JCOND }, { "jumpgt", P_JCOND },
+	};
+	struct s16_peephole p;
+	struct s16_pinsn insn;
+	size_t node, last, i;
+	uint32_t ids[sizeof kinds / sizeof *kinds];
+
+	p.ast = ast;
+	p.names = names;
+	p.path = path;
+	p.report = report;
+	p.changes = 0;
+	pinsnvec_init(&p.insns);
+	idxvec_init(&p.labels);
+
+	/* Interning every mnemonic up front keeps the ids below stable */
+	for (i = 0; i < sizeof kinds / sizeof *kinds; ++i)
+		ids[i] = intern_str(names, kinds[i].mnemonic);
+	p.or_id = intern_str(names, "or");
+	for (i = 0; i < names->atoms.n; ++i)
+		idxvec_add(&p.labels, NO_LABEL);
+
+	/* Collect the instructions, labels point at the one that follows */
+	for (node = AST_ROOT(ast)->child; node; node = NODE(&p, node)->next) {
+		if (LABEL == NODE(&p, node)->type) {
+			p.labels.arr[NODE(&p, node)->data.id] = p.insns.n;
+			continue;
+		}
+
+		insn.node = node;
+		insn.kind = P_OTHER;
+		insn.deleted = 0;
+		for (i = 0; i < sizeof kinds / sizeof *kinds; ++i)
+			if (ids[i] == NODE(&p, node)->data.id) {
+				insn.kind = kinds[i].kind;
+				break;
+			}
+
+		/* Leave malformed instructions for the encoder to report */
+		if (P_OTHER != insn.kind && !eaddress(&p, node))
+			insn.kind = P_OTHER;
+		if ((P_LEA == insn.kind || P_LOAD == insn.kind
+				|| P_STORE == insn.kind) && 2 != NODE(&p, node)->child_cnt)
+			insn.kind = P_OTHER;
+		pinsnvec_add(&p.insns, insn);
+	}
+
+	/* Retargeting jumps keeps every address where it was */
+	thread_jumps(&p);
+
+	if (insn_movable(names, ast)) {
+		copies(&p);
+		jumps_to_next(&p);
+		store_load(&p);
+	} else if (report) {
+		fprintf(report, "%s: absolute addresses in use, not removing code\n",
+			path);
+	}
+
+	/* Unlink deleted instructions, their labels move to what follows */
+	last = 0;
+	i = 0;
+	AST_ROOT(ast)->child_cnt = 0;
+	for (node = AST_ROOT(ast)->child; node; node = NODE(&p, node)->next) {
+		if (OPCODE == NODE(&p, node)->type && p.insns.arr[i++].deleted)
+			continue;
+
+		if (last)
+			NODE(&p, last)->next = node;
+		else
+			AST_ROOT(ast)->child = node;
+		++AST_ROOT(ast)->child_cnt;
+		last = node;
+	}
+	if (last)
+		NODE(&p, last)->next = 0;
+	else
+		AST_ROOT(ast)->child = 0;
+
+	pinsnvec_free(&p.insns);
+	idxvec_free(&p.labels);
+	return p.changes;
+}
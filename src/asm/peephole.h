@@ -0,0 +1,18 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+/*
+ * Optimise the instructions of an AST in place, names is the intern table it
+ *  was tokenized into. Each change is reported to report as path:line
+ *  unless it is NULL
+ * Returns the number of changes
+ *
+ * Rewrites only assume that code is not read or written as data. Those
+ *  that remove words are skipped for programs using numeric constants as
+ *  addresses, see insn_movable(), as those would no longer point at the
+ *  same place once code moves
+ */
+size_t peephole(struct s16_ast *ast, struct s16_intern *names,
+	const char *path, FILE *report);
+
+#endif
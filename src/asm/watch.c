@@ -0,0 +1,497 @@
+/*
+ * Incremental reassembly for s16asm -w
+ */
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <vec.h>
+#include "arena.h"
+#include "intern.h"
+#include "lexer.h"
+#include "parser.h"
+#include "../lib/symtab.h"
+#include "../lib/dbginfo.h"
+#include "insn.h"
+#include "watch.h"
+
+/*
+ * One source line and the words it was encoded to
+ */
+struct s16_wline {
+	/* Hash of the line's text, to tell which lines changed */
+	uint64_t hash;
+	/* Position of its words in the image */
+	size_t start, cnt;
+	/* Label defined on the line, -1 if none */
+	int32_t label;
+	/* Whether it holds an instruction, for the line table */
+	_Bool insn;
+	/* Label references, word is relative to start */
+	struct s16_fixup *relocs;
+	size_t reloc_cnt;
+};
+
+VEC_GEN(struct s16_wline, wline)
+VEC_GEN(int32_t, addr)
+VEC_GEN(size_t, patch)
+
+struct s16_watch {
+	char *path;
+	s16_tokenizer lex;
+	int outfd, dbgfd;
+
+	/* Identifiers stay interned across edits so their ids remain valid */
+	struct s16_intern names;
+	struct s16_encoder enc;
+	struct s16_arena arena;
+	tokvec toks;
+	struct s16_ast ast;
+
+	/* State of the last successful assembly */
+	wlinevec lines;
+	wvec image;
+	/* Label addresses indexed by identifier id */
+	addrvec addrs;
+};
+
+static uint64_t hashline(const char *str, size_t len)
+{
+	uint64_t h;
+
+	/* FNV-1a */
+	for (h = 0xcbf29ce484222325u; len; --len)
+		h = (h ^ (unsigned char) *str++) * 0x100000001b3u;
+	return h;
+}
+
+static char *readsource(const char *path, size_t *len)
+{
+	int fd;
+	struct stat st;
+	char *str;
+	ssize_t ret;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+		return NULL;
+
+	if (-1 == fstat(fd, &st) || !(str = malloc(st.st_size + 1))) {
+		close(fd);
+		return NULL;
+	}
+
+	for (*len = 0; *len < (size_t) st.st_size; *len += ret) {
+		ret = read(fd, str + *len, st.st_size - *len);
+		if (ret <= 0)
+			break;
+	}
+	str[*len] = 0;
+
+	close(fd);
+	return str;
+}
+
+/*
+ * Convert words [lo, hi) of the image to big-endian and write them in place
+ */
+static int writewords(int fd, const uint16_t *image, size_t lo, size_t hi)
+{
+	uint8_t *buf;
+	size_t j, off;
+	ssize_t len;
+
+	if (lo >= hi)
+		return 0;
+
+	buf = malloc((hi - lo) * 2);
+	if (!buf)
+		abort();
+	for (j = lo; j < hi; ++j) {
+		buf[(j - lo) * 2] = image[j] >> 8;
+		buf[(j - lo) * 2 + 1] = image[j];
+	}
+
+	for (off = 0; off < (hi - lo) * 2; off += len) {
+		len = pwrite(fd, buf + off, (hi - lo) * 2 - off, lo * 2 + off);
+		if (-1 == len) {
+			free(buf);
+			return -1;
+		}
+	}
+
+	free(buf);
+	return 0;
+}
+
+static int writedbginfo(struct s16_watch *w)
+{
+	struct s16_wline *l;
+	symvec syms;
+	linevec lines;
+	s16sym sym;
+	s16line line;
+	int ret;
+
+	symvec_init(&syms);
+	linevec_init(&lines);
+
+	for (l = w->lines.arr; l < w->lines.arr + w->lines.n; ++l) {
+		if (-1 != l->label) {
+			sym.addr = l->start;
+			sym.len = INTERN_LEN(&w->names, l->label);
+			sym.name = INTERN_NAME(&w->names, l->label);
+			symvec_add(&syms, sym);
+		}
+		if (l->insn) {
+			line.addr = l->start;
+			line.line = l - w->lines.arr + 1;
+			linevec_add(&lines, line);
+		}
+	}
+
+	ret = -1;
+	if (-1 != ftruncate(w->dbgfd, 0) && -1 != lseek(w->dbgfd, 0, SEEK_SET))
+		ret = dbginfo_write(w->dbgfd, syms.arr, syms.n, lines.arr, lines.n);
+
+	symvec_free(&syms);
+	linevec_free(&lines);
+	return ret;
+}
+
+/*
+ * Encode one NUL-terminated line into *l, appending its words to code
+ */
+static int encodeline
+	(struct s16_watch *w, char *str, long lineno, struct s16_wline *l,
+		wvec *code)
+{
+	struct s16_parse_token *ptok;
+	long tmp;
+	size_t j;
+
+	arena_reset(&w->arena);
+	w->toks.n = 0;
+	if (-1 == w->lex(str, &tmp, &w->arena, &w->names, &w->toks)
+			|| -1 == genast(w->toks.arr, &tmp, &w->ast))
+		return -1;
+	encoder_sync(&w->enc);
+
+	/* NOTE: the encoder never learns any label, so every reference ends
+	 *  up as a fixup that is resolved against the whole file later */
+	w->enc.code.n = 0;
+	w->enc.fixups.n = 0;
+	w->enc.lines.n = 0;
+	w->enc.line = lineno;
+
+	l->label = -1;
+	l->insn = 0;
+	for (ptok = AST_CHILD(&w->ast, AST_ROOT(&w->ast)); ptok;
+			ptok = AST_NEXT(&w->ast, ptok))
+		switch (ptok->type) {
+		case LABEL:
+			l->label = ptok->data.id;
+			break;
+		case OPCODE:
+			if (-1 == encode(&w->enc, &w->ast, ptok))
+				return -1;
+			l->insn = 1;
+			break;
+		default:
+			break;
+		}
+
+	l->start = code->n;
+	l->cnt = w->enc.code.n;
+	for (j = 0; j < w->enc.code.n; ++j)
+		wvec_add(code, w->enc.code.arr[j]);
+
+	l->reloc_cnt = w->enc.fixups.n;
+	l->relocs = NULL;
+	if (l->reloc_cnt) {
+		l->relocs = malloc(l->reloc_cnt * sizeof *l->relocs);
+		if (!l->relocs)
+			abort();
+		memcpy(l->relocs, w->enc.fixups.arr,
+			l->reloc_cnt * sizeof *l->relocs);
+	}
+
+	return 0;
+}
+
+static void freelines(struct s16_wline *l, size_t cnt)
+{
+	while (cnt--)
+		free(l++->relocs);
+}
+
+/*
+ * Bring the output up to date with the new source text
+ */
+static int update(struct s16_watch *w, char *text)
+{
+	struct s16_wline *old, *l, line;
+	wlinevec lines;
+	wvec mid, image;
+	addrvec addrs;
+	patchvec patches;
+	size_t new_cnt, pre, suf, i, j, lo, hi, written;
+	char **starts, *p;
+	uint64_t *hashes;
+	int32_t addr;
+	struct s16_fixup *r;
+	_Bool changed;
+
+	/* Split into lines */
+	new_cnt = 1;
+	for (p = text; *p; ++p)
+		new_cnt += '\n' == *p;
+	if (p > text && '\n' == p[-1])
+		--new_cnt;
+	starts = malloc((new_cnt + 1) * sizeof *starts);
+	hashes = malloc((new_cnt + 1) * sizeof *hashes);
+	if (!starts || !hashes)
+		abort();
+	for (p = text, i = 0; i < new_cnt; ++i) {
+		starts[i] = p;
+		p += strcspn(p, "\n");
+		hashes[i] = hashline(starts[i], p - starts[i]);
+		if (*p)
+			*p++ = 0;
+	}
+
+	/* Only lines between the unchanged prefix and suffix get re-encoded */
+	old = w->lines.arr;
+	for (pre = 0; pre < new_cnt && pre < w->lines.n
+			&& hashes[pre] == old[pre].hash; ++pre)
+		;
+	for (suf = 0; suf < new_cnt - pre && suf < w->lines.n - pre
+			&& hashes[new_cnt - 1 - suf]
+				== old[w->lines.n - 1 - suf].hash; ++suf)
+		;
+
+	wlinevec_init(&lines);
+	wvec_init(&mid);
+	for (i = 0; i < pre; ++i)
+		wlinevec_add(&lines, old[i]);
+	for (i = pre; i < new_cnt - suf; ++i) {
+		line.hash = hashes[i];
+		if (-1 == encodeline(w, starts[i], i + 1, &line, &mid)) {
+			fprintf(stderr, "%s: Error on line %zu\n", w->path, i + 1);
+			freelines(lines.arr + pre, lines.n - pre);
+			goto err;
+		}
+		wlinevec_add(&lines, line);
+	}
+	for (i = w->lines.n - suf; i < w->lines.n; ++i)
+		wlinevec_add(&lines, old[i]);
+
+	/* Splice the image, lines after the edit may have moved */
+	wvec_init(&image);
+	lo = pre < w->lines.n ? old[pre].start : w->image.n;
+	for (j = 0; j < lo; ++j)
+		wvec_add(&image, w->image.arr[j]);
+	for (j = 0; j < mid.n; ++j)
+		wvec_add(&image, mid.arr[j]);
+	for (i = pre; i < lines.n - suf; ++i)
+		lines.arr[i].start += lo;
+	for (j = suf ? old[w->lines.n - suf].start : w->image.n;
+			j < w->image.n; ++j)
+		wvec_add(&image, w->image.arr[j]);
+	for (i = lines.n - suf; i < lines.n; ++i)
+		lines.arr[i].start = i ? lines.arr[i - 1].start
+			+ lines.arr[i - 1].cnt : 0;
+	hi = image.n != w->image.n ? image.n : lo + mid.n;
+
+	/* Label addresses, later definitions win like in the two-pass mode */
+	addrvec_init(&addrs);
+	for (j = 0; j < w->names.atoms.n; ++j)
+		addrvec_add(&addrs, -1);
+	for (l = lines.arr; l < lines.arr + lines.n; ++l)
+		if (-1 != l->label)
+			addrs.arr[l->label] = l->start;
+
+	changed = 0;
+	for (j = 0; j < addrs.n; ++j)
+		changed |= addrs.arr[j] != (j < w->addrs.n ? w->addrs.arr[j] : -1);
+
+	/* Resolve the new lines, and the old ones only if some label moved.
+	 *  Nothing is written before all of them resolved, so a failed edit
+	 *  leaves the output as it was */
+	patchvec_init(&patches);
+	for (l = lines.arr; l < lines.arr + lines.n; ++l) {
+		if (!changed && (l < lines.arr + pre
+				|| l >= lines.arr + lines.n - suf))
+			continue;
+
+		for (r = l->relocs; r < l->relocs + l->reloc_cnt; ++r) {
+			addr = addrs.arr[r->label];
+			if (-1 == addr) {
+				fprintf(stderr, "Undefined label %s\n",
+					INTERN_NAME(&w->names, r->label));
+				fprintf(stderr, "%s: Error on line %zu\n",
+					w->path, l - lines.arr + 1);
+				freelines(lines.arr + pre, lines.n - suf - pre);
+				patchvec_free(&patches);
+				addrvec_free(&addrs);
+				wvec_free(&image);
+				goto err;
+			}
+
+			j = l->start + r->word;
+			if (lo <= j && j < hi) {
+				image.arr[j] = addr;
+				continue;
+			}
+
+			/* Words outside the rewritten span are patched one by one */
+			if (image.arr[j] == (uint16_t) addr)
+				continue;
+			image.arr[j] = addr;
+			patchvec_add(&patches, j);
+		}
+	}
+
+	/* Commit */
+	for (j = 0; j < patches.n; ++j)
+		if (-1 == writewords(w->outfd, image.arr, patches.arr[j],
+				patches.arr[j] + 1))
+			perror("output");
+	if (-1 == writewords(w->outfd, image.arr, lo, hi)
+			|| -1 == ftruncate(w->outfd, image.n * 2))
+		perror("output");
+	written = patches.n + hi - lo;
+	patchvec_free(&patches);
+
+	freelines(old + pre, w->lines.n - suf - pre);
+	wlinevec_free(&w->lines);
+	wvec_free(&w->image);
+	addrvec_free(&w->addrs);
+	w->lines = lines;
+	w->image = image;
+	w->addrs = addrs;
+
+	if (-1 != w->dbgfd && -1 == writedbginfo(w))
+		perror("debug info");
+
+	fprintf(stderr, "%s: %zu lines reassembled, %zu words written\n",
+		w->path, new_cnt - suf - pre, written);
+
+	wvec_free(&mid);
+	free(starts);
+	free(hashes);
+	return 0;
+
+err:
+	wlinevec_free(&lines);
+	wvec_free(&mid);
+	free(starts);
+	free(hashes);
+	return -1;
+}
+
+int assemble_watch(char *path, s16_tokenizer lex,
+	const char *outfile, const char *dbgfile)
+{
+	struct s16_watch w;
+	union {
+		struct inotify_event ev;
+		char buf[sizeof(struct inotify_event) + NAME_MAX + 1];
+	} u;
+	struct inotify_event *ev;
+	char *text, *dircopy, *namecopy, *name;
+	int fd, ret;
+	ssize_t len;
+	size_t size;
+	_Bool modified;
+
+	w.path = path;
+	w.lex = lex;
+	w.dbgfd = -1;
+	w.outfd = open(outfile, O_RDWR | O_CREAT, 0644);
+	if (-1 == w.outfd) {
+		perror(outfile);
+		return -1;
+	}
+	if (dbgfile) {
+		w.dbgfd = open(dbgfile, O_WRONLY | O_CREAT, 0644);
+		if (-1 == w.dbgfd) {
+			perror(dbgfile);
+			close(w.outfd);
+			return -1;
+		}
+	}
+
+	intern_init(&w.names);
+	encoder_init(&w.enc, &w.names, 1);
+	arena_init(&w.arena);
+	tokvec_init(&w.toks);
+	initast(&w.ast);
+	wlinevec_init(&w.lines);
+	wvec_init(&w.image);
+	addrvec_init(&w.addrs);
+
+	/* Editors often replace the file, so watch its directory instead */
+	dircopy = strdup(path);
+	namecopy = strdup(path);
+	if (!dircopy || !namecopy)
+		abort();
+	name = basename(namecopy);
+
+	ret = -1;
+	fd = inotify_init();
+	if (-1 == fd || -1 == inotify_add_watch(fd, dirname(dircopy),
+			IN_CLOSE_WRITE | IN_MOVED_TO)) {
+		perror(path);
+		goto done;
+	}
+
+	for (modified = 1;;) {
+		if (modified) {
+			text = readsource(path, &size);
+			if (!text)
+				perror(path);
+			else
+				update(&w, text);
+			free(text);
+		}
+
+		len = read(fd, &u, sizeof u);
+		if (-1 == len) {
+			perror(path);
+			break;
+		}
+
+		modified = 0;
+		for (ev = &u.ev; (char *) ev < u.buf + len;
+				ev = (struct inotify_event *)
+					((char *) (ev + 1) + ev->len))
+			modified |= ev->len && !strcmp(ev->name, name);
+	}
+
+done:
+	if (-1 != fd)
+		close(fd);
+	free(dircopy);
+	free(namecopy);
+	freelines(w.lines.arr, w.lines.n);
+	wlinevec_free(&w.lines);
+	wvec_free(&w.image);
+	addrvec_free(&w.addrs);
+	freeast(&w.ast);
+	tokvec_free(&w.toks);
+	arena_free(&w.arena);
+	encoder_free(&w.enc);
+	intern_free(&w.names);
+	close(w.outfd);
+	if (-1 != w.dbgfd)
+		close(w.dbgfd);
+	return ret;
+}
@@ -0,0 +1,13 @@
+#ifndef WATCH_H
+#define WATCH_H
+
+/*
+ * Assemble path, tokenized with lex, into outfile and keep reassembling it whenever it changes,
+ *  only re-encoding the lines that changed and rewriting the words of
+ *  outfile that differ. Debug info is rewritten too unless dbgfile is NULL
+ * Only returns on error
+ */
+int assemble_watch(char *path, s16_tokenizer lex,
+	const char *outfile, const char *dbgfile);
+
+#endif
@@ -8,93 +8,11 @@
 #include <getopt.h>
 #include <ncurses.h>
 #include <vec.h>
-#include <map.h>
 #include "lib/cpu.h"
+#include "lib/symtab.h"
+#include "lib/dbginfo.h"
 #include "lib/disasm.h"
 
-VEC_GEN(char, c)
-
-/*
- * Add a single symbol to the table
- */
-static int
-addsym(const char *line, rsymmap *rsymtab)
-{
-	char *sym, *p;
-	uint16_t addr;
-
-	p = strchr(line, ':');
-
-	if (!p) {
-		fprintf(stderr, "Invalid symbol table entry %s\n", line);
-		return -1;
-	}
-
-	sym  = strndup(line, p - line);
-	addr = strtol(p+1, NULL, 10);
-
-	rsymmap_put(rsymtab, addr, sym);
-	return 0;
-}
-
-/*
- * Load symbol table into a hash-table in memory
- */
-static int
-load_symtab(const char *path, rsymmap *rsymtab)
-{
-	FILE *file;
-	cvec line;
-
-	ssize_t len;
-	char buf[4096], *p;
-
-	file = fopen(path, "rb");
-	if (!file) {
-		perror(path);
-		return -1;
-	}
-
-	cvec_init(&line);
-
-	for (;;) {
-		len = fread(buf, 1, sizeof(buf), file);
-		if (-1 == len) {
-			perror(path);
-			goto err_close;
-		}
-
-		if (!len) {
-			if (line.n > 0) {
-				cvec_add(&line, 0);
-				addsym(line.arr, rsymtab);
-				line.n = 0;
-			}
-			break;
-		}
-
-		for (p = buf; p < buf + len; ++p) {
-			if (*p == '\n') {
-				if (line.n > 0) {
-					cvec_add(&line, 0);
-					addsym(line.arr, rsymtab);
-					line.n = 0;
-				}
-			} else {
-				cvec_add(&line, *p);
-			}
-		}
-	}
-
-	fclose(file);
-	cvec_free(&line);
-	return 0;
-err_close:
-	fclose(file);
-	cvec_free(&line);
-	return -1;
-}
-
 struct winbox {
 	WINDOW *border, *content;
 };
@@ -137,7 +55,7 @@ regs_refresh(struct winbox *regs, s16cpu *cpu)
 
 static
 void
-execute_debug(s16cpu *cpu, rsymmap *symtab)
+execute_debug(s16cpu *cpu, const s16symtab *symtab, const s16dbginfo *info)
 {
 	int height, width;
 
@@ -145,11 +63,14 @@ execute_debug(s16cpu *cpu, rsymmap *symtab)
 
 	struct winbox disasm;
 	char disbuf[50];
+	uint32_t line;
 
 	size_t cmdline_height;
 	struct winbox cmdline;
 	char lastcmd[100], cmd[100];
 
+	int ret;
+
 	initscr();
 	refresh();
 
@@ -161,10 +82,13 @@ execute_debug(s16cpu *cpu, rsymmap *symtab)
 	regs_refresh(&regs, cpu);
 	winbox_create(&cmdline, cmdline_height, width, height - cmdline_height, 0);
 	strcpy(lastcmd, "invalid");
+	ret = 1;
 
 	for (;;) {
 		disassemble(disbuf, sizeof(disbuf), &cpu->ram[cpu->pc], symtab);
 		wprintw(disasm.content, "%04x: %s", cpu->pc, disbuf);
+		if (info && (line = dbginfo_line(info, cpu->pc)))
+			wprintw(disasm.content, "\t; line %u", line);
 		winbox_refresh(&disasm);
 
 read_cmd:
@@ -186,7 +110,7 @@ parse_cmd:
 		}
 		memcpy(lastcmd, cmd, sizeof(lastcmd));
 
-		if (!execute(cpu))
+		if ((ret = execute(cpu)) <= 0)
 			break;
 
 		regs_refresh(&regs, cpu);
@@ -194,22 +118,30 @@ parse_cmd:
 	}
 
 	endwin();
+
+	if (ret < 0)
+		fprintf(stderr, "Illegal instruction %04x at %04x\n",
+			cpu->ir, (uint16_t) (cpu->pc - 1));
 }
 
 int
 main(int argc, char *argv[])
 {
 	int opt;
-	const char *symtab_path = NULL, *prog_path;
+	const char *symtab_path = NULL, *dbginfo_path = NULL, *prog_path;
 	s16cpu cpu;
-	rsymmap rsymtab;
+	s16symtab symtab;
+	s16dbginfo dbginfo, *info = NULL;
 
 	/* Parse command line */
-	while ((opt = getopt(argc, argv, "hs:")) != -1)
+	while ((opt = getopt(argc, argv, "hs:d:")) != -1)
 		switch (opt) {
 		case 's':
 			symtab_path = optarg;
 			break;
+		case 'd':
+			dbginfo_path = optarg;
+			break;
 		case 'h':
 		default:
 			goto print_usage;
@@ -222,7 +154,7 @@ main(int argc, char *argv[])
 	/* Make sure all registers and RAM is zeroed */
 	memset(&cpu, 0, sizeof cpu);
 	/* Initialize symbol table */
-	rsymmap_init(&rsymtab);
+	symtab_init(&symtab);
 
 	/* Load program into the CPU's RAM */
 	if (load_program(prog_path, &cpu) < 0) {
@@ -232,17 +164,24 @@ main(int argc, char *argv[])
 	printf("Program binary: %s\n", prog_path);
 
 	/* Load symbol table if specified */
-	if (symtab_path && load_symtab(symtab_path, &rsymtab) < 0)
-		perror(symtab_path);
+	if (symtab_path)
+		symtab_load(&symtab, symtab_path);
+
+	/* Load debug info if specified, its symbols are used without -s */
+	if (dbginfo_path && !dbginfo_load(&dbginfo, dbginfo_path))
+		info = &dbginfo;
 
 	/* Start debugger */
-	execute_debug(&cpu, &rsymtab);
+	execute_debug(&cpu,
+		info && !symtab_path ? &info->symtab : &symtab, info);
 
 	/* Free symbol table and exit */
-	rsymmap_free(&rsymtab);
+	symtab_free(&symtab);
+	if (info)
+		dbginfo_free(info);
 	return 0;
 
 print_usage:
-	fprintf(stderr, "Usage: %s [-s SYMTAB] PROG\n", argv[0]);
+	fprintf(stderr, "Usage: %s [-s SYMTAB] [-d DEBUGINFO] PROG\n", argv[0]);
 	return 1;
 }
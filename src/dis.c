@@ -5,8 +5,15 @@
 #include <stdio.h>
 #include <stdint.h>
 #include <stdlib.h>
-#include <map.h>
+#include <unistd.h>
+#include <vec.h>
+#include "lib/decode.h"
+#include "lib/symtab.h"
+#include "lib/dbginfo.h"
 #include "lib/disasm.h"
+#include "lib/cfg.h"
+
+#define MAX_ENTRIES 64
 
 // Load big endian file into memory in native endianness
 static void
@@ -31,23 +38,157 @@ load_full_file(FILE *fp, uint16_t **data, size_t *size)
     }
 }
 
+// Disassemble every word in order, the way the image was laid out
+static void
+linear_sweep(uint16_t *data, size_t words, const s16symtab *symtab)
+{
+    uint16_t *ptr;
+    char buf[4096];
+
+    for (ptr = data; ptr < data + words; ++ptr) {
+        ptr = disassemble(buf, sizeof buf, ptr, symtab);
+        printf("%s\n", buf);
+    }
+}
+
+// Symbol defined exactly at an address, NULL if none
+static const s16sym *
+exact_symbol(const s16dbginfo *info, uint16_t addr)
+{
+    const s16sym *sym;
+
+    if (!info || !(sym = symtab_lookup(&info->symtab, addr)))
+        return NULL;
+    return sym->addr == addr ? sym : NULL;
+}
+
+// Only static jump targets are known to be code addresses
+static const s16symtab *
+label_map(const s16insn *insn, const s16symtab *labels)
+{
+    return insn->attr & ATTR_JUMP && !insn->a ? labels : NULL;
+}
+
+// Print reachable code with block labels, everything else as data
+static void
+print_listing(s16cfg *cfg, uint16_t *data, const s16symtab *labels,
+    const s16dbginfo *info)
+{
+    size_t addr;
+    const s16insn *insn;
+    const s16sym *sym;
+    uint32_t line;
+    char buf[4096];
+
+    for (addr = 0; addr < cfg->size; ) {
+        if ((sym = exact_symbol(info, addr)))
+            printf("%.*s:\n", sym->len, sym->name);
+        else if (cfg->flags[addr] & CFG_LEADER)
+            printf("L%04zx:\n", addr);
+
+        if (!(cfg->flags[addr] & CFG_CODE)) {
+            printf("data 0x%04x\n", data[addr]);
+            ++addr;
+            continue;
+        }
+
+        insn = DECODE(data[addr]);
+        disassemble(buf, sizeof buf, data + addr, label_map(insn, labels));
+        if (info && (line = dbginfo_line(info, addr)))
+            printf("\t%s\t; line %u\n", buf, line);
+        else
+            printf("\t%s\n", buf);
+        addr += insn->len;
+    }
+}
+
+// Write the control flow graph in Graphviz DOT format
+static void
+print_dot(FILE *fp, s16cfg *cfg, uint16_t *data, const s16symtab *labels)
+{
+    size_t i;
+    uint32_t addr;
+    s16block *block;
+    const s16insn *insn;
+    char buf[4096];
+
+    fprintf(fp, "digraph cfg {\n");
+    fprintf(fp, "\tnode [shape=box fontname=monospace];\n");
+
+    for (i = 0; i < cfg->blocks.n; ++i) {
+        block = &cfg->blocks.arr[i];
+
+        fprintf(fp, "\tL%04x [label=\"L%04x:\\l", block->start, block->start);
+        for (addr = block->start; addr < block->end; addr += insn->len) {
+            insn = DECODE(data[addr]);
+            disassemble(buf, sizeof buf, data + addr, label_map(insn, labels));
+            fprintf(fp, "%s\\l", buf);
+        }
+        fprintf(fp, "\"%s];\n", block->indirect ? " style=dashed" : "");
+
+        if (CFG_NONE != block->next)
+            fprintf(fp, "\tL%04x -> L%04x;\n", block->start, block->next);
+        if (CFG_NONE != block->jump && cfg_lookup(cfg, block->jump))
+            fprintf(fp, "\tL%04x -> L%04x [color=blue];\n",
+                block->start, block->jump);
+        if (CFG_NONE != block->call && cfg_lookup(cfg, block->call))
+            fprintf(fp, "\tL%04x -> L%04x [style=dashed];\n",
+                block->start, block->call);
+    }
+
+    fprintf(fp, "}\n");
+}
+
 int
 main(int argc, char *argv[])
 {
+    int opt;
+    _Bool linear = 0;
+    const char *dot_path = NULL, *dbginfo_path = NULL;
+    uint16_t entries[MAX_ENTRIES];
+    size_t entry_cnt = 0, i;
+
     FILE *fp;
-    uint16_t *data, *ptr;
+    uint16_t *data;
     size_t words;
-    char buf[4096];
+
+    s16cfg cfg;
+    s16symtab labels;
+    char (*names)[6];
+    s16dbginfo dbginfo, *info = NULL;
+    const s16sym *sym;
+
+    // Parse command line
+    while ((opt = getopt(argc, argv, "hle:g:d:")) != -1)
+        switch (opt) {
+        case 'l':
+            linear = 1;
+            break;
+        case 'e':
+            if (entry_cnt >= MAX_ENTRIES) {
+                fprintf(stderr, "Too many entry points\n");
+                return 1;
+            }
+            entries[entry_cnt++] = strtol(optarg, NULL, 0);
+            break;
+        case 'g':
+            dot_path = optarg;
+            break;
+        case 'd':
+            dbginfo_path = optarg;
+            break;
+        case 'h':
+        default:
+            goto print_usage;
+        }
 
     // Make sure we got a filename argument
-    if (argc < 2) {
-        fprintf(stderr, "%s BINFILE\n", argv[0]);
-        return 1;
-    }
+    if (optind >= argc)
+        goto print_usage;
 
     // Open I/O handle on the provided path
-    if (!(fp = fopen(argv[1], "r"))) {
-        perror(argv[1]);
+    if (!(fp = fopen(argv[optind], "r"))) {
+        perror(argv[optind]);
         return 1;
     }
 
@@ -55,13 +196,59 @@ main(int argc, char *argv[])
     load_full_file(fp, &data, &words);
     fclose(fp);
 
-    // Disassemble all instructions
-    for (ptr = data; ptr < data + words; ++ptr) {
-        ptr = disassemble(buf, sizeof buf, ptr, NULL);
-        printf("%s\n", buf);
+    // Load debug info if specified
+    if (dbginfo_path && !dbginfo_load(&dbginfo, dbginfo_path))
+        info = &dbginfo;
+
+    if (linear) {
+        linear_sweep(data, words, info ? &info->symtab : NULL);
+        goto done;
+    }
+
+    // Recover control flow starting at address 0 and any extra entries
+    if (!entry_cnt)
+        entries[entry_cnt++] = 0;
+    if (cfg_build(&cfg, data, words, entries, entry_cnt) < 0)
+        abort();
+
+    // Name every basic block after its symbol or its address
+    symtab_init(&labels);
+    names = malloc((cfg.blocks.n ? cfg.blocks.n : 1) * sizeof *names);
+    if (!names)
+        abort();
+    for (i = 0; i < cfg.blocks.n; ++i) {
+        if ((sym = exact_symbol(info, cfg.blocks.arr[i].start))) {
+            symtab_add(&labels, sym->name, sym->len, sym->addr);
+            continue;
+        }
+        snprintf(names[i], sizeof *names, "L%04x", cfg.blocks.arr[i].start);
+        symtab_add(&labels, names[i], 5, cfg.blocks.arr[i].start);
     }
+    symtab_sort(&labels);
+
+    print_listing(&cfg, data, &labels, info);
 
-    // Free buffer and exit
+    if (dot_path) {
+        if (!(fp = fopen(dot_path, "w"))) {
+            perror(dot_path);
+        } else {
+            print_dot(fp, &cfg, data, &labels);
+            fclose(fp);
+        }
+    }
+
+    // Free buffers and exit
+    symtab_free(&labels);
+    free(names);
+    cfg_free(&cfg);
+done:
+    if (info)
+        dbginfo_free(info);
     free(data);
     return 0;
+
+print_usage:
+    fprintf(stderr, "Usage: %s [-l] [-e ENTRY]... [-g DOTFILE] [-d DEBUGINFO] "
+        "BINFILE\n", argv[0]);
+    return 1;
 }
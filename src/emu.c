@@ -5,31 +5,409 @@
 #include <stdio.h>
 #include <string.h>
 #include <stdint.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <vec.h>
 #include "lib/cpu.h"
+#include "lib/decode.h"
+#include "lib/symtab.h"
+#include "lib/dbginfo.h"
+#include "lib/cache.h"
+#include "lib/timing.h"
+
+/*
+ * Execution profile, how often each address was executed and how often the
+ *  instruction there jumped elsewhere
+ */
+static unsigned long counts[RAM_WORDS], taken[RAM_WORDS];
+
+static
+unsigned long
+cache_misses(const s16cpu *cpu)
+{
+	return (cpu->icache ? cpu->icache->miss_cnt : 0)
+		+ (cpu->dcache ? cpu->dcache->miss_cnt : 0);
+}
+
+/*
+ * Run step one instruction at a time for at most *budget instructions,
+ *  recording a profile if profile is set and cycles unless timing is NULL
+ *  *budget is decremented for every instruction run
+ */
+static
+int
+run_detailed(s16cpu *cpu, int (*step)(s16cpu *), _Bool profile,
+	s16timing *timing, unsigned long *budget)
+{
+	const s16insn *insn;
+	unsigned long misses;
+	uint16_t pc;
+	int ret, jumped;
+
+	ret = 1;
+	while (ret > 0 && *budget) {
+		--*budget;
+		pc = cpu->pc;
+		misses = cache_misses(cpu);
+		ret = step(cpu);
+
+		insn = DECODE(cpu->ir);
+		jumped = cpu->pc != (uint16_t) (pc + insn->len);
+		if (profile) {
+			++counts[pc];
+			taken[pc] += jumped;
+		}
+		if (timing)
+			timing_step(timing, insn, pc, jumped, cache_misses(cpu) - misses);
+	}
+
+	return ret;
+}
+
+/*
+ * Run the plain execute() for at most *budget instructions, see above
+ */
+static
+int
+fast_forward(s16cpu *cpu, unsigned long *budget)
+{
+	int ret;
+
+	ret = 1;
+	while (ret > 0 && *budget) {
+		--*budget;
+		ret = execute(cpu);
+	}
+
+	return ret;
+}
+
+/*
+ * Metrics measured per instruction in each sampled window
+ */
+enum {
+	METRIC_CYCLES,
+	METRIC_IMISS,
+	METRIC_DMISS,
+	METRIC_COUNT
+};
+
+/*
+ * Sampled simulation, every period instructions warmup are run in detail
+ *  to warm the caches up and then window are measured
+ */
+struct sampling {
+	unsigned long period, window, warmup;
+	/* Instructions run in total */
+	unsigned long long insns;
+	/* Per instruction metrics of the windows so far */
+	unsigned long samples;
+	double sum[METRIC_COUNT], sumsq[METRIC_COUNT];
+};
+
+static
+void
+sample_metrics(const s16cpu *cpu, const s16timing *timing,
+	double metrics[METRIC_COUNT])
+{
+	metrics[METRIC_CYCLES] = timing ? timing->cycles : 0;
+	metrics[METRIC_IMISS] = cpu->icache ? cpu->icache->miss_cnt : 0;
+	metrics[METRIC_DMISS] = cpu->dcache ? cpu->dcache->miss_cnt : 0;
+}
+
+/*
+ * Alternate between fast-forwarding and detailed windows, both engines
+ *  work on the same s16cpu so switching costs nothing
+ */
+static
+int
+run_sampled(s16cpu *cpu, int (*step)(s16cpu *), s16timing *timing,
+	struct sampling *sampling)
+{
+	double before[METRIC_COUNT], after[METRIC_COUNT], x;
+	unsigned long budget, ran;
+	size_t i;
+	int ret;
+
+	sampling->insns = 0;
+	sampling->samples = 0;
+	for (i = 0; i < METRIC_COUNT; ++i)
+		sampling->sum[i] = sampling->sumsq[i] = 0;
+
+	for (;;) {
+		budget = sampling->period - sampling->window - sampling->warmup;
+		ret = fast_forward(cpu, &budget);
+		sampling->insns +=
+			sampling->period - sampling->window - sampling->warmup - budget;
+		if (ret <= 0)
+			break;
+
+		budget = sampling->warmup;
+		ret = run_detailed(cpu, step, 0, timing, &budget);
+		sampling->insns += sampling->warmup - budget;
+		if (ret <= 0)
+			break;
+
+		/* Hazards are not carried over from the fast engine */
+		if (timing)
+			timing->fwrite = 0;
+		sample_metrics(cpu, timing, before);
+		budget = sampling->window;
+		ret = run_detailed(cpu, step, 0, timing, &budget);
+		ran = sampling->window - budget;
+		sampling->insns += ran;
+		sample_metrics(cpu, timing, after);
+
+		/* Only full windows, a short one at the end would skew the mean */
+		if (!budget) {
+			++sampling->samples;
+			for (i = 0; i < METRIC_COUNT; ++i) {
+				x = (after[i] - before[i]) / ran;
+				sampling->sum[i] += x;
+				sampling->sumsq[i] += x * x;
+			}
+		}
+		if (ret <= 0)
+			break;
+	}
+
+	return ret;
+}
+
+/*
+ * Extrapolate a metric to the whole run with a 95% confidence interval
+ */
+static
+void
+report_estimate(FILE *fp, const char *name, const struct sampling *sampling,
+	int metric)
+{
+	double mean, var, half;
+	unsigned long n;
+
+	n = sampling->samples;
+	mean = sampling->sum[metric] / n;
+	var = n > 1 ? (sampling->sumsq[metric] - n * mean * mean) / (n - 1) : 0;
+	half = n > 1 ? 1.96 * sqrt(var > 0 ? var / n : 0) : NAN;
+
+	fprintf(fp, "  %-16s %10.4f +- %.4f per instruction, "
+		"%.0f +- %.0f in total\n", name, mean, half,
+		mean * sampling->insns, half * sampling->insns);
+}
+
+static
+void
+report_sampling(FILE *fp, const s16cpu *cpu, const s16timing *timing,
+	const struct sampling *sampling)
+{
+	fprintf(fp, "Sampled %lu windows of %lu out of %llu instructions, "
+		"estimates with 95%% confidence intervals:\n", sampling->samples,
+		sampling->window, sampling->insns);
+	if (!sampling->samples)
+		return;
+
+	if (timing)
+		report_estimate(fp, "cycles", sampling, METRIC_CYCLES);
+	if (cpu->icache)
+		report_estimate(fp, "I-cache misses", sampling, METRIC_IMISS);
+	if (cpu->dcache)
+		report_estimate(fp, "D-cache misses", sampling, METRIC_DMISS);
+}
+
+/*
+ * Write the profile as "ADDR COUNT TAKEN" lines for every executed address,
+ *  followed by the CYCLES spent there when timing
+ */
+static
+int
+write_profile(const char *path, const s16timing *timing)
+{
+	FILE *file;
+	size_t addr;
+
+	file = fopen(path, "w");
+	if (!file) {
+		perror(path);
+		return -1;
+	}
+
+	for (addr = 0; addr < RAM_WORDS; ++addr) {
+		if (!counts[addr])
+			continue;
+		fprintf(file, "%04zx %lu %lu", addr, counts[addr], taken[addr]);
+		if (timing)
+			fprintf(file, " %lu", timing->by_addr[addr]);
+		fputc('\n', file);
+	}
+
+	if (fclose(file)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
 
 int
 main(int argc, char *argv[])
 {
 	s16cpu cpu;
 	ssize_t prog_size;
+	char *profile, *ispec, *dspec, *costs, *symtab_path, *dbginfo_path;
+	_Bool timed, sampled;
+	struct sampling sampling;
+	unsigned long budget;
+	s16cache icache, dcache;
+	s16timing timing;
+	s16symtab symtab;
+	s16dbginfo dbginfo;
+	const s16symtab *syms;
+	int (*step)(s16cpu *);
+	int opt, ret;
 
-	if (argc < 2)
+	profile = NULL;
+	ispec = NULL;
+	dspec = NULL;
+	costs = NULL;
+	timed = 0;
+	sampled = 0;
+	symtab_path = NULL;
+	dbginfo_path = NULL;
+	while (-1 != (opt = getopt(argc, argv, "hp:I:D:tc:S:s:d:")))
+		switch (opt) {
+		case 'p':
+			profile = optarg;
+			break;
+		case 'I':
+			ispec = optarg;
+			break;
+		case 'D':
+			dspec = optarg;
+			break;
+		case 't':
+			timed = 1;
+			break;
+		case 'c':
+			costs = optarg;
+			timed = 1;
+			break;
+		case 'S':
+			sampled = 1;
+			sampling.warmup = 0;
+			if (sscanf(optarg, "%lu:%lu:%lu", &sampling.period,
+					&sampling.window, &sampling.warmup) < 2
+					|| !sampling.window || sampling.period
+					< sampling.window + sampling.warmup)
+				goto print_usage;
+			break;
+		case 's':
+			symtab_path = optarg;
+			break;
+		case 'd':
+			dbginfo_path = optarg;
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind >= argc)
+		goto print_usage;
+
+	/* A profile of the sampled windows alone would be misleading */
+	if (sampled && (profile || !(ispec || dspec || timed)))
 		goto print_usage;
 
 	/* Make sure all registers and RAM is zeroed */
 	memset(&cpu, 0, sizeof cpu);
 
 	/* Load program into the CPU's RAM */
-	prog_size = load_program(argv[1], &cpu);
+	prog_size = load_program(argv[optind], &cpu);
 	if (prog_size < 0)
 		return 1;
 
-	/* Execute until an EXIT trap is hit */
-	while (execute(&cpu))
-		;
+	/* Simulated caches need the slower execute_cached() */
+	step = execute;
+	if (ispec) {
+		if (-1 == cache_init(&icache, ispec))
+			return 1;
+		cpu.icache = &icache;
+		step = execute_cached;
+	}
+	if (dspec) {
+		if (-1 == cache_init(&dcache, dspec))
+			return 1;
+		cpu.dcache = &dcache;
+		step = execute_cached;
+	}
+
+	if (timed && -1 == timing_init(&timing, costs))
+		return 1;
+
+	/* Execute until an EXIT trap or an illegal instruction is hit */
+	budget = ULONG_MAX;
+	if (sampled)
+		ret = run_sampled(&cpu, step, timed ? &timing : NULL, &sampling);
+	else if (profile || timed)
+		ret = run_detailed(&cpu, step, !!profile, timed ? &timing : NULL,
+			&budget);
+	else if (execute_cached == step)
+		while ((ret = execute_cached(&cpu)) > 0)
+			;
+	else
+		while ((ret = execute(&cpu)) > 0)
+			;
+	if (profile && -1 == write_profile(profile, timed ? &timing : NULL))
+		return 1;
+
+	/* Statistics go per symbol if there are any */
+	if (cpu.icache || cpu.dcache || timed) {
+		syms = NULL;
+		symtab_init(&symtab);
+		if (symtab_path && !symtab_load(&symtab, symtab_path))
+			syms = &symtab;
+		else if (!symtab_path && dbginfo_path
+				&& !dbginfo_load(&dbginfo, dbginfo_path))
+			syms = &dbginfo.symtab;
+
+		if (sampled)
+			report_sampling(stderr, &cpu, timed ? &timing : NULL,
+				&sampling);
+		if (cpu.icache)
+			cache_report(stderr, "I-cache", cpu.icache, syms);
+		if (cpu.dcache)
+			cache_report(stderr, "D-cache", cpu.dcache, syms);
+		if (timed)
+			timing_report(stderr, &timing, syms);
+
+		if (syms == &dbginfo.symtab)
+			dbginfo_free(&dbginfo);
+		symtab_free(&symtab);
+		if (cpu.icache)
+			cache_free(cpu.icache);
+		if (cpu.dcache)
+			cache_free(cpu.dcache);
+		if (timed)
+			timing_free(&timing);
+	}
+	if (ret < 0) {
+		fprintf(stderr, "Illegal instruction %04x at %04x\n",
+			cpu.ir, (uint16_t) (cpu.pc - 1));
+		return 1;
+	}
 	return 0;
 
 print_usage:
-	fprintf(stderr, "Usage: %s BIN\n", argv[0]);
+	fprintf(stderr,
+		"Usage: %s [-p PROFILE | -S PERIOD:WINDOW[:WARMUP]] [-I CACHE] "
+		"[-D CACHE]\n"
+		"          [-t | -c COSTS] [-s SYMTAB | -d DEBUGINFO] BIN\n"
+		"  -I, -D  simulate an instruction or data cache given as\n"
+		"          SIZE:WAYS:LINE[:lru|random] in words\n"
+		"  -t      count cycles with the default cost of each instruction\n"
+		"  -c      count cycles with costs read from a file\n"
+		"  -S      only simulate caches and cycles for WINDOW instructions\n"
+		"          after WARMUP ones every PERIOD, and extrapolate\n",
+		argv[0]);
 	return 1;
 }
@@ -0,0 +1,382 @@
+/*
+ * Emulator daemon, runs jobs from s16run on instances kept warm between them
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include <time.h>
+#include <vec.h>
+#include "lib/s16.h"
+#include "lib/job.h"
+
+/* Image bytes at most, all of RAM */
+#define IMAGE_MAX (0x10000 * 2)
+/* Images of paths kept loaded */
+#define CACHED 64
+/* Seconds a client has to send its whole request */
+#define REQUEST_TIME 1
+
+/*
+ * Image file loaded before, reused while the file looks unchanged
+ */
+struct image {
+	char *path;
+	dev_t dev;
+	ino_t ino;
+	off_t size;
+	struct timespec mtime;
+	uint8_t *bytes;
+};
+
+/*
+ * Job handed to the scheduler, conn is the client's connection and io the
+ *  socket it passed for the guest
+ */
+struct job {
+	int conn, io;
+};
+
+VEC_GEN(s16vm *, vm)
+VEC_GEN(struct image, image)
+
+/*
+ * Zeroed instances ready for the next job, workers return them
+ */
+static pthread_mutex_t pool_lock = PTHREAD_MUTEX_INITIALIZER;
+static vmvec pool;
+static size_t pool_max;
+
+/* Only the accepting thread uses the image cache */
+static imagevec images;
+static size_t next_evicted;
+
+static unsigned long long max_limit;
+
+static
+s16vm *
+take_vm(void)
+{
+	s16vm *vm;
+
+	vm = NULL;
+	pthread_mutex_lock(&pool_lock);
+	if (pool.n)
+		vm = pool.arr[--pool.n];
+	pthread_mutex_unlock(&pool_lock);
+	return vm ? vm : s16_create();
+}
+
+/*
+ * Zero an instance for its next job, which keeps that off the job's latency
+ */
+static
+void
+give_vm(s16vm *vm)
+{
+	s16_reset(vm);
+	pthread_mutex_lock(&pool_lock);
+	if (pool.n < pool_max) {
+		vmvec_add(&pool, vm);
+		vm = NULL;
+	}
+	pthread_mutex_unlock(&pool_lock);
+	s16_destroy(vm);
+}
+
+static
+void
+reply(int conn, uint32_t status, s16vm *vm)
+{
+	struct job_reply rep;
+
+	memset(&rep, 0, sizeof rep);
+	rep.status = status;
+	if (vm) {
+		rep.pc = s16_pc(vm);
+		s16_read(vm, rep.pc - 1, &rep.ir, 1);
+		rep.steps = s16_steps(vm);
+	}
+	if (-1 == job_write(conn, &rep, sizeof rep))
+		perror("reply");
+}
+
+static
+void
+done(s16vm *vm, int status, void *user)
+{
+	struct job *job;
+
+	job = user;
+	reply(job->conn, status, vm);
+	close(job->conn);
+	close(job->io);
+	free(job);
+	give_vm(vm);
+}
+
+/*
+ * Image of path, from the cache unless the file changed since
+ * Returns NULL with a message on stderr on error
+ */
+static
+const struct image *
+load_image(const char *path)
+{
+	struct image *image, fresh;
+	struct stat st;
+	size_t i;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		perror(path);
+		goto fail;
+	}
+
+	for (i = 0; i < images.n; ++i) {
+		image = &images.arr[i];
+		if (!strcmp(image->path, path) && image->dev == st.st_dev
+				&& image->ino == st.st_ino
+				&& image->size == st.st_size
+				&& image->mtime.tv_sec == st.st_mtim.tv_sec
+				&& image->mtime.tv_nsec == st.st_mtim.tv_nsec) {
+			close(fd);
+			return image;
+		}
+	}
+
+	if (st.st_size > IMAGE_MAX) {
+		fprintf(stderr, "%s: Image does not fit into RAM\n", path);
+		goto fail;
+	}
+	fresh.bytes = malloc(st.st_size + 1);
+	fresh.path = strdup(path);
+	if (!fresh.bytes || !fresh.path
+			|| -1 == job_read(fd, fresh.bytes, st.st_size, NULL)) {
+		perror(path);
+		free(fresh.bytes);
+		free(fresh.path);
+		goto fail;
+	}
+	close(fd);
+	fresh.dev = st.st_dev;
+	fresh.ino = st.st_ino;
+	fresh.size = st.st_size;
+	fresh.mtime = st.st_mtim;
+
+	/* Replace a stale entry for the same path, else the oldest if full */
+	for (i = 0; i < images.n; ++i)
+		if (!strcmp(images.arr[i].path, path))
+			break;
+	if (i == images.n && images.n == CACHED)
+		i = next_evicted++ % CACHED;
+	if (i == images.n) {
+		imagevec_add(&images, fresh);
+	} else {
+		free(images.arr[i].path);
+		free(images.arr[i].bytes);
+		images.arr[i] = fresh;
+	}
+	return &images.arr[i];
+
+fail:
+	if (fd >= 0)
+		close(fd);
+	return NULL;
+}
+
+/*
+ * Read a request from a new connection and hand it to the scheduler
+ */
+static
+void
+accept_job(s16sched *sched, int conn)
+{
+	static uint8_t payload[IMAGE_MAX > PATH_MAX ? IMAGE_MAX : PATH_MAX];
+	struct job_request req;
+	const struct image *image;
+	struct timespec deadline;
+	struct timeval timeout;
+	struct job *job;
+	s16vm *vm;
+	int io, ret;
+
+	/*
+	 * A client stalling mid request must not hold up the others, nor one
+	 *  sending a byte at a time, so the deadline is for all of it. The
+	 *  reply goes out from a worker, which must not hang on it either
+	 */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+	deadline.tv_sec += REQUEST_TIME;
+	timeout.tv_sec = REQUEST_TIME;
+	timeout.tv_usec = 0;
+	setsockopt(conn, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof timeout);
+
+	if (-1 == job_recv(conn, &req, &io, &deadline)) {
+		fprintf(stderr, "Malformed request\n");
+		close(conn);
+		return;
+	}
+	if (req.magic != JOB_MAGIC
+			|| (req.kind == JOB_IMAGE && req.size > IMAGE_MAX)
+			|| (req.kind == JOB_PATH && req.size >= PATH_MAX)
+			|| req.kind > JOB_PATH
+			|| -1 == job_read(conn, payload, req.size, &deadline)) {
+		fprintf(stderr, "Malformed request\n");
+		goto reject;
+	}
+
+	vm = take_vm();
+	if (!vm) {
+		perror("s16_create");
+		goto reject;
+	}
+	if (req.kind == JOB_PATH) {
+		payload[req.size] = '\0';
+		image = load_image((char *) payload);
+		ret = image ? s16_load(vm, image->bytes, image->size) : -1;
+	} else {
+		ret = s16_load(vm, payload, req.size);
+	}
+	job = malloc(sizeof *job);
+	if (ret < 0 || !job)
+		goto give_back;
+
+	job->conn = conn;
+	job->io = io;
+	s16_set_limit(vm, !req.limit || (max_limit && req.limit > max_limit)
+		? max_limit : req.limit);
+	if (-1 == s16_sched_add(sched, vm, io, io, done, job)) {
+		perror("s16_sched_add");
+		goto give_back;
+	}
+	return;
+
+give_back:
+	free(job);
+	give_vm(vm);
+reject:
+	reply(conn, JOB_REJECTED, NULL);
+	close(conn);
+	close(io);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct sockaddr_un addr;
+	s16sched *sched;
+	const char *path;
+	unsigned threads;
+	unsigned long slice;
+	size_t i;
+	mode_t mask;
+	int opt, sock, conn;
+
+	path = getenv(JOB_SOCKET_ENV);
+	if (!path)
+		path = JOB_SOCKET;
+	threads = 2;
+	slice = 0;
+	pool_max = 64;
+	max_limit = 0;
+	while (-1 != (opt = getopt(argc, argv, "hS:t:s:p:b:")))
+		switch (opt) {
+		case 'S':
+			path = optarg;
+			break;
+		case 't':
+			threads = strtoul(optarg, NULL, 0);
+			break;
+		case 's':
+			slice = strtoul(optarg, NULL, 0);
+			break;
+		case 'p':
+			pool_max = strtoul(optarg, NULL, 0);
+			break;
+		case 'b':
+			max_limit = strtoull(optarg, NULL, 0);
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind != argc || strlen(path) >= sizeof addr.sun_path)
+		goto print_usage;
+
+	/* Clients going away must not take the daemon with them */
+	signal(SIGPIPE, SIG_IGN);
+
+	/* Fault in the pool now rather than during the first jobs */
+	vmvec_init(&pool);
+	for (i = 0; i < pool_max; ++i) {
+		vmvec_add(&pool, s16_create());
+		if (!pool.arr[i]) {
+			perror("s16_create");
+			return 1;
+		}
+		s16_reset(pool.arr[i]);
+	}
+	imagevec_init(&images);
+
+	sched = s16_sched_create(threads, slice);
+	if (!sched) {
+		perror("s16_sched_create");
+		return 1;
+	}
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	sock = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (sock < 0) {
+		perror("socket");
+		return 1;
+	}
+	unlink(path);
+	/* Jobs read files as the daemon's user, so only it may connect */
+	mask = umask(077);
+	if (bind(sock, (struct sockaddr *) &addr, sizeof addr) < 0
+			|| listen(sock, SOMAXCONN) < 0) {
+		perror(path);
+		return 1;
+	}
+	umask(mask);
+
+	for (;;) {
+		conn = accept4(sock, NULL, NULL, SOCK_CLOEXEC);
+		if (conn < 0) {
+			if (errno != EINTR && errno != ECONNABORTED)
+				perror("accept");
+			continue;
+		}
+		accept_job(sched, conn);
+	}
+
+print_usage:
+	fprintf(stderr,
+		"Usage: %s [-S SOCKET] [-t THREADS] [-s SLICE] [-p POOL] "
+		"[-b LIMIT]\n"
+		"  -S      listen here instead of $" JOB_SOCKET_ENV " or "
+		JOB_SOCKET "\n"
+		"  -t      worker threads running guests\n"
+		"  -s      instructions a guest runs before others get a turn\n"
+		"  -p      instances kept ready for jobs\n"
+		"  -b      instructions a job may run at most\n",
+		argv[0]);
+	return 1;
+}
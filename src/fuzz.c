@@ -0,0 +1,574 @@
+/*
+ * In-process fuzzer for guest programs
+ *
+ * The program is loaded once and every input runs on a copy of the CPU
+ *  restored from a snapshot taken right after loading, with TRAP_READ
+ *  reading the input. Edges between guest basic blocks are the coverage
+ *  feedback. Built with FUZZ_LIBFUZZER the harness is driven by libFuzzer
+ *  instead of the small mutational loop below
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <time.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <vec.h>
+#include "lib/cpu.h"
+#include "lib/fuzz.h"
+
+/*
+ * Edge counters, libFuzzer picks them up from this section as feedback on
+ *  top of its own
+ */
+#ifdef FUZZ_LIBFUZZER
+__attribute__((used, section("__libfuzzer_extra_counters")))
+#endif
+static uint8_t edges[FUZZ_MAP_SIZE];
+
+static s16cpu cpu, snapshot;
+static s16fuzz fuzz;
+
+/* Instructions a run may take before it counts as a hang */
+static unsigned long budget = 100000;
+
+/*
+ * How a run ended
+ */
+enum {
+	RUN_EXIT,
+	RUN_ILLEGAL,
+	RUN_BAD_TRAP,
+	RUN_HANG,
+	RUN_COUNT
+};
+
+static const char *const run_names[RUN_COUNT] = {
+	"exit", "illegal instruction", "out of bounds trap", "hang"
+};
+
+static
+int
+setup(const char *path)
+{
+	cpu.fuzz = &fuzz;
+	fuzz.map = edges;
+	if (load_program(path, &cpu) < 0)
+		return -1;
+	snapshot = cpu;
+	return 0;
+}
+
+static
+int
+run(const uint8_t *data, size_t len)
+{
+	unsigned long left;
+	int ret;
+
+	fuzz_reset(&cpu, &snapshot, data, len);
+	left = budget;
+	while ((ret = execute_fuzz(&cpu)) > 0 && !fuzz.bad_trap && --left)
+		;
+
+	if (ret < 0)
+		return RUN_ILLEGAL;
+	if (fuzz.bad_trap)
+		return RUN_BAD_TRAP;
+	return ret ? RUN_HANG : RUN_EXIT;
+}
+
+#ifdef FUZZ_LIBFUZZER
+
+/*
+ * libFuzzer entry points, the program comes from $S16FUZZ_BIN and the
+ *  budget from $S16FUZZ_BUDGET. Anything but an exit aborts so libFuzzer
+ *  keeps the input
+ */
+
+int
+LLVMFuzzerInitialize(int *argc, char ***argv)
+{
+	const char *path, *limit;
+
+	path = getenv("S16FUZZ_BIN");
+	if (!path) {
+		fprintf(stderr, "S16FUZZ_BIN must name the program to fuzz\n");
+		exit(1);
+	}
+	limit = getenv("S16FUZZ_BUDGET");
+	if (limit)
+		budget = strtoul(limit, NULL, 0);
+	if (-1 == setup(path))
+		exit(1);
+	return 0;
+}
+
+int
+LLVMFuzzerTestOneInput(const uint8_t *data, size_t len)
+{
+	int res;
+
+	res = run(data, len);
+	if (RUN_EXIT != res) {
+		fprintf(stderr, "%s at %04x\n", run_names[res],
+			(uint16_t) (cpu.pc - 1));
+		abort();
+	}
+	return 0;
+}
+
+#else
+
+/*
+ * Inputs that found new coverage
+ */
+struct entry {
+	uint8_t *data;
+	size_t len;
+};
+
+VEC_GEN(struct entry, entry)
+
+/*
+ * Coverage seen so far by AFL style bucket of each counter, separately for
+ *  exits, crashes and hangs so each kind is kept once per new path
+ */
+static uint8_t virgin[3][FUZZ_MAP_SIZE];
+static size_t edges_seen;
+
+static uint32_t rng = 0x5eed;
+
+static
+uint32_t
+rand32(void)
+{
+	rng ^= rng << 13;
+	rng ^= rng >> 17;
+	rng ^= rng << 5;
+	return rng;
+}
+
+static
+uint8_t
+bucket(uint8_t count)
+{
+	if (count < 4)
+		return count == 3 ? 4 : count;
+	if (count < 8)
+		return 8;
+	if (count < 16)
+		return 16;
+	if (count < 32)
+		return 32;
+	return count < 128 ? 64 : 128;
+}
+
+/*
+ * Fold the edges of the last run into a virgin map
+ * Returns nonzero if any edge was new or hit a new bucket
+ */
+static
+int
+new_coverage(uint8_t *map)
+{
+	uint64_t word;
+	uint8_t bits;
+	size_t i, j;
+	int found;
+
+	/* Most counters are zero, skip them a word at a time */
+	found = 0;
+	for (i = 0; i < FUZZ_MAP_SIZE; i += sizeof word) {
+		memcpy(&word, edges + i, sizeof word);
+		if (!word)
+			continue;
+		for (j = i; j < i + sizeof word; ++j) {
+			bits = bucket(edges[j]);
+			if (!(map[j] & bits))
+				continue;
+			if (map == virgin[0] && 0xff == map[j])
+				++edges_seen;
+			map[j] &= ~bits;
+			found = 1;
+		}
+	}
+	return found;
+}
+
+static const uint8_t interesting[] = {
+	0, 1, 0x7f, 0x80, 0xff, '\n', ' ', '-', '+', '0', '1', '9', 'a', 'z'
+};
+
+/*
+ * Stack a few random mutations on buf of len bytes, splicing in other
+ *  from the corpus. buf has room for max bytes
+ * Returns the new length
+ */
+static
+size_t
+mutate(uint8_t *buf, size_t len, size_t max, const struct entry *other)
+{
+	size_t n, i, at, from, span;
+	_Bool repeat;
+
+	for (n = 1 << rand32() % 4; n--; ) {
+		switch (rand32() % 8) {
+		case 0:
+			if (len)
+				buf[rand32() % len] ^= 1 << rand32() % 8;
+			break;
+		case 1:
+			if (len)
+				buf[rand32() % len] = rand32();
+			break;
+		case 2:
+			if (len)
+				buf[rand32() % len] =
+					interesting[rand32() % sizeof interesting];
+			break;
+		case 3:
+			if (len)
+				buf[rand32() % len] += rand32() % 33 - 16;
+			break;
+		case 4:
+			/* Insert a few random or repeated bytes */
+			if (len == max)
+				break;
+			at = rand32() % (len + 1);
+			span = 1 + rand32() % (max - len < 8 ? max - len : 8);
+			repeat = at && rand32() & 1;
+			memmove(buf + at + span, buf + at, len - at);
+			for (i = 0; i < span; ++i)
+				buf[at + i] = repeat ? buf[at - 1] : rand32();
+			len += span;
+			break;
+		case 5:
+			if (!len)
+				break;
+			at = rand32() % len;
+			span = 1 + rand32() % (len - at);
+			memmove(buf + at, buf + at + span, len - at - span);
+			len -= span;
+			break;
+		case 6:
+			/* Copy a chunk over another place in the input */
+			if (len < 2)
+				break;
+			from = rand32() % len;
+			at = rand32() % len;
+			span = 1 + rand32() % (len - (from > at ? from : at));
+			memmove(buf + at, buf + from, span);
+			break;
+		case 7:
+			/* Splice another input's tail in after a prefix */
+			if (!other->len)
+				break;
+			at = rand32() % (len + 1);
+			from = rand32() % other->len;
+			span = other->len - from;
+			if (span > max - at)
+				span = max - at;
+			memcpy(buf + at, other->data + from, span);
+			len = at + span;
+			break;
+		}
+	}
+	return len;
+}
+
+static
+int
+save(const char *dir, const char *kind, unsigned long id, const uint8_t *data,
+	size_t len)
+{
+	char path[4096];
+	FILE *file;
+
+	if (!dir)
+		return 0;
+	snprintf(path, sizeof path, "%s/%s-%06lu", dir, kind, id);
+	file = fopen(path, "wb");
+	if (!file) {
+		perror(path);
+		return -1;
+	}
+	if (len && fwrite(data, len, 1, file) != 1) {
+		perror(path);
+		fclose(file);
+		return -1;
+	}
+	if (fclose(file)) {
+		perror(path);
+		return -1;
+	}
+	return 0;
+}
+
+/*
+ * Read at most max bytes of a file
+ * Returns the number read, -1 on error
+ */
+static
+ssize_t
+read_input(const char *path, uint8_t *buf, size_t max)
+{
+	FILE *file;
+	size_t len;
+
+	file = fopen(path, "rb");
+	if (!file) {
+		perror(path);
+		return -1;
+	}
+	len = fread(buf, 1, max, file);
+	if (ferror(file)) {
+		perror(path);
+		fclose(file);
+		return -1;
+	}
+	fclose(file);
+	return len;
+}
+
+static
+void
+add_entry(entryvec *corpus, const uint8_t *data, size_t len)
+{
+	struct entry entry;
+
+	entry.data = malloc(len ? len : 1);
+	memcpy(entry.data, data, len);
+	entry.len = len;
+	entryvec_add(corpus, entry);
+}
+
+/*
+ * Run a seed file, or every file in a seed directory, keeping those that
+ *  find new coverage
+ */
+static
+int
+add_seeds(entryvec *corpus, const char *path, uint8_t *buf, size_t max)
+{
+	struct stat st;
+	struct dirent *ent;
+	DIR *dir;
+	char sub[4096];
+	ssize_t len;
+
+	if (-1 == stat(path, &st)) {
+		perror(path);
+		return -1;
+	}
+
+	if (S_ISDIR(st.st_mode)) {
+		dir = opendir(path);
+		if (!dir) {
+			perror(path);
+			return -1;
+		}
+		while ((ent = readdir(dir))) {
+			if ('.' == ent->d_name[0])
+				continue;
+			snprintf(sub, sizeof sub, "%s/%s", path, ent->d_name);
+			if (-1 == add_seeds(corpus, sub, buf, max)) {
+				closedir(dir);
+				return -1;
+			}
+		}
+		closedir(dir);
+		return 0;
+	}
+
+	len = read_input(path, buf, max);
+	if (len < 0)
+		return -1;
+	memset(edges, 0, sizeof edges);
+	if (RUN_EXIT == run(buf, len) && new_coverage(virgin[0]))
+		add_entry(corpus, buf, len);
+	return 0;
+}
+
+static
+double
+now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Run each file once and say how it ended
+ * Returns the number of files that did not exit cleanly
+ */
+static
+int
+replay(char *paths[], int count, uint8_t *buf, size_t max)
+{
+	ssize_t len;
+	int i, bad, res;
+
+	bad = 0;
+	for (i = 0; i < count; ++i) {
+		len = read_input(paths[i], buf, max);
+		if (len < 0) {
+			++bad;
+			continue;
+		}
+		res = run(buf, len);
+		if (RUN_EXIT == res)
+			printf("%s: exit\n", paths[i]);
+		else
+			printf("%s: %s at %04x\n", paths[i], run_names[res],
+				(uint16_t) (cpu.pc - 1));
+		bad += RUN_EXIT != res;
+	}
+	return bad;
+}
+
+int
+main(int argc, char *argv[])
+{
+	_Bool replaying;
+	unsigned long long runs, execs;
+	unsigned long found[RUN_COUNT];
+	double seconds, start, last, t;
+	const char *outdir;
+	size_t max, len, i;
+	entryvec corpus;
+	uint8_t *buf;
+	struct entry *entry;
+	int opt, res;
+
+	replaying = 0;
+	runs = 0;
+	seconds = 0;
+	outdir = NULL;
+	max = 1024;
+	while (-1 != (opt = getopt(argc, argv, "hrn:T:b:l:o:s:")))
+		switch (opt) {
+		case 'r':
+			replaying = 1;
+			break;
+		case 'n':
+			runs = strtoull(optarg, NULL, 0);
+			break;
+		case 'T':
+			seconds = strtod(optarg, NULL);
+			break;
+		case 'b':
+			budget = strtoul(optarg, NULL, 0);
+			if (!budget)
+				goto print_usage;
+			break;
+		case 'l':
+			max = strtoul(optarg, NULL, 0);
+			if (!max)
+				goto print_usage;
+			break;
+		case 'o':
+			outdir = optarg;
+			break;
+		case 's':
+			rng = strtoul(optarg, NULL, 0);
+			if (!rng)
+				goto print_usage;
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind >= argc)
+		goto print_usage;
+	if (-1 == setup(argv[optind]))
+		return 1;
+
+	buf = malloc(max);
+	if (replaying) {
+		res = replay(argv + optind + 1, argc - optind - 1, buf, max);
+		free(buf);
+		return !!res;
+	}
+
+	memset(virgin, 0xff, sizeof virgin);
+	entryvec_init(&corpus);
+	for (i = optind + 1; i < (size_t) argc; ++i)
+		if (-1 == add_seeds(&corpus, argv[i], buf, max))
+			return 1;
+	if (!corpus.n)
+		add_entry(&corpus, buf, 0);
+
+	memset(found, 0, sizeof found);
+	start = last = now();
+	for (execs = 0; !runs || execs < runs; ++execs) {
+		entry = &corpus.arr[rand32() % corpus.n];
+		memcpy(buf, entry->data, entry->len);
+		len = mutate(buf, entry->len, max,
+			&corpus.arr[rand32() % corpus.n]);
+
+		memset(edges, 0, sizeof edges);
+		res = run(buf, len);
+		if (RUN_EXIT == res) {
+			if (new_coverage(virgin[0])) {
+				add_entry(&corpus, buf, len);
+				save(outdir, "queue", corpus.n, buf, len);
+			}
+		} else if (new_coverage(virgin[RUN_HANG == res ? 2 : 1])) {
+			++found[res];
+			fprintf(stderr, "%s at %04x\n", run_names[res],
+				(uint16_t) (cpu.pc - 1));
+			save(outdir, RUN_HANG == res ? "hang" : "crash",
+				found[RUN_ILLEGAL] + found[RUN_BAD_TRAP]
+				+ found[RUN_HANG], buf, len);
+		}
+
+		/* Look at the clock only every so often */
+		if (execs & 0x3fff)
+			continue;
+		t = now();
+		if (t - last >= 1 || (seconds && t - start >= seconds)) {
+			fprintf(stderr, "#%llu %.0f execs/s, corpus %zu, edges %zu, "
+				"crashes %lu, hangs %lu\n", execs,
+				execs / (t - start), corpus.n, edges_seen,
+				found[RUN_ILLEGAL] + found[RUN_BAD_TRAP],
+				found[RUN_HANG]);
+			last = t;
+		}
+		if (seconds && t - start >= seconds)
+			break;
+	}
+
+	t = now();
+	fprintf(stderr, "Done, %llu runs in %.1fs, %.0f execs/s, corpus %zu, "
+		"edges %zu, crashes %lu, hangs %lu\n", execs, t - start,
+		execs / (t - start), corpus.n, edges_seen,
+		found[RUN_ILLEGAL] + found[RUN_BAD_TRAP], found[RUN_HANG]);
+
+	for (i = 0; i < corpus.n; ++i)
+		free(corpus.arr[i].data);
+	entryvec_free(&corpus);
+	free(buf);
+	return 0;
+
+print_usage:
+	fprintf(stderr,
+		"Usage: %s [-n RUNS] [-T SECONDS] [-b BUDGET] [-l MAXLEN] "
+		"[-o DIR] [-s SEED]\n"
+		"          BIN [CORPUS...]\n"
+		"       %s -r [-b BUDGET] BIN FILE...\n"
+		"  -b      instructions a run may take before it is a hang\n"
+		"  -l      longest input to try, in bytes\n"
+		"  -o      write inputs with new coverage, crashes and hangs here\n"
+		"  -r      run each FILE once and report how it ended\n",
+		argv[0], argv[0]);
+	return 1;
+}
+
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Linker, places relocatable objects one after another starting at address 0
+ *  and resolves their relocations into an executable image
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vec.h>
+#include <map.h>
+#include <djb2.h>
+#include "lib/leb.h"
+#include "lib/obj.h"
+#include "lib/symtab.h"
+#include "lib/dbginfo.h"
+
+MAP_GEN(char *, uint16_t, djb2_hash, !strcmp, glob)
+
+int
+main(int argc, char *argv[])
+{
+	int opt, outfd, dbgfd, ret;
+	char *outfile, *dbgfile;
+	s16obj *objs;
+	size_t obj_cnt, i, j, size;
+	size_t *bases;
+	globmap globals;
+	s16objsym *sym;
+	s16reloc *reloc;
+	uint16_t *image, addr;
+	bvec buf;
+	symvec syms;
+	s16sym dbgsym;
+
+	outfile = NULL;
+	dbgfile = NULL;
+
+	/* Parse arguments */
+	while (-1 != (opt = getopt(argc, argv, "ho:d:")))
+		switch (opt) {
+		case 'o':
+			outfile = optarg;
+			break;
+		case 'd':
+			dbgfile = optarg;
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind >= argc)
+		goto print_usage;
+
+	obj_cnt = argc - optind;
+	objs = malloc(obj_cnt * sizeof *objs);
+	bases = malloc(obj_cnt * sizeof *bases);
+	if (!objs || !bases)
+		abort();
+
+	ret = 1;
+	image = NULL;
+	globmap_init(&globals);
+	symvec_init(&syms);
+
+	/* Load objects and lay them out */
+	for (size = 0, i = 0; i < obj_cnt; size += objs[i++].size) {
+		if (-1 == obj_load(&objs[i], argv[optind + i])) {
+			obj_cnt = i;
+			goto done;
+		}
+		bases[i] = size;
+	}
+	if (size > 0x10000) {
+		fprintf(stderr, "Image too large: %zu words\n", size);
+		goto done;
+	}
+
+	/* Collect global definitions */
+	for (i = 0; i < obj_cnt; ++i)
+		for (sym = objs[i].syms.arr;
+				sym < objs[i].syms.arr + objs[i].syms.n; ++sym) {
+			if (!(sym->flags & OBJSYM_DEFINED))
+				continue;
+
+			addr = bases[i] + sym->value;
+			dbgsym.addr = addr;
+			dbgsym.len = sym->len;
+			dbgsym.name = sym->name;
+			symvec_add(&syms, dbgsym);
+
+			if (!(sym->flags & OBJSYM_GLOBAL))
+				continue;
+			if (globmap_get(&globals, (char *) sym->name, NULL)) {
+				fprintf(stderr, "%s: Duplicate symbol %s\n",
+					argv[optind + i], sym->name);
+				goto done;
+			}
+			globmap_put(&globals, (char *) sym->name, addr);
+		}
+
+	/* Concatenate and relocate */
+	image = malloc(size * sizeof *image + 1);
+	if (!image)
+		abort();
+	for (i = 0; i < obj_cnt; ++i) {
+		memcpy(image + bases[i], objs[i].code,
+			objs[i].size * sizeof *image);
+
+		for (reloc = objs[i].relocs.arr;
+				reloc < objs[i].relocs.arr + objs[i].relocs.n; ++reloc) {
+			sym = &objs[i].syms.arr[reloc->sym];
+			if (sym->flags & OBJSYM_DEFINED) {
+				addr = bases[i] + sym->value;
+			} else if (!globmap_get(&globals, (char *) sym->name, &addr)) {
+				fprintf(stderr, "%s: Undefined symbol %s\n",
+					argv[optind + i], sym->name);
+				goto done;
+			}
+			image[bases[i] + reloc->word] = addr;
+		}
+	}
+
+	/* Write image */
+	if (outfile) {
+		outfd = open(outfile, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+		if (-1 == outfd) {
+			perror(outfile);
+			goto done;
+		}
+	} else {
+		outfd = STDOUT_FILENO;
+	}
+
+	bvec_init(&buf);
+	for (j = 0; j < size; ++j) {
+		bvec_add(&buf, image[j] >> 8);
+		bvec_add(&buf, image[j]);
+	}
+	if (-1 == write_all(outfd, &buf)) {
+		perror(outfile ? outfile : "output");
+		bvec_free(&buf);
+		close(outfd);
+		goto done;
+	}
+	bvec_free(&buf);
+	close(outfd);
+
+	/* Symbols of every object make up the debug info, lines are lost */
+	if (dbgfile) {
+		dbgfd = open(dbgfile, O_WRONLY | O_TRUNC | O_CREAT, 0644);
+		if (-1 == dbgfd
+				|| -1 == dbginfo_write(dbgfd, syms.arr, syms.n, NULL, 0)) {
+			perror(dbgfile);
+			if (-1 != dbgfd)
+				close(dbgfd);
+			goto done;
+		}
+		close(dbgfd);
+	}
+
+	ret = 0;
+
+done:
+	for (i = 0; i < obj_cnt; ++i)
+		obj_free(&objs[i]);
+	free(objs);
+	free(bases);
+	free(image);
+	globmap_free(&globals);
+	symvec_free(&syms);
+	return ret;
+
+print_usage:
+	fprintf(stderr, "Usage: %s [-o OUT] [-d DEBUGINFO] OBJ...\n", argv[0]);
+	return 1;
+}
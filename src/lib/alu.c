@@ -1,34 +1,59 @@
 /*
  * Two's complement arithmatic emulator
+ *
+ * All kernels are branchless: flag bits are computed arithmetically and merged
+ * into R15 with a single masked store. The only remaining branch is the
+ * division by zero check in s16div, which is a no-op by definition.
  */
 
 #include <stdint.h>
 #include "alu.h"
 
-#define S16_SIGN(x) (x & 0x8000)
+/* Place a 0/1 value at the R15 position of flag "bit" */
+#define FLAG(bit, val) ((uint16_t) ((uint16_t) (val) << (15 - bit)))
+
+/* Flags written by the add family */
+#define ADD_FLAGS \
+	(FLAG(BIT_ccV, 1) | FLAG(BIT_ccv, 1) | FLAG(BIT_ccC, 1))
+
+/* Flags written by cmp */
+#define CMP_FLAGS \
+	(FLAG(BIT_ccG, 1) | FLAG(BIT_ccg, 1) | FLAG(BIT_ccE, 1) | \
+	 FLAG(BIT_ccl, 1) | FLAG(BIT_ccL, 1))
 
 /*
  * Convert a two's complement word into a signed integer
  */
-static int32_t tosigint(uint16_t x)
+static inline int32_t tosigint(uint16_t x)
+{
+	return (int32_t) (x ^ 0x8000) - 0x8000;
+}
+
+/*
+ * Merge "val" into the bits of *f selected by "mask"
+ *  When f aliases the destination register flags are discarded, the
+ *  selection is done with a mask instead of an early return
+ */
+static inline void setflags
+	(uint16_t *f, const uint16_t *d, uint16_t mask, uint16_t val)
 {
-	if (S16_SIGN(x)) {
-		return -(int32_t) ((uint16_t) ~x + 1);
-	} else {
-		return (int32_t) x;
-	}
+	mask &= -(uint16_t) (f != d);
+	*f = (*f & ~mask) | (val & mask);
 }
 
 /*
- * Convert a signed integer to two's complement word
+ * Flags for "d = a + b (+ carry)"
+ *  The unsigned overflow check is the "d < a || d < b" test of the
+ *  original implementation, signed overflow means a and b agree in sign but
+ *  the result does not
  */
-static uint16_t fromsigint(int32_t x)
+static inline uint16_t addflags(uint16_t d, uint16_t a, uint16_t b)
 {
-	if (x < 0) {
-		return (uint16_t) ~(uint16_t) -x + 1;
-	} else {
-		return (uint16_t) x;
-	}
+	uint16_t c, v;
+
+	c = (d < a) | (d < b);
+	v = (uint16_t) ((a ^ d) & (b ^ d)) >> 15;
+	return FLAG(BIT_ccV, c) | FLAG(BIT_ccC, c) | FLAG(BIT_ccv, v);
 }
 
 /*
@@ -37,15 +62,7 @@ static uint16_t fromsigint(int32_t x)
 void s16add(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b)
 {
 	*d = a + b;
-
-	if (f == d) /* Do not set flags if f == d */
-		return;
-	/* Unsigned overflow + carry propagation */
-	SET_BIT(*f, BIT_ccV, *d < a || *d < b);
-	SET_BIT(*f, BIT_ccC, *d < a || *d < b);
-	/* Signed overflow */
-	SET_BIT(*f, BIT_ccv,
-		!(S16_SIGN(a) ^ S16_SIGN(b)) && (S16_SIGN(a) ^ S16_SIGN(*d)));
+	setflags(f, d, ADD_FLAGS, addflags(*d, a, b));
 }
 
 /*
@@ -58,18 +75,15 @@ void s16sub(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b)
 
 /*
  * Calculate "a * b" treating both a and b as two's complement words
+ *  ccv is set if the 32-bit product has any bit set above the low word
  */
 void s16mul(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b)
 {
-	int32_t tmp;
+	uint32_t tmp;
 
-	tmp = tosigint(a) * tosigint(b);
-	*d = fromsigint(tmp);
-
-	if (f == d) /* Do not set flags if f == d */
-		return;
-	/* Signed overflow bit */
-	SET_BIT(*f, BIT_ccv, tmp & 0xffff0000);
+	tmp = (uint32_t) (tosigint(a) * tosigint(b));
+	*d = (uint16_t) tmp;
+	setflags(f, d, FLAG(BIT_ccv, 1), FLAG(BIT_ccv, (tmp >> 16) != 0));
 }
 
 /*
@@ -80,20 +94,19 @@ void s16div(uint16_t *q, uint16_t *r, uint16_t a, uint16_t b)
 {
 	int32_t i_a, i_b, i_q;
 
+	if (!b) /* Zero division is just ignored */
+		return;
+
 	i_a = tosigint(a);
 	i_b = tosigint(b);
 
-	if (!i_b) /* Zero division is just ignored */
-		return;
-
+	/* Emulate floor division on top of C's truncating one */
 	i_q = i_a / i_b;
-	if (i_q < 0 && i_a % i_b) /* Emulate floor division */
-		--i_q;
-
-	*q = fromsigint(i_q);
+	i_q -= (i_q < 0) & (i_a % i_b != 0);
 
-	if (q != r) /* Do not overwrite quotient */
-		*r = fromsigint(i_a - i_b * i_q);
+	/* Do not overwrite quotient: the remainder is stored first */
+	*r = (uint16_t) (i_a - i_b * i_q);
+	*q = (uint16_t) i_q;
 }
 
 /*
@@ -106,13 +119,14 @@ void s16cmp(uint16_t *f, uint16_t a, uint16_t b)
 	i_a = tosigint(a);
 	i_b = tosigint(b);
 
-	/* Unsigned comparison */
-	SET_BIT(*f, BIT_ccE, a == b);
-	SET_BIT(*f, BIT_ccG, a > b);
-	SET_BIT(*f, BIT_ccL, a < b);
-	/* Signed comparison */
-	SET_BIT(*f, BIT_ccg, i_a > i_b);
-	SET_BIT(*f, BIT_ccl, i_a < i_b);
+	*f = (*f & ~CMP_FLAGS)
+		/* Unsigned comparison */
+		| FLAG(BIT_ccE, a == b)
+		| FLAG(BIT_ccG, a > b)
+		| FLAG(BIT_ccL, a < b)
+		/* Signed comparison */
+		| FLAG(BIT_ccg, i_a > i_b)
+		| FLAG(BIT_ccl, i_a < i_b);
 }
 
 /*
@@ -121,12 +135,7 @@ void s16cmp(uint16_t *f, uint16_t a, uint16_t b)
  */
 void s16cmplt(uint16_t *d, uint16_t a, uint16_t b)
 {
-	int32_t i_a, i_b;
-
-	i_a = tosigint(a);
-	i_b = tosigint(b);
-
-	*d = i_a < i_b;
+	*d = tosigint(a) < tosigint(b);
 }
 
 /*
@@ -135,29 +144,71 @@ void s16cmplt(uint16_t *d, uint16_t a, uint16_t b)
  */
 void s16cmpgt(uint16_t *d, uint16_t a, uint16_t b)
 {
-	int32_t i_a, i_b;
-
-	i_a = tosigint(a);
-	i_b = tosigint(b);
-
-	*d = i_a > i_b;
+	*d = tosigint(a) > tosigint(b);
 }
 
 /*
  * Add two words plus R15.ccC
+ *  NOTE: the sum is stored before ccC is read, so when d is R15 the carry
+ *  comes from the sum itself, matching the original implementation
  */
 void s16addc(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b)
 {
 	*d = a + b;
-	if (0 < GET_BIT(*f, BIT_ccC))
-		++*d;
+	*d += GET_BIT(*f, BIT_ccC);
+	setflags(f, d, ADD_FLAGS, addflags(*d, a, b));
+}
 
-	if (f == d) /* Do not set flags if f == d */
-		return;
-	/* Unsigned overflow + carry propagation */
-	SET_BIT(*f, BIT_ccV, *d < a || *d < b);
-	SET_BIT(*f, BIT_ccC, *d < a || *d < b);
-	/* Signed overflow */
-	SET_BIT(*f, BIT_ccv,
-		!(S16_SIGN(a) ^ S16_SIGN(b)) && (S16_SIGN(a) ^ S16_SIGN(*d)));
+/*
+ * Shift a right by k, copying the sign bit into the vacated bits
+ */
+void s16shiftra(uint16_t *d, uint16_t a, unsigned k)
+{
+	*d = (uint16_t) (a >> k | (0u - (a >> 15)) << (16 - k));
+}
+
+/*
+ * Rotate a left by k, bits shifted out at the top come back in at the bottom
+ */
+void s16rotl(uint16_t *d, uint16_t a, unsigned k)
+{
+	*d = (uint16_t) ((uint32_t) a << k | a >> (16 - k));
+}
+
+/*
+ * Rotate a right by k
+ */
+void s16rotr(uint16_t *d, uint16_t a, unsigned k)
+{
+	*d = (uint16_t) (a >> k | (uint32_t) a << (16 - k));
+}
+
+/*
+ * Last bit plus one of the w bit field starting at bit p, bits are numbered
+ *  from the most significant one and fields end at bit 15 at the latest
+ */
+static inline unsigned field_end(unsigned p, unsigned w)
+{
+	return p + w > 16 ? 16 : p + w;
+}
+
+/*
+ * Move the w bit field of a starting at bit p to the bottom of d
+ */
+void s16extract(uint16_t *d, uint16_t a, unsigned p, unsigned w)
+{
+	*d = (uint16_t) ((a & 0xffffu >> p) >> (16 - field_end(p, w)));
+}
+
+/*
+ * Replace the w bit field of d starting at bit p with the bottom bits of a
+ */
+void s16insert(uint16_t *d, uint16_t a, unsigned p, unsigned w)
+{
+	unsigned end;
+	uint16_t mask;
+
+	end = field_end(p, w);
+	mask = (uint16_t) (0xffffu >> p & ~(0xffffu >> end));
+	*d = (*d & ~mask) | ((uint16_t) ((uint32_t) a << (16 - end)) & mask);
 }
@@ -24,5 +24,10 @@ void s16cmp(uint16_t *f, uint16_t a, uint16_t b);
 void s16cmplt(uint16_t *d, uint16_t a, uint16_t b);
 void s16cmpgt(uint16_t *d, uint16_t a, uint16_t b);
 void s16addc(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b);
+void s16shiftra(uint16_t *d, uint16_t a, unsigned k);
+void s16rotl(uint16_t *d, uint16_t a, unsigned k);
+void s16rotr(uint16_t *d, uint16_t a, unsigned k);
+void s16extract(uint16_t *d, uint16_t a, unsigned p, unsigned w);
+void s16insert(uint16_t *d, uint16_t a, unsigned p, unsigned w);
 
 #endif
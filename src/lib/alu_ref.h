@@ -0,0 +1,17 @@
+#ifndef ALU_REF_H
+#define ALU_REF_H
+
+/*
+ * Reference versions of the kernels in alu.h, see alu_ref.c
+ */
+
+void s16add_ref(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b);
+void s16sub_ref(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b);
+void s16mul_ref(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b);
+void s16div_ref(uint16_t *q, uint16_t *r, uint16_t a, uint16_t b);
+void s16cmp_ref(uint16_t *f, uint16_t a, uint16_t b);
+void s16cmplt_ref(uint16_t *d, uint16_t a, uint16_t b);
+void s16cmpgt_ref(uint16_t *d, uint16_t a, uint16_t b);
+void s16addc_ref(uint16_t *f, uint16_t *d, uint16_t a, uint16_t b);
+
+#endif
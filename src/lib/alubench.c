@@ -0,0 +1,127 @@
+/*
+ * ALU microbenchmark, times every kernel in alu.c and its reference in
+ *  alu_ref.c on the same random operands and reports ns per operation
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+#include "alu.h"
+#include "alu_ref.h"
+
+/* Operand pairs, random so that branches of the reference mispredict */
+#define PAIRS 4096
+
+typedef void (*fd_kernel)(uint16_t *, uint16_t *, uint16_t, uint16_t);
+typedef void (*f_kernel)(uint16_t *, uint16_t, uint16_t);
+
+static uint16_t as[PAIRS], bs[PAIRS];
+static volatile uint16_t sink;
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Run fn over all pairs runs times, returns ns per call
+ *  The flags carry over between calls like they do in R15
+ */
+static double time_fd(fd_kernel fn, int runs)
+{
+	uint16_t f, d;
+	double start;
+	int i, r;
+
+	f = 0;
+	d = 0;
+	start = now();
+	for (r = 0; r < runs; ++r)
+		for (i = 0; i < PAIRS; ++i)
+			fn(&f, &d, as[i], bs[i]);
+	sink = f ^ d;
+	return (now() - start) * 1e9 / ((double) runs * PAIRS);
+}
+
+static double time_f(f_kernel fn, int runs)
+{
+	uint16_t f;
+	double start;
+	int i, r;
+
+	f = 0;
+	start = now();
+	for (r = 0; r < runs; ++r)
+		for (i = 0; i < PAIRS; ++i)
+			fn(&f, as[i], bs[i]);
+	sink = f;
+	return (now() - start) * 1e9 / ((double) runs * PAIRS);
+}
+
+int main(int argc, char *argv[])
+{
+	static const struct {
+		const char *name;
+		fd_kernel fn, ref;
+	} fd_kernels[] = {
+		{ "add", s16add, s16add_ref },
+		{ "sub", s16sub, s16sub_ref },
+		{ "mul", s16mul, s16mul_ref },
+		{ "div", s16div, s16div_ref },
+		{ "addc", s16addc, s16addc_ref },
+	};
+	static const struct {
+		const char *name;
+		f_kernel fn, ref;
+	} f_kernels[] = {
+		{ "cmp", s16cmp, s16cmp_ref },
+		{ "cmplt", s16cmplt, s16cmplt_ref },
+		{ "cmpgt", s16cmpgt, s16cmpgt_ref },
+	};
+	uint32_t seed;
+	size_t i;
+	int opt, runs;
+
+	runs = 2000;
+
+	while (-1 != (opt = getopt(argc, argv, "hn:")))
+		switch (opt) {
+		case 'n':
+			runs = atoi(optarg);
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind != argc || runs < 1)
+		goto print_usage;
+
+	seed = 12345;
+	for (i = 0; i < PAIRS; ++i) {
+		seed = seed * 1103515245 + 12345;
+		as[i] = seed >> 16;
+		seed = seed * 1103515245 + 12345;
+		bs[i] = seed >> 16;
+	}
+
+	printf("%-8s %8s %8s\n", "", "ref", "alu");
+	for (i = 0; i < sizeof fd_kernels / sizeof *fd_kernels; ++i)
+		printf("%-8s %8.2f %8.2f ns/op\n", fd_kernels[i].name,
+			time_fd(fd_kernels[i].ref, runs),
+			time_fd(fd_kernels[i].fn, runs));
+	for (i = 0; i < sizeof f_kernels / sizeof *f_kernels; ++i)
+		printf("%-8s %8.2f %8.2f ns/op\n", f_kernels[i].name,
+			time_f(f_kernels[i].ref, runs),
+			time_f(f_kernels[i].fn, runs));
+	return 0;
+
+print_usage:
+	fprintf(stderr, "Usage %s [-n RUNS]\n", argv[0]);
+	return 1;
+}
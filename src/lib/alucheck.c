@@ -0,0 +1,210 @@
+/*
+ * Exhaustive ALU check, runs every kernel in alu.c and its reference in
+ *  alu_ref.c over all 2^32 operand pairs and compares the results
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <pthread.h>
+#include <unistd.h>
+#include "alu.h"
+#include "alu_ref.h"
+
+/* Stored in destinations beforehand to catch kernels leaving them alone */
+#define POISON 0x5a5a
+
+/*
+ * Kernels writing a flag or remainder register and a destination
+ */
+static const struct {
+	const char *name;
+	void (*fn)(uint16_t *, uint16_t *, uint16_t, uint16_t);
+	void (*ref)(uint16_t *, uint16_t *, uint16_t, uint16_t);
+} kernels[] = {
+	{ "add", s16add, s16add_ref },
+	{ "sub", s16sub, s16sub_ref },
+	{ "mul", s16mul, s16mul_ref },
+	{ "div", s16div, s16div_ref },
+	{ "addc", s16addc, s16addc_ref },
+};
+
+#define KERNELS (sizeof kernels / sizeof *kernels)
+
+/* R15 before each flag setting kernel runs, all flags clear and all set */
+static const uint16_t flags[] = { 0x0000, 0xffff };
+
+struct share {
+	unsigned first, step;
+	unsigned long mismatches;
+};
+
+/* Mismatches reported so far, threads stop at the first */
+static pthread_mutex_t report_lock = PTHREAD_MUTEX_INITIALIZER;
+static int failed;
+
+static void report(const char *name, const char *how, uint16_t a, uint16_t b,
+	uint16_t before, uint16_t got_f, uint16_t got_d, uint16_t want_f,
+	uint16_t want_d)
+{
+	pthread_mutex_lock(&report_lock);
+	if (failed++ < 10)
+		fprintf(stderr, "%s%s a=%04x b=%04x before=%04x: "
+			"got %04x %04x, want %04x %04x\n", name, how, a, b,
+			before, got_f, got_d, want_f, want_d);
+	pthread_mutex_unlock(&report_lock);
+}
+
+/*
+ * Compare all kernels for one operand pair
+ * Returns the number of mismatches
+ */
+static unsigned long check_pair(uint16_t a, uint16_t b)
+{
+	uint16_t f, d, ref_f, ref_d;
+	unsigned long bad;
+	size_t i, j;
+
+	bad = 0;
+	for (i = 0; i < KERNELS; ++i)
+		for (j = 0; j < sizeof flags / sizeof *flags; ++j) {
+			/* Separate registers */
+			f = ref_f = flags[j];
+			d = ref_d = POISON;
+			kernels[i].fn(&f, &d, a, b);
+			kernels[i].ref(&ref_f, &ref_d, a, b);
+			if (f != ref_f || d != ref_d) {
+				report(kernels[i].name, "", a, b, flags[j],
+					f, d, ref_f, ref_d);
+				++bad;
+			}
+
+			/* Destination is the flag or remainder register */
+			f = ref_f = flags[j];
+			kernels[i].fn(&f, &f, a, b);
+			kernels[i].ref(&ref_f, &ref_f, a, b);
+			if (f != ref_f) {
+				report(kernels[i].name, " aliased", a, b,
+					flags[j], f, f, ref_f, ref_f);
+				++bad;
+			}
+		}
+
+	for (j = 0; j < sizeof flags / sizeof *flags; ++j) {
+		f = ref_f = flags[j];
+		s16cmp(&f, a, b);
+		s16cmp_ref(&ref_f, a, b);
+		if (f != ref_f) {
+			report("cmp", "", a, b, flags[j], f, 0, ref_f, 0);
+			++bad;
+		}
+	}
+
+	d = ref_d = POISON;
+	s16cmplt(&d, a, b);
+	s16cmplt_ref(&ref_d, a, b);
+	if (d != ref_d) {
+		report("cmplt", "", a, b, POISON, 0, d, 0, ref_d);
+		++bad;
+	}
+
+	d = ref_d = POISON;
+	s16cmpgt(&d, a, b);
+	s16cmpgt_ref(&ref_d, a, b);
+	if (d != ref_d) {
+		report("cmpgt", "", a, b, POISON, 0, d, 0, ref_d);
+		++bad;
+	}
+
+	return bad;
+}
+
+static int failures(void)
+{
+	int n;
+
+	pthread_mutex_lock(&report_lock);
+	n = failed;
+	pthread_mutex_unlock(&report_lock);
+	return n;
+}
+
+static void *check(void *arg)
+{
+	struct share *share;
+	unsigned a, b;
+
+	share = arg;
+	for (a = share->first; a < 0x10000 && !failures(); a += share->step)
+		for (b = 0; b < 0x10000; ++b)
+			share->mismatches += check_pair(a, b);
+	return NULL;
+}
+
+int main(int argc, char *argv[])
+{
+	struct share *shares;
+	pthread_t *threads;
+	unsigned long mismatches;
+	long nthreads, stride, i;
+	int opt;
+
+	nthreads = sysconf(_SC_NPROCESSORS_ONLN);
+	stride = 1;
+
+	while (-1 != (opt = getopt(argc, argv, "ht:s:")))
+		switch (opt) {
+		case 't':
+			nthreads = atol(optarg);
+			break;
+		case 's':
+			stride = atol(optarg);
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind != argc || nthreads < 1 || stride < 1)
+		goto print_usage;
+
+	shares = calloc(nthreads, sizeof *shares);
+	threads = calloc(nthreads, sizeof *threads);
+	if (!shares || !threads) {
+		perror("calloc");
+		return 1;
+	}
+
+	/* Thread i takes every nthreads-th value of a in steps of stride */
+	for (i = 0; i < nthreads; ++i) {
+		shares[i].first = i * stride;
+		shares[i].step = nthreads * stride;
+		if (pthread_create(&threads[i], NULL, check, &shares[i])) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	mismatches = 0;
+	for (i = 0; i < nthreads; ++i) {
+		pthread_join(threads[i], NULL);
+		mismatches += shares[i].mismatches;
+	}
+	free(threads);
+	free(shares);
+
+	if (mismatches) {
+		fprintf(stderr, "%lu mismatches\n", mismatches);
+		return 1;
+	}
+	printf("%s pairs of %d kernels match\n",
+		stride == 1 ? "All 2^32" : "Sampled", (int) KERNELS + 3);
+	return 0;
+
+print_usage:
+	fprintf(stderr, "Usage %s [-t THREADS] [-s STRIDE]\n"
+		"  -t      threads to check on, default one per CPU\n"
+		"  -s      only check every STRIDE-th value of the first "
+		"operand\n", argv[0]);
+	return 1;
+}
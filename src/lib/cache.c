@@ -0,0 +1,190 @@
+/*
+ * Cache simulation
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vec.h>
+#include "cpu.h"
+#include "symtab.h"
+#include "cache.h"
+
+#define ADDR_COUNT 0x10000
+
+static
+int
+is_pow2(unsigned long x)
+{
+	return x && !(x & (x - 1));
+}
+
+int
+cache_init(s16cache *cache, const char *spec)
+{
+	unsigned long size, ways, line;
+	char policy[8];
+	int n;
+
+	policy[0] = 0;
+	n = sscanf(spec, "%lu:%lu:%lu:%7s", &size, &ways, &line, policy);
+	if (n < 3 || !is_pow2(size) || !is_pow2(ways) || !is_pow2(line)
+			|| size > ADDR_COUNT || ways * line > size)
+		goto err;
+
+	if (!policy[0] || !strcmp(policy, "lru"))
+		cache->policy = CACHE_LRU;
+	else if (!strcmp(policy, "random"))
+		cache->policy = CACHE_RANDOM;
+	else
+		goto err;
+
+	cache->size = size;
+	cache->ways = ways;
+	cache->line = line;
+	cache->sets = size / (ways * line);
+	for (cache->line_shift = 0; (1ul << cache->line_shift) < line;
+			++cache->line_shift)
+		;
+
+	cache->tags = malloc(cache->sets * ways * sizeof *cache->tags);
+	cache->stamps = calloc(cache->sets * ways, sizeof *cache->stamps);
+	cache->hits = calloc(ADDR_COUNT, sizeof *cache->hits);
+	cache->misses = calloc(ADDR_COUNT, sizeof *cache->misses);
+	if (!cache->tags || !cache->stamps || !cache->hits || !cache->misses)
+		abort();
+	memset(cache->tags, 0xff, cache->sets * ways * sizeof *cache->tags);
+	cache->clock = 0;
+	cache->rng = 0x5eed;
+	cache->miss_cnt = 0;
+	return 0;
+
+err:
+	fprintf(stderr, "Invalid cache %s, expected SIZE:WAYS:LINE[:lru|random]"
+		" in words and powers of two\n", spec);
+	return -1;
+}
+
+int
+cache_access(s16cache *cache, uint16_t addr)
+{
+	int32_t tag, *tags;
+	uint64_t *stamps;
+	unsigned way, victim;
+
+	tag = addr >> cache->line_shift;
+	tags = &cache->tags[(tag & (cache->sets - 1)) * cache->ways];
+	stamps = &cache->stamps[tags - cache->tags];
+	++cache->clock;
+
+	for (way = 0; way < cache->ways; ++way)
+		if (tags[way] == tag) {
+			stamps[way] = cache->clock;
+			++cache->hits[addr];
+			return 1;
+		}
+
+	/* Fill an empty way first, then evict */
+	victim = 0;
+	for (way = 0; way < cache->ways; ++way) {
+		if (-1 == tags[way]) {
+			victim = way;
+			goto fill;
+		}
+		if (stamps[way] < stamps[victim])
+			victim = way;
+	}
+	if (CACHE_RANDOM == cache->policy) {
+		/* xorshift32 */
+		cache->rng ^= cache->rng << 13;
+		cache->rng ^= cache->rng >> 17;
+		cache->rng ^= cache->rng << 5;
+		victim = cache->rng & (cache->ways - 1);
+	}
+
+fill:
+	tags[victim] = tag;
+	stamps[victim] = cache->clock;
+	++cache->misses[addr];
+	++cache->miss_cnt;
+	return 0;
+}
+
+static
+void
+report_group(FILE *fp, const s16symtab *symtab, const s16sym *sym,
+	size_t start, unsigned long hits, unsigned long misses)
+{
+	char region[8];
+	const char *name;
+	int len;
+
+	if (!(hits + misses))
+		return;
+
+	if (sym) {
+		name = sym->name;
+		len = sym->len;
+	} else if (symtab) {
+		name = "(no symbol)";
+		len = strlen(name);
+	} else {
+		sprintf(region, "%04zx", start);
+		name = region;
+		len = strlen(name);
+	}
+
+	fprintf(fp, "  %-20.*s %12lu %12lu %7.2f%%\n", len, name,
+		hits + misses, misses, 100.0 * misses / (hits + misses));
+}
+
+void
+cache_report(FILE *fp, const char *name, const s16cache *cache,
+	const s16symtab *symtab)
+{
+	static const s16sym total = { 0, 5, "total" };
+	unsigned long hits, misses, total_hits, total_misses;
+	const s16sym *sym;
+	size_t addr, start;
+
+	fprintf(fp, "%s: %u words, %u-way, %u word lines, %s\n", name,
+		cache->size, cache->ways, cache->line,
+		CACHE_LRU == cache->policy ? "LRU" : "random");
+	fprintf(fp, "  %-20s %12s %12s %8s\n", "", "accesses", "misses", "miss");
+
+	total_hits = total_misses = 0;
+	for (addr = 0; addr < ADDR_COUNT; ++addr) {
+		total_hits += cache->hits[addr];
+		total_misses += cache->misses[addr];
+	}
+	report_group(fp, NULL, &total, 0, total_hits, total_misses);
+
+	/* A group ends where the next symbol, or 256 word region, starts */
+	start = 0;
+	sym = symtab ? symtab_lookup(symtab, 0) : NULL;
+	hits = misses = 0;
+	for (addr = 0; addr <= ADDR_COUNT; ++addr) {
+		if (addr == ADDR_COUNT || (symtab
+				? symtab_lookup(symtab, addr) != sym : !(addr & 0xff))) {
+			report_group(fp, symtab, sym, start, hits, misses);
+			if (addr == ADDR_COUNT)
+				break;
+			start = addr;
+			sym = symtab ? symtab_lookup(symtab, addr) : NULL;
+			hits = misses = 0;
+		}
+
+		hits += cache->hits[addr];
+		misses += cache->misses[addr];
+	}
+}
+
+void
+cache_free(s16cache *cache)
+{
+	free(cache->tags);
+	free(cache->stamps);
+	free(cache->hits);
+	free(cache->misses);
+}
@@ -0,0 +1,66 @@
+#ifndef CACHE_H
+#define CACHE_H
+
+/*
+ * Replacement policies
+ */
+#define CACHE_LRU    0
+#define CACHE_RANDOM 1
+
+/*
+ * Set associative cache over word addresses, only hits and misses are
+ *  modelled. Writes allocate like reads do
+ */
+struct s16cache {
+	/* Geometry in words, size = sets * ways * line */
+	unsigned size, ways, line, sets;
+	unsigned line_shift;
+	int policy;
+	/* Line held by each way of each set, -1 if none */
+	int32_t *tags;
+	/* When each way was last used, for LRU */
+	uint64_t *stamps;
+	uint64_t clock;
+	/* State of the generator picking victims for CACHE_RANDOM */
+	uint32_t rng;
+	/* Hits and misses by address, and all misses so far */
+	unsigned long *hits, *misses;
+	unsigned long miss_cnt;
+};
+
+typedef struct s16cache s16cache;
+
+/*
+ * Set up a cache from a "SIZE:WAYS:LINE[:lru|random]" spec, all in words
+ *  and powers of two, e.g. "1024:2:8:lru"
+ * Returns zero on success, -1 with a message on stderr if the spec is bad
+ */
+int
+cache_init(s16cache *cache, const char *spec);
+
+/*
+ * Look up an address, filling its line on a miss
+ * Returns nonzero on a hit
+ */
+int
+cache_access(s16cache *cache, uint16_t addr);
+
+/*
+ * Print totals and hit/miss rates per symbol, or per 256 word region
+ *  without symbols
+ */
+void
+cache_report(FILE *fp, const char *name, const s16cache *cache,
+	const s16symtab *symtab);
+
+void
+cache_free(s16cache *cache);
+
+/*
+ * execute() that also drives cpu->icache and cpu->dcache, either may be
+ *  NULL. Built from cpu.c with CPU_CACHE so execute() itself pays nothing
+ */
+int
+execute_cached(s16cpu *cpu);
+
+#endif
@@ -0,0 +1,190 @@
+/*
+ * Control flow graph recovery
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <vec.h>
+#include "decode.h"
+#include "cfg.h"
+
+VEC_GEN(uint32_t, addr)
+
+/*
+ * Statically known target of a jump, CFG_NONE if it depends on a register
+ */
+static int32_t
+jump_target(const s16insn *insn, uint16_t *mem, uint32_t addr)
+{
+	return insn->a ? CFG_NONE : mem[addr + 1];
+}
+
+/*
+ * Instructions after which execution never falls through
+ */
+static _Bool
+is_terminator(const s16insn *insn)
+{
+	return insn->op == OP_JUMP || insn->op == OP_ILLEGAL
+		/* trap R0,Ra,Rb is always an exit as R0 is 0 */
+		|| (insn->op == OP_TRAP && !insn->d);
+}
+
+/*
+ * Mark all words reachable from the worklist
+ */
+static void
+explore(s16cfg *cfg, uint16_t *mem, addrvec *work)
+{
+	uint32_t addr;
+	int32_t target;
+	const s16insn *insn;
+
+	while (work->n) {
+		addr = work->arr[--work->n];
+		if (addr >= cfg->size)
+			continue;
+		cfg->flags[addr] |= CFG_LEADER;
+
+		for (;;) {
+			/* Already decoded, or overlaps another instruction */
+			if (cfg->flags[addr] & (CFG_CODE | CFG_OPERAND))
+				break;
+
+			insn = DECODE(mem[addr]);
+			if (!IS_VALID(insn) || addr + insn->len > cfg->size)
+				break;
+			if (insn->len > 1 && cfg->flags[addr + 1] & CFG_CODE)
+				break;
+
+			cfg->flags[addr] |= CFG_CODE;
+			if (insn->len > 1)
+				cfg->flags[addr + 1] |= CFG_OPERAND;
+
+			if (insn->attr & ATTR_JUMP) {
+				target = jump_target(insn, mem, addr);
+				if (CFG_NONE != target
+						&& (size_t) target < cfg->size) {
+					if (insn->attr & ATTR_CALL)
+						cfg->flags[target] |= CFG_CALLEE;
+					addrvec_add(work, target);
+				}
+			}
+
+			if (is_terminator(insn))
+				break;
+
+			addr += insn->len;
+			if (addr >= cfg->size)
+				break;
+			/* Code after a jump or call starts a new block */
+			if (insn->attr & ATTR_JUMP)
+				cfg->flags[addr] |= CFG_LEADER;
+		}
+	}
+}
+
+/*
+ * Split reachable code into basic blocks
+ */
+static void
+split(s16cfg *cfg, uint16_t *mem)
+{
+	uint32_t addr, last;
+	int32_t target;
+	const s16insn *insn;
+	s16block block;
+
+	for (addr = 0; addr < cfg->size; ) {
+		if (!(cfg->flags[addr] & CFG_CODE)) {
+			++addr;
+			continue;
+		}
+
+		block.start = addr;
+		for (;;) {
+			last = addr;
+			insn = DECODE(mem[addr]);
+			addr += insn->len;
+			if (insn->attr & ATTR_JUMP || is_terminator(insn))
+				break;
+			if (addr >= cfg->size || !(cfg->flags[addr] & CFG_CODE)
+					|| cfg->flags[addr] & CFG_LEADER)
+				break;
+		}
+		block.end = addr;
+
+		block.jump = CFG_NONE;
+		block.next = CFG_NONE;
+		block.call = CFG_NONE;
+		block.indirect = 0;
+
+		if (insn->attr & ATTR_JUMP) {
+			target = jump_target(insn, mem, last);
+			block.indirect = CFG_NONE == target;
+			if (insn->attr & ATTR_CALL)
+				block.call = target;
+			else
+				block.jump = target;
+		}
+
+		if (!is_terminator(insn) && addr < cfg->size
+				&& cfg->flags[addr] & CFG_CODE)
+			block.next = addr;
+
+		blockvec_add(&cfg->blocks, block);
+	}
+}
+
+int
+cfg_build(s16cfg *cfg, uint16_t *mem, size_t size,
+	const uint16_t *entries, size_t entry_cnt)
+{
+	addrvec work;
+	size_t i;
+
+	cfg->size = size;
+	cfg->flags = calloc(size ? size : 1, sizeof *cfg->flags);
+	if (!cfg->flags)
+		return -1;
+	blockvec_init(&cfg->blocks);
+
+	addrvec_init(&work);
+	for (i = 0; i < entry_cnt; ++i)
+		addrvec_add(&work, entries[i]);
+
+	explore(cfg, mem, &work);
+	split(cfg, mem);
+
+	addrvec_free(&work);
+	return 0;
+}
+
+s16block *
+cfg_lookup(s16cfg *cfg, uint16_t addr)
+{
+	size_t lo, hi, mid;
+	s16block *block;
+
+	lo = 0;
+	hi = cfg->blocks.n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		block = &cfg->blocks.arr[mid];
+		if (addr < block->start)
+			hi = mid;
+		else if (addr >= block->end)
+			lo = mid + 1;
+		else
+			return block;
+	}
+
+	return NULL;
+}
+
+void
+cfg_free(s16cfg *cfg)
+{
+	free(cfg->flags);
+	blockvec_free(&cfg->blocks);
+}
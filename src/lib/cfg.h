@@ -0,0 +1,58 @@
+#ifndef CFG_H
+#define CFG_H
+
+/*
+ * Per word flags
+ */
+#define CFG_CODE    0x01 /* First word of a reachable instruction */
+#define CFG_OPERAND 0x02 /* Displacement word of a reachable instruction */
+#define CFG_LEADER  0x04 /* First word of a basic block */
+#define CFG_CALLEE  0x08 /* Target of a jal */
+
+/* Successor that does not exist or is not known statically */
+#define CFG_NONE -1
+
+typedef struct {
+	/* First word and one past the last word */
+	uint32_t start, end;
+	/* Successors: jump target and fall-through */
+	int32_t jump, next;
+	/* Callee of a terminating jal */
+	int32_t call;
+	/* Ends in a jump whose target depends on a register */
+	_Bool indirect;
+} s16block;
+
+VEC_GEN(s16block, block)
+
+typedef struct {
+	/* Size of the image in words */
+	size_t size;
+	/* CFG_* flags of each word */
+	uint8_t *flags;
+	/* Basic blocks ordered by address */
+	blockvec blocks;
+} s16cfg;
+
+/*
+ * Recover the control flow graph of an image by recursive descent from
+ *  the given entry points, words never reached are treated as data
+ * Returns zero on success, -1 on allocation failure
+ */
+int
+cfg_build(s16cfg *cfg, uint16_t *mem, size_t size,
+	const uint16_t *entries, size_t entry_cnt);
+
+/*
+ * Find the block containing a word, NULL if it is data
+ */
+s16block *
+cfg_lookup(s16cfg *cfg, uint16_t addr);
+
+/*
+ * Free a control flow graph
+ */
+void
+cfg_free(s16cfg *cfg);
+
+#endif
@@ -4,8 +4,55 @@
 
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
 #include "alu.h"
 #include "cpu.h"
+#include "decode.h"
+
+/*
+ * Cache simulation hooks, compiled in only for execute_cached()
+ */
+#ifdef CPU_CACHE
+#include <vec.h>
+#include "symtab.h"
+#include "cache.h"
+#define execute execute_cached
+#define CACHE(cache, addr) \
+	((cache) ? (void) cache_access(cache, addr) : (void) 0)
+#else
+#define CACHE(cache, addr) ((void) 0)
+#endif
+
+/*
+ * Fuzzing hooks, compiled in only for execute_fuzz(). Guest input comes
+ *  from the fuzzer, guest output is dropped and bad traps are flagged
+ *  instead of warned about
+ */
+#ifdef CPU_FUZZ
+#include "fuzz.h"
+#define execute execute_fuzz
+#define getchar() fuzz_getchar(cpu->fuzz)
+#define putchar(c) ((void) (c))
+#define BAD_TRAP(cpu, msg) ((cpu)->fuzz->bad_trap = 1)
+#define DIRTY(cpu, addr) fuzz_dirty((cpu)->fuzz, addr)
+#define EDGE(cpu) fuzz_edge((cpu)->fuzz, (cpu)->pc)
+#else
+#define BAD_TRAP(cpu, msg) fprintf(stderr, msg)
+#define DIRTY(cpu, addr) ((void) 0)
+#define EDGE(cpu) ((void) 0)
+#endif
+
+/*
+ * Memory access hook, compiled in only for execute_hooked()
+ */
+#ifdef CPU_HOOKS
+#define execute execute_hooked
+#define ACCESS(cpu, addr, kind) \
+	((cpu)->access ? (cpu)->access(cpu, addr, kind) : (void) 0)
+#else
+#define ACCESS(cpu, addr, kind) ((void) 0)
+#endif
 
 /*
  * Traps
@@ -20,12 +67,16 @@ void
 trap_read(s16cpu *cpu, uint16_t a, uint16_t b)
 {
 	if (a + b > RAM_WORDS) {
-		fprintf(stderr, "WARN: out of bounds trap read detected!!\n");
+		BAD_TRAP(cpu, "WARN: out of bounds trap read detected!!\n");
 		return;
 	}
 
-	while (b--)
+	while (b--) {
+		CACHE(cpu->dcache, a);
+		DIRTY(cpu, a);
+		ACCESS(cpu, a, ACCESS_STORE);
 		cpu->ram[a++] = getchar();
+	}
 }
 
 static
@@ -33,103 +84,238 @@ void
 trap_write(s16cpu *cpu, uint16_t a, uint16_t b)
 {
 	if (a + b > RAM_WORDS) {
-		fprintf(stderr, "WARN: out of bounds trap write detected!!\n");
+		BAD_TRAP(cpu, "WARN: out of bounds trap write detected!!\n");
 		return;
 	}
 
-	while (b--)
+	while (b--) {
+		CACHE(cpu->dcache, a);
+		ACCESS(cpu, a, ACCESS_LOAD);
 		putchar(cpu->ram[a++]);
+	}
+}
+
+/*
+ * Block memory operations, ranges wrap around the end of RAM like effective
+ *  addresses do
+ */
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+static
+void
+fill_words(uint16_t *p, uint16_t val, size_t n)
+{
+#if defined(__AVX2__)
+	__m256i v;
+
+	v = _mm256_set1_epi16((short) val);
+	for (; n >= 16; n -= 16, p += 16)
+		_mm256_storeu_si256((__m256i *) p, v);
+#elif defined(__SSE2__)
+	__m128i v;
+
+	v = _mm_set1_epi16((short) val);
+	for (; n >= 8; n -= 8, p += 8)
+		_mm_storeu_si128((__m128i *) p, v);
+#endif
+
+	while (n--)
+		*p++ = val;
+}
+
+#define WRAP(ram, addr) ((ram)[(uint16_t) (addr)])
+
+/*
+ * Both are kept out of line, inlined they make execute() save more registers
+ *  on every instruction
+ */
+static
+__attribute__((noinline))
+void
+block_fill(s16cpu *cpu, uint16_t dst, uint16_t val, uint16_t n)
+{
+	uint32_t i;
+
+	for (i = 0; i < n; ++i) {
+		CACHE(cpu->dcache, dst + i);
+		DIRTY(cpu, dst + i);
+		ACCESS(cpu, dst + i, ACCESS_STORE);
+	}
+
+	if (dst + n <= RAM_WORDS) {
+		fill_words(cpu->ram + dst, val, n);
+	} else {
+		fill_words(cpu->ram + dst, val, RAM_WORDS - dst);
+		fill_words(cpu->ram, val, dst + n - RAM_WORDS);
+	}
+}
+
+/*
+ * Copy as if through a temporary buffer, like memmove()
+ */
+static
+__attribute__((noinline))
+void
+block_copy(s16cpu *cpu, uint16_t dst, uint16_t src, uint16_t n)
+{
+	uint16_t *tmp;
+	uint32_t i, off;
+
+	for (i = 0; i < n; ++i) {
+		CACHE(cpu->dcache, src + i);
+		CACHE(cpu->dcache, dst + i);
+		DIRTY(cpu, dst + i);
+		ACCESS(cpu, src + i, ACCESS_LOAD);
+		ACCESS(cpu, dst + i, ACCESS_STORE);
+	}
+
+	if (src + n <= RAM_WORDS && dst + n <= RAM_WORDS) {
+		memmove(cpu->ram + dst, cpu->ram + src, n * sizeof *cpu->ram);
+		return;
+	}
+
+	/* A range wraps around, copy backwards if dst starts inside src. Long
+	 *  ranges can overlap at both ends, those need the buffer */
+	off = (uint16_t) (dst - src);
+	if (off >= n) {
+		for (i = 0; i < n; ++i)
+			WRAP(cpu->ram, dst + i) = WRAP(cpu->ram, src + i);
+	} else if (off + n <= RAM_WORDS) {
+		for (i = n; i--; )
+			WRAP(cpu->ram, dst + i) = WRAP(cpu->ram, src + i);
+	} else {
+		tmp = malloc(n * sizeof *tmp);
+		if (!tmp)
+			abort();
+		for (i = 0; i < n; ++i)
+			tmp[i] = WRAP(cpu->ram, src + i);
+		for (i = 0; i < n; ++i)
+			WRAP(cpu->ram, dst + i) = tmp[i];
+		free(tmp);
+	}
 }
 
 /*
  * Instruction dispatcher
  */
 
-#define INSN_OP(insn) (insn >> 12 & 0xf)
-#define INSN_RD(insn) (insn >> 8 & 0xf)
-#define INSN_RA(insn) (insn >> 4 & 0xf)
-#define INSN_RB(insn) (insn & 0xf)
+/* Second word of RX instructions, the displacement */
+#define FETCH_RX(cpu) \
+	(CACHE((cpu)->icache, (cpu)->pc), \
+	 ACCESS(cpu, (cpu)->pc, ACCESS_FETCH), \
+	 (cpu)->adr = (cpu)->ram[(cpu)->pc++])
+
+/* Second word of EXP instructions, their sub-opcode takes up Ra as well */
+#define FETCH_EXP(cpu, a) \
+	do { \
+		if (a) \
+			return -1; \
+		FETCH_RX(cpu); \
+	} while (0)
+
+/* Same handler for all 16 values of the lowest nibble */
+#define ALL16(label) \
+	label, label, label, label, label, label, label, label, \
+	label, label, label, label, label, label, label, label,
 
 int
 execute(s16cpu *cpu)
 {
-	static void *jmp_RRR[] = {
-		&&op_add, &&op_sub, &&op_mul, &&op_div, &&op_cmp, &&op_cmplt,
-		&&op_cmpeq, &&op_cmpgt, &&op_inv, &&op_and, &&op_or, &&op_xor,
-		&&op_addc, &&op_trap, &&op_exp, &&op_rx
-	};
-
-	static void *jmp_RX[] = {
+	/* Handlers by opcode and lowest nibble, the sub-opcode of RX and EXP */
+	static void *jmp[0x100] = {
+		ALL16(&&op_add) ALL16(&&op_sub) ALL16(&&op_mul) ALL16(&&op_div)
+		ALL16(&&op_cmp) ALL16(&&op_cmplt) ALL16(&&op_cmpeq)
+		ALL16(&&op_cmpgt) ALL16(&&op_inv) ALL16(&&op_and) ALL16(&&op_or)
+		ALL16(&&op_xor) ALL16(&&op_addc) ALL16(&&op_trap)
+		&&op_shiftl, &&op_shiftr, &&op_shiftra, &&op_rotl, &&op_rotr,
+		&&op_extract, &&op_insert, &&op_bcopy, &&op_bfill,
+		&&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal,
+		&&op_illegal, &&op_illegal, &&op_illegal,
 		&&op_lea, &&op_load, &&op_store, &&op_jump, &&op_jumpc0,
-		&&op_jumpc1, &&op_jumpf, &&op_jumpt, &&op_jal
+		&&op_jumpc1, &&op_jumpf, &&op_jumpt, &&op_jal,
+		&&op_illegal, &&op_illegal, &&op_illegal, &&op_illegal,
+		&&op_illegal, &&op_illegal, &&op_illegal
 	};
 
-	uint8_t op, d, a, b;
+	uint8_t d, a, b;
+	int ret;
 
+	CACHE(cpu->icache, cpu->pc);
+	ACCESS(cpu, cpu->pc, ACCESS_FETCH);
 	cpu->ir = cpu->ram[cpu->pc++];
 
-	op = INSN_OP(cpu->ir);
-	d = INSN_RD(cpu->ir);
-	a = INSN_RA(cpu->ir);
-	b = INSN_RB(cpu->ir);
+	d = cpu->ir >> 8 & 0xf;
+	a = cpu->ir >> 4 & 0xf;
+	b = cpu->ir & 0xf;
 
-	goto *jmp_RRR[op];
+	/* RX and EXP handlers fetch their second word themselves */
+	goto *jmp[(cpu->ir >> 8 & 0xf0) | b];
 
-	switch (op) {
-	case 0: /* add */
+	switch (DECODE(cpu->ir)->op) {
+	case OP_ADD:
 	op_add:
 		s16add(&cpu->reg[15], &cpu->reg[d], cpu->reg[a], cpu->reg[b]);
 		break;
-	case 1: /* sub */
+	case OP_SUB:
 	op_sub:
 		s16sub(&cpu->reg[15], &cpu->reg[d], cpu->reg[a], cpu->reg[b]);
 		break;
-	case 2: /* mul */
+	case OP_MUL:
 	op_mul:
 		s16mul(&cpu->reg[15], &cpu->reg[d], cpu->reg[a], cpu->reg[b]);
 		break;
-	case 3: /* div */
+	case OP_DIV:
 	op_div:
 		s16div(&cpu->reg[d], &cpu->reg[15], cpu->reg[a], cpu->reg[b]);
 		break;
-	case 4: /* cmp */
+	case OP_CMP:
 	op_cmp:
 		s16cmp(&cpu->reg[15], cpu->reg[a], cpu->reg[b]);
 		break;
-	case 5: /* cmplt */
+	case OP_CMPLT:
 	op_cmplt:
 		s16cmplt(&cpu->reg[d], cpu->reg[a], cpu->reg[b]);
 		break;
-	case 6: /* cmpeq */
+	case OP_CMPEQ:
 	op_cmpeq:
 		cpu->reg[d] = cpu->reg[a] == cpu->reg[b];
 		break;
-	case 7: /* cmpgt */
+	case OP_CMPGT:
 	op_cmpgt:
 		s16cmpgt(&cpu->reg[d], cpu->reg[a], cpu->reg[b]);
 		break;
-	case 8: /* inv */
+	case OP_INV:
 	op_inv:
 		cpu->reg[d] = (uint16_t) ~cpu->reg[a];
 		break;
-	case 9: /* and */
+	case OP_AND:
 	op_and:
 		cpu->reg[d] = cpu->reg[a] & cpu->reg[b];
 		break;
-	case 0xa: /* or */
+	case OP_OR:
 	op_or:
 		cpu->reg[d] = cpu->reg[a] | cpu->reg[b];
 		break;
-	case 0xb: /* xor */
+	case OP_XOR:
 	op_xor:
 		cpu->reg[d] = cpu->reg[a] ^ cpu->reg[b];
 		break;
-	case 0xc: /* addc */
+	case OP_ADDC:
 	op_addc:
 		s16addc(&cpu->reg[15], &cpu->reg[d], cpu->reg[a], cpu->reg[b]);
 		break;
-	case 0xd: /* trap */
+	case OP_TRAP:
 	op_trap:
+		if (cpu->trap) {
+			ret = cpu->trap(cpu, cpu->reg[d], cpu->reg[a], cpu->reg[b]);
+			if (TRAP_PASS != ret)
+				return ret;
+		}
 		switch (cpu->reg[d]) {
 		case TRAP_EXIT:
 			return 0;
@@ -141,59 +327,121 @@ execute(s16cpu *cpu)
 			break;
 		}
 		break;
-	case 0xe: /* EXP format, current unused */
-	op_exp:
+	case OP_SHIFTL:
+	op_shiftl:
+		FETCH_EXP(cpu, a);
+		cpu->reg[d] = (uint16_t)
+			(cpu->reg[EXP_A(cpu->adr)] << EXP_P(cpu->adr));
 		break;
-	case 0xf: /* RX format */
-	op_rx:
-		cpu->adr = cpu->ram[cpu->pc++];
-
-		goto *jmp_RX[b];
-
-		switch (b) {
-		case 0: /* lea */
-		op_lea:
-			cpu->reg[d] = cpu->adr + cpu->reg[a];
-			break;
-		case 1: /* load */
-		op_load:
-			cpu->reg[d] = cpu->ram[cpu->adr + cpu->reg[a]];
-			break;
-		case 2: /* store */
-		op_store:
-			cpu->ram[cpu->adr + cpu->reg[a]] = cpu->reg[d];
-			break;
-		case 3: /* jump */
-		op_jump:
+	case OP_SHIFTR:
+	op_shiftr:
+		FETCH_EXP(cpu, a);
+		cpu->reg[d] = cpu->reg[EXP_A(cpu->adr)] >> EXP_P(cpu->adr);
+		break;
+	case OP_SHIFTRA:
+	op_shiftra:
+		FETCH_EXP(cpu, a);
+		s16shiftra(&cpu->reg[d], cpu->reg[EXP_A(cpu->adr)],
+			EXP_P(cpu->adr));
+		break;
+	case OP_ROTL:
+	op_rotl:
+		FETCH_EXP(cpu, a);
+		s16rotl(&cpu->reg[d], cpu->reg[EXP_A(cpu->adr)], EXP_P(cpu->adr));
+		break;
+	case OP_ROTR:
+	op_rotr:
+		FETCH_EXP(cpu, a);
+		s16rotr(&cpu->reg[d], cpu->reg[EXP_A(cpu->adr)], EXP_P(cpu->adr));
+		break;
+	case OP_EXTRACT:
+	op_extract:
+		FETCH_EXP(cpu, a);
+		s16extract(&cpu->reg[d], cpu->reg[EXP_A(cpu->adr)],
+			EXP_P(cpu->adr), EXP_Q(cpu->adr) + 1);
+		break;
+	case OP_INSERT:
+	op_insert:
+		FETCH_EXP(cpu, a);
+		s16insert(&cpu->reg[d], cpu->reg[EXP_A(cpu->adr)],
+			EXP_P(cpu->adr), EXP_Q(cpu->adr) + 1);
+		break;
+	case OP_BCOPY:
+	op_bcopy:
+		FETCH_EXP(cpu, a);
+		block_copy(cpu, cpu->reg[d], cpu->reg[EXP_A(cpu->adr)],
+			cpu->reg[EXP_B(cpu->adr)]);
+		break;
+	case OP_BFILL:
+	op_bfill:
+		FETCH_EXP(cpu, a);
+		block_fill(cpu, cpu->reg[d], cpu->reg[EXP_A(cpu->adr)],
+			cpu->reg[EXP_B(cpu->adr)]);
+		break;
+	case OP_LEA:
+	op_lea:
+		FETCH_RX(cpu);
+		cpu->reg[d] = cpu->adr + cpu->reg[a];
+		break;
+	case OP_LOAD:
+	op_load:
+		FETCH_RX(cpu);
+		CACHE(cpu->dcache, cpu->adr + cpu->reg[a]);
+		ACCESS(cpu, cpu->adr + cpu->reg[a], ACCESS_LOAD);
+		cpu->reg[d] = cpu->ram[(uint16_t) (cpu->adr + cpu->reg[a])];
+		break;
+	case OP_STORE:
+	op_store:
+		FETCH_RX(cpu);
+		CACHE(cpu->dcache, cpu->adr + cpu->reg[a]);
+		DIRTY(cpu, cpu->adr + cpu->reg[a]);
+		ACCESS(cpu, cpu->adr + cpu->reg[a], ACCESS_STORE);
+		cpu->ram[(uint16_t) (cpu->adr + cpu->reg[a])] = cpu->reg[d];
+		break;
+	case OP_JUMP:
+	op_jump:
+		FETCH_RX(cpu);
+		cpu->pc = cpu->adr + cpu->reg[a];
+		EDGE(cpu);
+		break;
+	case OP_JUMPC0:
+	op_jumpc0:
+		FETCH_RX(cpu);
+		if (!GET_BIT(cpu->reg[15], d))
 			cpu->pc = cpu->adr + cpu->reg[a];
-			break;
-		case 4: /* jumpc0 */
-		op_jumpc0:
-			if (!GET_BIT(cpu->reg[15], d))
-				cpu->pc = cpu->adr + cpu->reg[a];
-			break;
-		case 5: /* jumpc1 */
-		op_jumpc1:
-			if (GET_BIT(cpu->reg[15], d))
-				cpu->pc = cpu->adr + cpu->reg[a];
-			break;
-		case 6: /* jumpf */
-		op_jumpf:
-			if (!cpu->reg[d])
-				cpu->pc = cpu->adr +  cpu->reg[a];
-			break;
-		case 7: /* jumpt */
-		op_jumpt:
-			if (cpu->reg[d])
-				cpu->pc = cpu->adr + cpu->reg[a];
-			break;
-		case 8: /* jal */
-		op_jal:
-			cpu->reg[d] = cpu->pc;
+		EDGE(cpu);
+		break;
+	case OP_JUMPC1:
+	op_jumpc1:
+		FETCH_RX(cpu);
+		if (GET_BIT(cpu->reg[15], d))
 			cpu->pc = cpu->adr + cpu->reg[a];
-			break;
-		}
+		EDGE(cpu);
 		break;
+	case OP_JUMPF:
+	op_jumpf:
+		FETCH_RX(cpu);
+		if (!cpu->reg[d])
+			cpu->pc = cpu->adr +  cpu->reg[a];
+		EDGE(cpu);
+		break;
+	case OP_JUMPT:
+	op_jumpt:
+		FETCH_RX(cpu);
+		if (cpu->reg[d])
+			cpu->pc = cpu->adr + cpu->reg[a];
+		EDGE(cpu);
+		break;
+	case OP_JAL:
+	op_jal:
+		FETCH_RX(cpu);
+		cpu->reg[d] = cpu->pc;
+		cpu->pc = cpu->adr + cpu->reg[a];
+		EDGE(cpu);
+		break;
+	case OP_ILLEGAL:
+	op_illegal:
+		return -1;
 	}
 
 	/* Enforce R0 = 0 */
@@ -202,6 +450,7 @@ execute(s16cpu *cpu)
 	return 1;
 }
 
+#if !defined(CPU_CACHE) && !defined(CPU_FUZZ) && !defined(CPU_HOOKS)
 ssize_t
 load_program(const char *path, s16cpu *cpu)
 {
@@ -233,3 +482,4 @@ err:
 	fclose(file);
 	return -1;
 }
+#endif
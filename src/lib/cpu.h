@@ -4,22 +4,57 @@
 #define REG_COUNT 0x10
 #define RAM_WORDS 0x10000 /* 64K words */
 
-typedef struct {
+struct s16cache;
+struct s16fuzz;
+
+/*
+ * Kinds of memory access reported to the access hook
+ */
+#define ACCESS_FETCH 0
+#define ACCESS_LOAD  1
+#define ACCESS_STORE 2
+
+/*
+ * Returned by the trap hook to run the built-in trap after all
+ */
+#define TRAP_PASS 2
+
+typedef struct s16cpu s16cpu;
+
+struct s16cpu {
 	/* Decode registers */
 	uint16_t pc, ir, adr;
 	/* General purpose registers */
 	uint16_t reg[REG_COUNT];
 	/* RAM */
 	uint16_t ram[RAM_WORDS];
-} s16cpu;
+	/* Caches simulated by execute_cached(), see cache.h */
+	struct s16cache *icache, *dcache;
+	/* Input, coverage and written pages of execute_fuzz(), see fuzz.h */
+	struct s16fuzz *fuzz;
+	/* Runs every trap first if set, returns what execute() should or
+	 *  TRAP_PASS for the built-in trap */
+	int (*trap)(s16cpu *cpu, uint16_t number, uint16_t a, uint16_t b);
+	/* Called for each word fetched, loaded or stored by execute_hooked() */
+	void (*access)(s16cpu *cpu, uint16_t addr, int kind);
+	/* Whoever set the hooks above */
+	void *user;
+};
 
 /*
  * Execute one instruction
- * Returns zero if TRAP_EXIT was run, otherise non-zero
+ * Returns zero if TRAP_EXIT was run, negative if the instruction was illegal,
+ *  otherwise positive
  */
 int
 execute(s16cpu *cpu);
 
+/*
+ * execute() that also calls cpu->access, built from cpu.c with CPU_HOOKS
+ */
+int
+execute_hooked(s16cpu *cpu);
+
 /*
  * Load program into RAM
  */
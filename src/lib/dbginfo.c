@@ -0,0 +1,188 @@
+/*
+ * Debug info reader and writer
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vec.h>
+#include "leb.h"
+#include "symtab.h"
+#include "dbginfo.h"
+
+int
+dbginfo_write(int fd, const s16sym *syms, size_t sym_cnt,
+	const s16line *lines, size_t line_cnt)
+{
+	bvec buf;
+	size_t i, off;
+	uint16_t addr;
+	uint32_t line;
+	int ret;
+
+	bvec_init(&buf);
+
+	for (i = 0; i < strlen(DBGINFO_MAGIC); ++i)
+		bvec_add(&buf, DBGINFO_MAGIC[i]);
+	bvec_add(&buf, DBGINFO_VERSION);
+
+	put_uleb(&buf, sym_cnt);
+	for (addr = 0, i = 0; i < sym_cnt; addr = syms[i++].addr) {
+		put_uleb(&buf, (uint16_t) (syms[i].addr - addr));
+		put_uleb(&buf, syms[i].len);
+		for (off = 0; off < syms[i].len; ++off)
+			bvec_add(&buf, syms[i].name[off]);
+	}
+
+	put_uleb(&buf, line_cnt);
+	for (addr = 0, line = 1, i = 0; i < line_cnt; ++i) {
+		put_uleb(&buf, (uint16_t) (lines[i].addr - addr));
+		put_sleb(&buf, (int32_t) (lines[i].line - line));
+		addr = lines[i].addr;
+		line = lines[i].line;
+	}
+
+	ret = write_all(fd, &buf);
+	bvec_free(&buf);
+	return ret;
+}
+
+static int
+compare_line(const void *a, const void *b)
+{
+	return (int) ((const s16line *) a)->addr - ((const s16line *) b)->addr;
+}
+
+/*
+ * Decode the mapped file
+ */
+static int
+parse(s16dbginfo *info)
+{
+	const uint8_t *p, *end;
+	uint32_t cnt, i, len, udelta;
+	int32_t sdelta;
+	uint16_t addr;
+	s16line line;
+	_Bool sorted;
+
+	p = info->map;
+	end = p + info->map_size;
+
+	if (info->map_size < strlen(DBGINFO_MAGIC) + 1
+			|| memcmp(p, DBGINFO_MAGIC, strlen(DBGINFO_MAGIC))
+			|| DBGINFO_VERSION != p[strlen(DBGINFO_MAGIC)])
+		return -1;
+	p += strlen(DBGINFO_MAGIC) + 1;
+
+	/* Symbols */
+	if (-1 == get_uleb(&p, end, &cnt))
+		return -1;
+	for (addr = 0, i = 0; i < cnt; ++i) {
+		if (-1 == get_uleb(&p, end, &udelta)
+				|| -1 == get_uleb(&p, end, &len)
+				|| len > (size_t) (end - p))
+			return -1;
+		addr += udelta;
+		symtab_add(&info->symtab, (const char *) p, len, addr);
+		p += len;
+	}
+	symtab_sort(&info->symtab);
+
+	/* Address to line table */
+	if (-1 == get_uleb(&p, end, &cnt))
+		return -1;
+	line.addr = 0;
+	line.line = 1;
+	sorted = 1;
+	for (i = 0; i < cnt; ++i) {
+		if (-1 == get_uleb(&p, end, &udelta)
+				|| -1 == get_sleb(&p, end, &sdelta))
+			return -1;
+		sorted &= (uint16_t) (line.addr + udelta) >= line.addr;
+		line.addr += udelta;
+		line.line += sdelta;
+		linevec_add(&info->lines, line);
+	}
+	if (!sorted)
+		qsort(info->lines.arr, info->lines.n,
+			sizeof *info->lines.arr, compare_line);
+
+	return 0;
+}
+
+int
+dbginfo_load(s16dbginfo *info, const char *path)
+{
+	int fd;
+	struct stat st;
+
+	symtab_init(&info->symtab);
+	linevec_init(&info->lines);
+	info->map = NULL;
+	info->map_size = 0;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+		goto err;
+
+	if (-1 == fstat(fd, &st))
+		goto err_close;
+
+	if (st.st_size > 0) {
+		info->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (MAP_FAILED == info->map) {
+			info->map = NULL;
+			goto err_close;
+		}
+		info->map_size = st.st_size;
+	}
+	close(fd);
+
+	if (-1 == parse(info)) {
+		fprintf(stderr, "%s: invalid debug info\n", path);
+		goto err_free;
+	}
+	return 0;
+
+err_close:
+	close(fd);
+err:
+	perror(path);
+err_free:
+	dbginfo_free(info);
+	return -1;
+}
+
+uint32_t
+dbginfo_line(const s16dbginfo *info, uint16_t addr)
+{
+	size_t lo, hi, mid;
+
+	/* Find the first entry above addr */
+	lo = 0;
+	hi = info->lines.n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (info->lines.arr[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? info->lines.arr[lo - 1].line : 0;
+}
+
+void
+dbginfo_free(s16dbginfo *info)
+{
+	symtab_free(&info->symtab);
+	linevec_free(&info->lines);
+	if (info->map)
+		munmap(info->map, info->map_size);
+}
@@ -0,0 +1,62 @@
+#ifndef DBGINFO_H
+#define DBGINFO_H
+
+/*
+ * Debug info file layout, integers are LEB128 encoded unless noted:
+ *  magic      "s16d" followed by a version byte
+ *  symbols    count, then per symbol: address delta, name length, name
+ *  lines      count, then per entry: address delta, signed line delta
+ * Address deltas are modulo 64K from the previous entry, starting at 0.
+ *  Line deltas start from line 1 and are zigzag encoded.
+ */
+#define DBGINFO_MAGIC   "s16d"
+#define DBGINFO_VERSION 1
+
+typedef struct {
+	/* First word generated by the line */
+	uint16_t addr;
+	/* Source line number */
+	uint32_t line;
+} s16line;
+
+VEC_GEN(s16line, line)
+
+typedef struct {
+	/* Symbols, names point into the mapping */
+	s16symtab symtab;
+	/* Address to line table sorted by address */
+	linevec lines;
+	/* Read-only mapping of the file */
+	void *map;
+	size_t map_size;
+} s16dbginfo;
+
+/*
+ * Load a debug info file
+ * Returns zero on success, -1 on error in which case nothing needs freeing
+ */
+int
+dbginfo_load(s16dbginfo *info, const char *path);
+
+/*
+ * Find the source line an address was generated from
+ *  Returns zero if unknown
+ */
+uint32_t
+dbginfo_line(const s16dbginfo *info, uint16_t addr);
+
+/*
+ * Free debug info
+ */
+void
+dbginfo_free(s16dbginfo *info);
+
+/*
+ * Write a debug info file with a single write
+ * Returns zero on success, -1 on error
+ */
+int
+dbginfo_write(int fd, const s16sym *syms, size_t sym_cnt,
+	const s16line *lines, size_t line_cnt);
+
+#endif
@@ -0,0 +1,174 @@
+/*
+ * Instruction decoder
+ *
+ * Sigma16 instruction words are 16-bit, so every possible first word is
+ * decoded ahead of time into a constant table. The table is generated by the
+ * preprocessor, each entry is an integer constant expression of its word.
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include "alu.h"
+#include "decode.h"
+
+/* Fields of an instruction word */
+#define W_D(w) ((w) >> 8 & 0xf)
+#define W_A(w) ((w) >> 4 & 0xf)
+#define W_B(w) ((w) & 0xf)
+
+#define IN(op, lo, hi) ((op) >= (lo) && (op) <= (hi))
+#define FBIT(bit) (0x8000 >> (bit))
+
+/* EXP sub-opcodes in use, the handlers are in the same order */
+#define EXP_COUNT (OP_BFILL - OP_SHIFTL + 1)
+#define EXP_OP(w) \
+	(((w) & 0xff) < EXP_COUNT ? OP_SHIFTL + ((w) & 0xff) : OP_ILLEGAL)
+
+/* Register operands of each handler */
+#define READS_D(op) \
+	((op) == OP_TRAP || (op) == OP_STORE || \
+	 (op) == OP_JUMPF || (op) == OP_JUMPT || IN(op, OP_INSERT, OP_BFILL))
+#define READS_A(op) \
+	((op) <= OP_TRAP || IN(op, OP_LEA, OP_JAL))
+#define READS_B(op) \
+	((op) <= OP_TRAP && (op) != OP_INV)
+#define WRITES_D(op) \
+	(((op) <= OP_ADDC && (op) != OP_CMP) || IN(op, OP_SHIFTL, OP_INSERT) || \
+	 (op) == OP_LEA || (op) == OP_LOAD || (op) == OP_JAL)
+
+/* Whole of R15 if register field r is used and names it */
+#define R15(used, r) ((used) && (r) == 15 ? 0xffff : 0)
+
+#define ATTR(op) \
+	((IN(op, OP_LEA, OP_JAL) ? ATTR_RX : 0) | \
+	 (IN(op, OP_JUMP, OP_JAL) ? ATTR_JUMP : 0) | \
+	 (IN(op, OP_JUMPC0, OP_JUMPT) ? ATTR_COND : 0) | \
+	 ((op) == OP_JAL ? ATTR_CALL : 0) | \
+	 ((op) == OP_LOAD ? ATTR_LOAD : 0) | \
+	 ((op) == OP_STORE ? ATTR_STORE : 0) | \
+	 ((op) == OP_TRAP ? ATTR_TRAP : 0) | \
+	 (IN(op, OP_SHIFTL, OP_BFILL) ? ATTR_EXP : 0))
+
+#define LEN(op) (IN(op, OP_SHIFTL, OP_JAL) ? 2 : 1)
+
+#define FREAD(w, op) \
+	(R15(READS_D(op), W_D(w)) | \
+	 R15(READS_A(op), W_A(w)) | \
+	 R15(READS_B(op), W_B(w)) | \
+	 ((op) == OP_ADDC ? FBIT(BIT_ccC) : 0) | \
+	 (IN(op, OP_JUMPC0, OP_JUMPC1) ? FBIT(W_D(w)) : 0))
+
+/* NOTE: flags are not set when R15 is the destination */
+#define FWRITE(w, op) \
+	(R15(WRITES_D(op), W_D(w)) | \
+	 ((op) == OP_DIV ? 0xffff : 0) | \
+	 ((op) == OP_CMP ? FBIT(BIT_ccG) | FBIT(BIT_ccg) | FBIT(BIT_ccE) | \
+		FBIT(BIT_ccl) | FBIT(BIT_ccL) : 0) | \
+	 (W_D(w) == 15 ? 0 : \
+	 ((op) == OP_ADD || (op) == OP_SUB || (op) == OP_ADDC) ? \
+		FBIT(BIT_ccV) | FBIT(BIT_ccv) | FBIT(BIT_ccC) : \
+	 (op) == OP_MUL ? FBIT(BIT_ccv) : 0))
+
+#define E(w, op) \
+	{ op, ATTR(op), W_D(w), W_A(w), W_B(w), LEN(op), \
+		FREAD(w, op), FWRITE(w, op) },
+
+/* Words with a fixed handler */
+#define R4(x, op) \
+	E(x##0, op) E(x##1, op) E(x##2, op) E(x##3, op) \
+	E(x##4, op) E(x##5, op) E(x##6, op) E(x##7, op) \
+	E(x##8, op) E(x##9, op) E(x##a, op) E(x##b, op) \
+	E(x##c, op) E(x##d, op) E(x##e, op) E(x##f, op)
+#define R8(x, op) \
+	R4(x##0, op) R4(x##1, op) R4(x##2, op) R4(x##3, op) \
+	R4(x##4, op) R4(x##5, op) R4(x##6, op) R4(x##7, op) \
+	R4(x##8, op) R4(x##9, op) R4(x##a, op) R4(x##b, op) \
+	R4(x##c, op) R4(x##d, op) R4(x##e, op) R4(x##f, op)
+#define R12(x, op) \
+	R8(x##0, op) R8(x##1, op) R8(x##2, op) R8(x##3, op) \
+	R8(x##4, op) R8(x##5, op) R8(x##6, op) R8(x##7, op) \
+	R8(x##8, op) R8(x##9, op) R8(x##a, op) R8(x##b, op) \
+	R8(x##c, op) R8(x##d, op) R8(x##e, op) R8(x##f, op)
+
+/* EXP words, the handler comes from the lowest byte */
+#define Y4(x) \
+	E(x##0, EXP_OP(x##0)) E(x##1, EXP_OP(x##1)) E(x##2, EXP_OP(x##2)) \
+	E(x##3, EXP_OP(x##3)) E(x##4, EXP_OP(x##4)) E(x##5, EXP_OP(x##5)) \
+	E(x##6, EXP_OP(x##6)) E(x##7, EXP_OP(x##7)) E(x##8, EXP_OP(x##8)) \
+	E(x##9, EXP_OP(x##9)) E(x##a, EXP_OP(x##a)) E(x##b, EXP_OP(x##b)) \
+	E(x##c, EXP_OP(x##c)) E(x##d, EXP_OP(x##d)) E(x##e, EXP_OP(x##e)) \
+	E(x##f, EXP_OP(x##f))
+#define Y8(x) \
+	Y4(x##0) Y4(x##1) Y4(x##2) Y4(x##3) Y4(x##4) Y4(x##5) Y4(x##6) Y4(x##7) \
+	Y4(x##8) Y4(x##9) Y4(x##a) Y4(x##b) Y4(x##c) Y4(x##d) Y4(x##e) Y4(x##f)
+#define Y12(x) \
+	Y8(x##0) Y8(x##1) Y8(x##2) Y8(x##3) Y8(x##4) Y8(x##5) Y8(x##6) Y8(x##7) \
+	Y8(x##8) Y8(x##9) Y8(x##a) Y8(x##b) Y8(x##c) Y8(x##d) Y8(x##e) Y8(x##f)
+
+/* RX words, the handler comes from the lowest nibble */
+#define X4(x) \
+	E(x##0, OP_LEA) E(x##1, OP_LOAD) E(x##2, OP_STORE) E(x##3, OP_JUMP) \
+	E(x##4, OP_JUMPC0) E(x##5, OP_JUMPC1) E(x##6, OP_JUMPF) \
+	E(x##7, OP_JUMPT) E(x##8, OP_JAL) E(x##9, OP_ILLEGAL) \
+	E(x##a, OP_ILLEGAL) E(x##b, OP_ILLEGAL) E(x##c, OP_ILLEGAL) \
+	E(x##d, OP_ILLEGAL) E(x##e, OP_ILLEGAL) E(x##f, OP_ILLEGAL)
+#define X8(x) \
+	X4(x##0) X4(x##1) X4(x##2) X4(x##3) X4(x##4) X4(x##5) X4(x##6) X4(x##7) \
+	X4(x##8) X4(x##9) X4(x##a) X4(x##b) X4(x##c) X4(x##d) X4(x##e) X4(x##f)
+#define X12(x) \
+	X8(x##0) X8(x##1) X8(x##2) X8(x##3) X8(x##4) X8(x##5) X8(x##6) X8(x##7) \
+	X8(x##8) X8(x##9) X8(x##a) X8(x##b) X8(x##c) X8(x##d) X8(x##e) X8(x##f)
+
+const s16insn decode_table[0x10000] = {
+	R12(0x0, OP_ADD)
+	R12(0x1, OP_SUB)
+	R12(0x2, OP_MUL)
+	R12(0x3, OP_DIV)
+	R12(0x4, OP_CMP)
+	R12(0x5, OP_CMPLT)
+	R12(0x6, OP_CMPEQ)
+	R12(0x7, OP_CMPGT)
+	R12(0x8, OP_INV)
+	R12(0x9, OP_AND)
+	R12(0xa, OP_OR)
+	R12(0xb, OP_XOR)
+	R12(0xc, OP_ADDC)
+	R12(0xd, OP_TRAP)
+	Y12(0xe)
+	X12(0xf)
+};
+
+const char *const op_mnemonic[OP_COUNT] = {
+	[OP_ADD]     = "add",
+	[OP_SUB]     = "sub",
+	[OP_MUL]     = "mul",
+	[OP_DIV]     = "div",
+	[OP_CMP]     = "cmp",
+	[OP_CMPLT]   = "cmplt",
+	[OP_CMPEQ]   = "cmpeq",
+	[OP_CMPGT]   = "cmpgt",
+	[OP_INV]     = "inv",
+	[OP_AND]     = "and",
+	[OP_OR]      = "or",
+	[OP_XOR]     = "xor",
+	[OP_ADDC]    = "addc",
+	[OP_TRAP]    = "trap",
+	[OP_SHIFTL]  = "shiftl",
+	[OP_SHIFTR]  = "shiftr",
+	[OP_SHIFTRA] = "shiftra",
+	[OP_ROTL]    = "rotl",
+	[OP_ROTR]    = "rotr",
+	[OP_EXTRACT] = "extract",
+	[OP_INSERT]  = "insert",
+	[OP_BCOPY]   = "bcopy",
+	[OP_BFILL]   = "bfill",
+	[OP_LEA]     = "lea",
+	[OP_LOAD]    = "load",
+	[OP_STORE]   = "store",
+	[OP_JUMP]    = "jump",
+	[OP_JUMPC0]  = "jumpc0",
+	[OP_JUMPC1]  = "jumpc1",
+	[OP_JUMPF]   = "jumpf",
+	[OP_JUMPT]   = "jumpt",
+	[OP_JAL]     = "jal",
+};
@@ -0,0 +1,70 @@
+#ifndef DECODE_H
+#define DECODE_H
+
+/*
+ * Handler indices, RRR opcodes map to themselves, RX opcodes follow
+ */
+enum {
+	/* RRR format */
+	OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_CMP, OP_CMPLT, OP_CMPEQ, OP_CMPGT,
+	OP_INV, OP_AND, OP_OR, OP_XOR, OP_ADDC, OP_TRAP,
+	/* EXP format, in the order of their sub-opcodes */
+	OP_SHIFTL, OP_SHIFTR, OP_SHIFTRA, OP_ROTL, OP_ROTR, OP_EXTRACT,
+	OP_INSERT, OP_BCOPY, OP_BFILL,
+	/* RX format */
+	OP_LEA, OP_LOAD, OP_STORE, OP_JUMP, OP_JUMPC0, OP_JUMPC1, OP_JUMPF,
+	OP_JUMPT, OP_JAL,
+	/* Anything else, e.g. RX sub-opcodes 9 through 15 */
+	OP_ILLEGAL,
+	OP_COUNT
+};
+
+/*
+ * Instruction attributes
+ */
+#define ATTR_RX     0x01 /* Second word is a displacement */
+#define ATTR_JUMP   0x02 /* May write the program counter */
+#define ATTR_COND   0x04 /* Jump is conditional */
+#define ATTR_CALL   0x08 /* Jump saves the return address */
+#define ATTR_LOAD   0x10 /* Reads RAM at the effective address */
+#define ATTR_STORE  0x20 /* Writes RAM at the effective address */
+#define ATTR_TRAP   0x40 /* Calls into the host */
+#define ATTR_EXP    0x80 /* Second word holds more operand fields */
+
+/*
+ * Fields of the second word of EXP instructions, Ra and Rb are registers,
+ *  p and q small constants
+ */
+#define EXP_A(w) ((w) >> 12 & 0xf)
+#define EXP_B(w) ((w) >> 8 & 0xf)
+#define EXP_P(w) ((w) >> 4 & 0xf)
+#define EXP_Q(w) ((w) & 0xf)
+
+typedef struct {
+	/* Handler index */
+	uint8_t op;
+	/* Instruction attributes */
+	uint8_t attr;
+	/* Operand fields, for EXP a and b are the sub-opcode instead */
+	uint8_t d, a, b;
+	/* Length in words */
+	uint8_t len;
+	/* Bits of R15 read and possibly written, whole register if used as Rx.
+	 *  Only Rd counts for EXP, the rest are not in the first word */
+	uint16_t fread, fwrite;
+} s16insn;
+
+/*
+ * Decoded form of every possible first instruction word
+ */
+extern const s16insn decode_table[0x10000];
+
+/*
+ * Mnemonic for each handler index, NULL for ones without a mnemonic
+ */
+extern const char *const op_mnemonic[OP_COUNT];
+
+#define DECODE(word) (&decode_table[(uint16_t) (word)])
+#define IS_VALID(insn) ((insn)->op != OP_ILLEGAL)
+
+#endif
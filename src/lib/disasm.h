@@ -1,14 +1,12 @@
 #ifndef DISASM_H
 #define DISASM_H
 
-/* Reverse symbol table type */
-MAP_GEN(uint16_t, char *, IHASH, ICOMPARE, rsym)
-
 /*
  * Disassemble one instruction
+ *  Displacements are shown as "symbol+offset" if a symbol table is given
  * Returns a pointer to the next instruction
  */
 uint16_t *
-disassemble(char *str, size_t size, uint16_t *mem, rsymmap *rsymtab);
+disassemble(char *str, size_t size, uint16_t *mem, const s16symtab *symtab);
 
 #endif
@@ -0,0 +1,37 @@
+/*
+ * Snapshot restore for in-process fuzzing
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "cpu.h"
+#include "fuzz.h"
+
+void
+fuzz_reset(s16cpu *cpu, const s16cpu *snapshot, const uint8_t *input,
+	size_t len)
+{
+	s16fuzz *fuzz;
+	size_t i, off;
+
+	fuzz = cpu->fuzz;
+	for (i = 0; i < fuzz->ndirty; ++i) {
+		off = (size_t) fuzz->dirtied[i] << FUZZ_PAGE_SHIFT;
+		memcpy(cpu->ram + off, snapshot->ram + off,
+			sizeof *cpu->ram << FUZZ_PAGE_SHIFT);
+		fuzz->dirty[fuzz->dirtied[i]] = 0;
+	}
+	fuzz->ndirty = 0;
+
+	cpu->pc = snapshot->pc;
+	cpu->ir = snapshot->ir;
+	cpu->adr = snapshot->adr;
+	memcpy(cpu->reg, snapshot->reg, sizeof cpu->reg);
+
+	fuzz->input = input;
+	fuzz->len = len;
+	fuzz->pos = 0;
+	fuzz->prev = 0;
+	fuzz->bad_trap = 0;
+}
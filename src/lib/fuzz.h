@@ -0,0 +1,76 @@
+#ifndef FUZZ_H
+#define FUZZ_H
+
+/*
+ * RAM is restored in pages of this many words between runs
+ */
+#define FUZZ_PAGE_SHIFT 6
+#define FUZZ_PAGES      (RAM_WORDS >> FUZZ_PAGE_SHIFT)
+
+/*
+ * Counters for edges between basic blocks, indexed AFL style by the block
+ *  entered xor half the previous one
+ */
+#define FUZZ_MAP_SIZE 0x2000
+
+/*
+ * State of execute_fuzz() for one guest run
+ */
+struct s16fuzz {
+	/* TRAP_READ consumes the input a byte per word, then reads EOF */
+	const uint8_t *input;
+	size_t len, pos;
+	/* Edge counters, FUZZ_MAP_SIZE of them, and the previous block */
+	uint8_t *map;
+	uint16_t prev;
+	/* Set by a trap reading or writing past the end of RAM */
+	_Bool bad_trap;
+	/* Pages written since the last reset and a list of them */
+	uint8_t dirty[FUZZ_PAGES];
+	uint16_t dirtied[FUZZ_PAGES];
+	size_t ndirty;
+};
+
+typedef struct s16fuzz s16fuzz;
+
+static inline void
+fuzz_edge(s16fuzz *fuzz, uint16_t to)
+{
+	++fuzz->map[(to ^ fuzz->prev) & (FUZZ_MAP_SIZE - 1)];
+	fuzz->prev = to >> 1;
+}
+
+static inline void
+fuzz_dirty(s16fuzz *fuzz, uint16_t addr)
+{
+	unsigned page;
+
+	page = addr >> FUZZ_PAGE_SHIFT;
+	if (!fuzz->dirty[page]) {
+		fuzz->dirty[page] = 1;
+		fuzz->dirtied[fuzz->ndirty++] = page;
+	}
+}
+
+static inline int
+fuzz_getchar(s16fuzz *fuzz)
+{
+	return fuzz->pos < fuzz->len ? fuzz->input[fuzz->pos++] : EOF;
+}
+
+/*
+ * Start a run of cpu on input, restoring registers and every page written
+ *  since the last reset from snapshot. The edge map is left alone
+ */
+void
+fuzz_reset(s16cpu *cpu, const s16cpu *snapshot, const uint8_t *input,
+	size_t len);
+
+/*
+ * execute() that takes guest input from cpu->fuzz, drops guest output and
+ *  records edges and written pages. Built from cpu.c with CPU_FUZZ
+ */
+int
+execute_fuzz(s16cpu *cpu);
+
+#endif
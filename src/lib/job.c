@@ -0,0 +1,164 @@
+/*
+ * Requests and replies between s16emud and its clients
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include "job.h"
+
+/*
+ * Wait until fd is readable, returns at once without a deadline
+ * Returns zero on success, -1 on error or with ETIMEDOUT past the deadline
+ */
+static
+int
+wait_readable(int fd, const struct timespec *deadline)
+{
+	struct timespec now;
+	struct pollfd pfd;
+	long ms;
+	int n;
+
+	if (!deadline)
+		return 0;
+	pfd.fd = fd;
+	pfd.events = POLLIN;
+	for (;;) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		ms = (deadline->tv_sec - now.tv_sec) * 1000
+			+ (deadline->tv_nsec - now.tv_nsec) / 1000000;
+		if (ms <= 0) {
+			errno = ETIMEDOUT;
+			return -1;
+		}
+		/* Rounded down, so a timeout just checks the clock again */
+		n = poll(&pfd, 1, ms);
+		if (n > 0)
+			return 0;
+		if (n < 0 && errno != EINTR)
+			return -1;
+	}
+}
+
+int
+job_send(int sock, const struct job_request *req, int fd)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof fd)];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof msg);
+	memset(&control, 0, sizeof control);
+	iov.iov_base = (void *) req;
+	iov.iov_len = sizeof *req;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof control.buf;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof fd);
+	memcpy(CMSG_DATA(cmsg), &fd, sizeof fd);
+
+	do
+		n = sendmsg(sock, &msg, MSG_NOSIGNAL);
+	while (n < 0 && errno == EINTR);
+	if (n < 0)
+		return -1;
+
+	/* The descriptor went with the first byte */
+	return job_write(sock, (const char *) req + n, sizeof *req - n);
+}
+
+int
+job_recv(int sock, struct job_request *req, int *fd,
+	const struct timespec *deadline)
+{
+	union {
+		struct cmsghdr hdr;
+		char buf[CMSG_SPACE(sizeof *fd)];
+	} control;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	struct iovec iov;
+	ssize_t n;
+
+	memset(&msg, 0, sizeof msg);
+	iov.iov_base = req;
+	iov.iov_len = sizeof *req;
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = control.buf;
+	msg.msg_controllen = sizeof control.buf;
+
+	do
+		n = -1 == wait_readable(sock, deadline) ? -1
+			: recvmsg(sock, &msg, MSG_CMSG_CLOEXEC);
+	while (n < 0 && errno == EINTR);
+	if (n <= 0)
+		return -1;
+
+	*fd = -1;
+	cmsg = CMSG_FIRSTHDR(&msg);
+	if (cmsg && cmsg->cmsg_level == SOL_SOCKET
+			&& cmsg->cmsg_type == SCM_RIGHTS
+			&& cmsg->cmsg_len == CMSG_LEN(sizeof *fd))
+		memcpy(fd, CMSG_DATA(cmsg), sizeof *fd);
+	if (*fd < 0)
+		return -1;
+
+	if (-1 == job_read(sock, (char *) req + n, sizeof *req - n,
+			deadline)) {
+		close(*fd);
+		return -1;
+	}
+	return 0;
+}
+
+int
+job_read(int fd, void *buf, size_t size, const struct timespec *deadline)
+{
+	ssize_t n;
+
+	while (size) {
+		if (-1 == wait_readable(fd, deadline))
+			return -1;
+		n = read(fd, buf, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			return -1;
+		buf = (char *) buf + n;
+		size -= n;
+	}
+	return 0;
+}
+
+int
+job_write(int fd, const void *buf, size_t size)
+{
+	ssize_t n;
+
+	while (size) {
+		n = write(fd, buf, size);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0)
+			return -1;
+		buf = (const char *) buf + n;
+		size -= n;
+	}
+	return 0;
+}
@@ -0,0 +1,80 @@
+#ifndef JOB_H
+#define JOB_H
+
+/*
+ * Jobs for s16emud over its Unix socket
+ *
+ * A client connects and sends a request, passing one end of a socket pair
+ *  along with it as SCM_RIGHTS, then the image or its path. The guest reads
+ *  and writes that socket where s16emu would use stdin and stdout. Once the
+ *  guest is done and its output written the daemon sends a reply and closes
+ *  both. Both ends are on the same host, integers are in host byte order
+ */
+
+/*
+ * Where the daemon listens unless $S16EMUD_SOCKET says otherwise
+ */
+#define JOB_SOCKET     "/tmp/s16emud.sock"
+#define JOB_SOCKET_ENV "S16EMUD_SOCKET"
+
+#define JOB_MAGIC 0x4a363153 /* "S16J" */
+
+/*
+ * What follows a request
+ */
+#define JOB_IMAGE 0 /* The image in the format s16asm writes */
+#define JOB_PATH  1 /* Absolute path of an image file, not NUL terminated */
+
+struct job_request {
+	uint32_t magic;
+	uint32_t kind;
+	/* Bytes of image or path following */
+	uint32_t size;
+	uint32_t reserved;
+	/* Instructions the guest may run, 0 leaves it to the daemon */
+	uint64_t limit;
+};
+
+/*
+ * Reply status if the request or its image was bad, otherwise it is how the
+ *  guest ended, S16_EXIT, S16_ILLEGAL or S16_LIMIT
+ */
+#define JOB_REJECTED 0xff
+
+struct job_reply {
+	uint32_t status;
+	/* Instruction register and program counter after the last instruction */
+	uint16_t ir, pc;
+	/* Instructions run */
+	uint64_t steps;
+};
+
+/*
+ * Send a request with fd attached
+ * Returns zero on success, -1 on error
+ */
+int
+job_send(int sock, const struct job_request *req, int fd);
+
+/*
+ * Receive a request and the descriptor attached to it, giving up at the
+ *  deadline unless that is NULL, see job_read()
+ * Returns zero on success, -1 on error or if no descriptor came along
+ */
+int
+job_recv(int sock, struct job_request *req, int *fd,
+	const struct timespec *deadline);
+
+/*
+ * Read or write exactly size bytes, retrying short transfers. Reads give up
+ *  with ETIMEDOUT at the deadline, a CLOCK_MONOTONIC time, however the
+ *  bytes trickle in. A NULL deadline waits for as long as it takes
+ * Returns zero on success, -1 on error or early EOF
+ */
+int
+job_read(int fd, void *buf, size_t size, const struct timespec *deadline);
+
+int
+job_write(int fd, const void *buf, size_t size);
+
+#endif
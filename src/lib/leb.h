@@ -0,0 +1,74 @@
+#ifndef LEB_H
+#define LEB_H
+
+/*
+ * LEB128 helpers shared by the debug info and object file formats
+ */
+
+VEC_GEN(uint8_t, b)
+
+static inline void
+put_uleb(bvec *buf, uint32_t x)
+{
+	while (x >= 0x80) {
+		bvec_add(buf, (x & 0x7f) | 0x80);
+		x >>= 7;
+	}
+	bvec_add(buf, x);
+}
+
+static inline void
+put_sleb(bvec *buf, int32_t x)
+{
+	/* Zigzag encoding keeps small negative deltas short */
+	put_uleb(buf, (uint32_t) x << 1 ^ (uint32_t) -(x < 0));
+}
+
+/*
+ * Read an unsigned LEB128 number, returns -1 on truncated input
+ */
+static inline int
+get_uleb(const uint8_t **p, const uint8_t *end, uint32_t *x)
+{
+	int shift;
+
+	*x = 0;
+	for (shift = 0; *p < end && shift < 32; shift += 7) {
+		*x |= (uint32_t) (**p & 0x7f) << shift;
+		if (!(*(*p)++ & 0x80))
+			return 0;
+	}
+
+	return -1;
+}
+
+static inline int
+get_sleb(const uint8_t **p, const uint8_t *end, int32_t *x)
+{
+	uint32_t u;
+
+	if (-1 == get_uleb(p, end, &u))
+		return -1;
+	*x = (int32_t) (u >> 1) ^ -(int32_t) (u & 1);
+	return 0;
+}
+
+/*
+ * Write a whole buffer, returns -1 on error
+ */
+static inline int
+write_all(int fd, const bvec *buf)
+{
+	size_t off;
+	ssize_t len;
+
+	for (off = 0; off < buf->n; off += len) {
+		len = write(fd, buf->arr + off, buf->n - off);
+		if (-1 == len)
+			return -1;
+	}
+
+	return 0;
+}
+
+#endif
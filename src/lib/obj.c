@@ -0,0 +1,189 @@
+/*
+ * Relocatable object reader and writer
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vec.h>
+#include "leb.h"
+#include "obj.h"
+
+int
+obj_write(int fd, const uint16_t *code, size_t size,
+	const s16objsym *syms, size_t sym_cnt,
+	const s16reloc *relocs, size_t reloc_cnt)
+{
+	bvec buf;
+	size_t i, off;
+	uint16_t word;
+	int ret;
+
+	bvec_init(&buf);
+
+	for (i = 0; i < strlen(OBJ_MAGIC); ++i)
+		bvec_add(&buf, OBJ_MAGIC[i]);
+	bvec_add(&buf, OBJ_VERSION);
+
+	put_uleb(&buf, size);
+	for (i = 0; i < size; ++i) {
+		bvec_add(&buf, code[i] >> 8);
+		bvec_add(&buf, code[i]);
+	}
+
+	put_uleb(&buf, sym_cnt);
+	for (i = 0; i < sym_cnt; ++i) {
+		bvec_add(&buf, syms[i].flags);
+		put_uleb(&buf, syms[i].value);
+		put_uleb(&buf, syms[i].len);
+		for (off = 0; off < syms[i].len; ++off)
+			bvec_add(&buf, syms[i].name[off]);
+	}
+
+	put_uleb(&buf, reloc_cnt);
+	for (word = 0, i = 0; i < reloc_cnt; word = relocs[i++].word) {
+		put_uleb(&buf, relocs[i].word - word);
+		put_uleb(&buf, relocs[i].sym);
+	}
+
+	ret = write_all(fd, &buf);
+	bvec_free(&buf);
+	return ret;
+}
+
+/*
+ * Decode the file contents
+ */
+static int
+parse(s16obj *obj, const uint8_t *p, const uint8_t *end)
+{
+	uint32_t cnt, i, value, len, names_size, delta, sym;
+	const uint8_t *syms;
+	s16objsym objsym;
+	s16reloc reloc;
+	char *name;
+
+	if ((size_t) (end - p) < strlen(OBJ_MAGIC) + 1
+			|| memcmp(p, OBJ_MAGIC, strlen(OBJ_MAGIC))
+			|| OBJ_VERSION != p[strlen(OBJ_MAGIC)])
+		return -1;
+	p += strlen(OBJ_MAGIC) + 1;
+
+	/* Code */
+	if (-1 == get_uleb(&p, end, &cnt) || cnt > 0x10000
+			|| cnt * 2 > (size_t) (end - p))
+		return -1;
+	obj->code = malloc(cnt * sizeof *obj->code + 1);
+	if (!obj->code)
+		return -1;
+	obj->size = cnt;
+	for (i = 0; i < cnt; ++i, p += 2)
+		obj->code[i] = p[0] << 8 | p[1];
+
+	/* Symbols, sized up first so names can go in a single allocation */
+	if (-1 == get_uleb(&p, end, &cnt))
+		return -1;
+	syms = p;
+	for (names_size = 0, i = 0; i < cnt; ++i) {
+		if (p++ >= end /* flags */
+				|| -1 == get_uleb(&p, end, &value)
+				|| -1 == get_uleb(&p, end, &len)
+				|| len > (size_t) (end - p) || len > UINT16_MAX)
+			return -1;
+		p += len;
+		names_size += len + 1;
+	}
+	obj->names = name = malloc(names_size + 1);
+	if (!name)
+		return -1;
+	for (p = syms, i = 0; i < cnt; ++i) {
+		objsym.flags = *p++;
+		get_uleb(&p, end, &value);
+		get_uleb(&p, end, &len);
+		objsym.value = value;
+		objsym.len = len;
+		objsym.name = name;
+		memcpy(name, p, len);
+		name[len] = 0;
+		name += len + 1;
+		p += len;
+		objsymvec_add(&obj->syms, objsym);
+	}
+
+	/* Relocations */
+	if (-1 == get_uleb(&p, end, &cnt))
+		return -1;
+	for (reloc.word = 0, i = 0; i < cnt; ++i) {
+		if (-1 == get_uleb(&p, end, &delta)
+				|| -1 == get_uleb(&p, end, &sym)
+				|| reloc.word + delta >= obj->size
+				|| sym >= obj->syms.n)
+			return -1;
+		reloc.word += delta;
+		reloc.sym = sym;
+		relocvec_add(&obj->relocs, reloc);
+	}
+
+	return 0;
+}
+
+int
+obj_load(s16obj *obj, const char *path)
+{
+	int fd;
+	struct stat st;
+	void *map;
+
+	obj->code = NULL;
+	obj->size = 0;
+	obj->names = NULL;
+	objsymvec_init(&obj->syms);
+	relocvec_init(&obj->relocs);
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+		goto err;
+
+	if (-1 == fstat(fd, &st))
+		goto err_close;
+
+	map = NULL;
+	if (st.st_size > 0) {
+		map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (MAP_FAILED == map)
+			goto err_close;
+	}
+	close(fd);
+
+	/* Everything is copied out, so the mapping need not outlive parsing */
+	if (!map || -1 == parse(obj, map, (uint8_t *) map + st.st_size)) {
+		fprintf(stderr, "%s: invalid object\n", path);
+		if (map)
+			munmap(map, st.st_size);
+		goto err_free;
+	}
+	munmap(map, st.st_size);
+	return 0;
+
+err_close:
+	close(fd);
+err:
+	perror(path);
+err_free:
+	obj_free(obj);
+	return -1;
+}
+
+void
+obj_free(s16obj *obj)
+{
+	free(obj->code);
+	free(obj->names);
+	objsymvec_free(&obj->syms);
+	relocvec_free(&obj->relocs);
+}
@@ -0,0 +1,70 @@
+#ifndef OBJ_H
+#define OBJ_H
+
+/*
+ * Relocatable object layout, integers are LEB128 encoded unless noted:
+ *  magic      "s16o" followed by a version byte
+ *  code       word count, then the words as big-endian 16-bit integers
+ *  symbols    count, then per symbol: flags, value, name length, name
+ *  relocs     count, then per relocation: word index delta, symbol index
+ * An object has a single section that the linker places anywhere in memory.
+ *  Values of defined symbols are relative to its start, each relocated word
+ *  is replaced by the final address of its symbol.
+ */
+#define OBJ_MAGIC   "s16o"
+#define OBJ_VERSION 1
+
+/* Symbol flags */
+#define OBJSYM_DEFINED 0x01 /* Defined in this object */
+#define OBJSYM_GLOBAL  0x02 /* Visible to other objects */
+
+typedef struct {
+	const char *name;
+	uint16_t len;
+	uint8_t flags;
+	uint16_t value;
+} s16objsym;
+
+VEC_GEN(s16objsym, objsym)
+
+typedef struct {
+	/* Index of the word to patch */
+	uint16_t word;
+	/* Index into the symbol table */
+	uint32_t sym;
+} s16reloc;
+
+VEC_GEN(s16reloc, reloc)
+
+typedef struct {
+	uint16_t *code;
+	size_t size;
+	/* Symbols, names are NUL-terminated and point into names */
+	objsymvec syms;
+	char *names;
+	relocvec relocs;
+} s16obj;
+
+/*
+ * Load an object file
+ * Returns zero on success, -1 on error in which case nothing needs freeing
+ */
+int
+obj_load(s16obj *obj, const char *path);
+
+/*
+ * Free an object
+ */
+void
+obj_free(s16obj *obj);
+
+/*
+ * Write an object file with a single write, relocations must be sorted
+ * Returns zero on success, -1 on error
+ */
+int
+obj_write(int fd, const uint16_t *code, size_t size,
+	const s16objsym *syms, size_t sym_cnt,
+	const s16reloc *relocs, size_t reloc_cnt);
+
+#endif
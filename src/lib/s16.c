@@ -0,0 +1,246 @@
+/*
+ * libs16, the emulator as a library
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include <vec.h>
+#include "cpu.h"
+#include "s16.h"
+
+struct s16_handler {
+	uint16_t number;
+	s16_trap_fn fn;
+	void *user;
+};
+
+VEC_GEN(struct s16_handler, handler)
+
+struct s16vm {
+	s16cpu cpu;
+	/* Installed trap handlers, there are only ever a few */
+	handlervec traps;
+	s16_access_fn access;
+	void *access_user;
+	unsigned long long steps, limit;
+	_Bool stop;
+};
+
+S16_API int
+s16_version(void)
+{
+	return S16_API_VERSION;
+}
+
+/*
+ * cpu->trap of every instance, handlers first, then the built-in traps
+ */
+static
+int
+run_trap(s16cpu *cpu, uint16_t number, uint16_t a, uint16_t b)
+{
+	s16vm *vm;
+	size_t i;
+
+	vm = cpu->user;
+	for (i = 0; i < vm->traps.n; ++i) {
+		if (vm->traps.arr[i].number != number)
+			continue;
+		if (vm->traps.arr[i].fn(vm, a, b, vm->traps.arr[i].user))
+			vm->stop = 1;
+		return 1;
+	}
+	return TRAP_PASS;
+}
+
+/*
+ * cpu->access while a hook is installed, ACCESS_* match S16_*
+ */
+static
+void
+run_access(s16cpu *cpu, uint16_t addr, int kind)
+{
+	s16vm *vm;
+
+	vm = cpu->user;
+	vm->access(vm, addr, kind, vm->access_user);
+}
+
+S16_API s16vm *
+s16_create(void)
+{
+	s16vm *vm;
+
+	vm = calloc(1, sizeof *vm);
+	if (!vm)
+		return NULL;
+	vm->cpu.trap = run_trap;
+	vm->cpu.user = vm;
+	handlervec_init(&vm->traps);
+	return vm;
+}
+
+S16_API void
+s16_destroy(s16vm *vm)
+{
+	if (!vm)
+		return;
+	handlervec_free(&vm->traps);
+	free(vm);
+}
+
+S16_API void
+s16_reset(s16vm *vm)
+{
+	vm->cpu.pc = 0;
+	vm->cpu.ir = 0;
+	vm->cpu.adr = 0;
+	memset(vm->cpu.reg, 0, sizeof vm->cpu.reg);
+	memset(vm->cpu.ram, 0, sizeof vm->cpu.ram);
+	vm->steps = 0;
+}
+
+S16_API int
+s16_load(s16vm *vm, const void *image, size_t size)
+{
+	const uint8_t *bytes;
+	size_t i;
+
+	if (size / 2 > RAM_WORDS)
+		return -1;
+
+	bytes = image;
+	for (i = 0; i < size / 2; ++i)
+		vm->cpu.ram[i] = bytes[i * 2] << 8 | bytes[i * 2 + 1];
+	return 0;
+}
+
+S16_API int
+s16_load_file(s16vm *vm, const char *path)
+{
+	return load_program(path, &vm->cpu) < 0 ? -1 : 0;
+}
+
+S16_API int
+s16_run(s16vm *vm, unsigned long budget)
+{
+	int (*step)(s16cpu *);
+	int ret;
+
+	if (vm->limit) {
+		if (vm->steps >= vm->limit)
+			return S16_LIMIT;
+		if (!budget || budget > vm->limit - vm->steps)
+			budget = vm->limit - vm->steps;
+	}
+
+	step = vm->cpu.access ? execute_hooked : execute;
+	vm->stop = 0;
+	do {
+		ret = step(&vm->cpu);
+		++vm->steps;
+		if (ret <= 0)
+			return ret ? S16_ILLEGAL : S16_EXIT;
+		if (vm->stop)
+			return S16_STOPPED;
+	} while (!budget || --budget);
+
+	return vm->limit && vm->steps >= vm->limit ? S16_LIMIT : S16_BUDGET;
+}
+
+S16_API void
+s16_set_limit(s16vm *vm, unsigned long long steps)
+{
+	vm->limit = steps;
+}
+
+S16_API void
+s16_stop(s16vm *vm)
+{
+	vm->stop = 1;
+}
+
+S16_API void
+s16_set_trap(s16vm *vm, uint16_t number, s16_trap_fn fn, void *user)
+{
+	struct s16_handler handler;
+	size_t i;
+
+	for (i = 0; i < vm->traps.n; ++i)
+		if (vm->traps.arr[i].number == number)
+			break;
+
+	if (!fn) {
+		if (i < vm->traps.n)
+			vm->traps.arr[i] = vm->traps.arr[--vm->traps.n];
+		return;
+	}
+
+	handler.number = number;
+	handler.fn = fn;
+	handler.user = user;
+	if (i < vm->traps.n)
+		vm->traps.arr[i] = handler;
+	else
+		handlervec_add(&vm->traps, handler);
+}
+
+S16_API void
+s16_set_access(s16vm *vm, s16_access_fn fn, void *user)
+{
+	vm->access = fn;
+	vm->access_user = user;
+	vm->cpu.access = fn ? run_access : NULL;
+}
+
+S16_API uint16_t
+s16_reg(const s16vm *vm, unsigned reg)
+{
+	return reg < REG_COUNT ? vm->cpu.reg[reg] : 0;
+}
+
+S16_API void
+s16_set_reg(s16vm *vm, unsigned reg, uint16_t value)
+{
+	if (reg && reg < REG_COUNT)
+		vm->cpu.reg[reg] = value;
+}
+
+S16_API uint16_t
+s16_pc(const s16vm *vm)
+{
+	return vm->cpu.pc;
+}
+
+S16_API void
+s16_set_pc(s16vm *vm, uint16_t pc)
+{
+	vm->cpu.pc = pc;
+}
+
+S16_API unsigned long long
+s16_steps(const s16vm *vm)
+{
+	return vm->steps;
+}
+
+S16_API void
+s16_read(const s16vm *vm, uint16_t addr, uint16_t *buf, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		buf[i] = vm->cpu.ram[(uint16_t) (addr + i)];
+}
+
+S16_API void
+s16_write(s16vm *vm, uint16_t addr, const uint16_t *buf, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i < count; ++i)
+		vm->cpu.ram[(uint16_t) (addr + i)] = buf[i];
+}
@@ -0,0 +1,226 @@
+#ifndef S16_H
+#define S16_H
+
+/*
+ * libs16, the emulator as a library
+ *
+ * Unlike the rest of src/lib this header stands alone and is the only one
+ *  programs embedding the emulator include. Instances are independent of
+ *  each other, but one instance must not be used by two threads at once.
+ *  Addresses and lengths are in words
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#if defined(__GNUC__)
+#define S16_API __attribute__((visibility("default")))
+#else
+#define S16_API
+#endif
+
+/*
+ * Bumped whenever the API changes incompatibly
+ */
+#define S16_API_VERSION 1
+
+/*
+ * How s16_run() ended
+ */
+#define S16_EXIT    0 /* The guest ran TRAP_EXIT */
+#define S16_BUDGET  1 /* The step budget ran out */
+#define S16_STOPPED 2 /* A callback asked to stop */
+#define S16_ILLEGAL 3 /* The guest ran an illegal instruction */
+#define S16_LIMIT   4 /* The step limit ran out */
+
+/*
+ * Kinds of memory access
+ */
+#define S16_FETCH 0
+#define S16_LOAD  1
+#define S16_STORE 2
+
+/*
+ * Built-in trap numbers
+ */
+#define S16_TRAP_EXIT  0
+#define S16_TRAP_READ  1
+#define S16_TRAP_WRITE 2
+
+typedef struct s16vm s16vm;
+
+/*
+ * Trap handler, a and b are the guest's Ra and Rb
+ * Returns zero to go on, anything else stops s16_run() with S16_STOPPED
+ *  after the trap
+ */
+typedef int (*s16_trap_fn)(s16vm *vm, uint16_t a, uint16_t b, void *user);
+
+/*
+ * Memory access hook, called before each word the guest fetches, loads or
+ *  stores, including those of traps and block instructions
+ */
+typedef void (*s16_access_fn)(s16vm *vm, uint16_t addr, int kind,
+	void *user);
+
+/*
+ * Returns S16_API_VERSION of the library actually linked
+ */
+S16_API int
+s16_version(void);
+
+/*
+ * New instance with zeroed registers and RAM. Traps 1 and 2 read stdin and
+ *  write stdout like s16emu until handlers replace them
+ * Returns NULL if out of memory
+ */
+S16_API s16vm *
+s16_create(void);
+
+S16_API void
+s16_destroy(s16vm *vm);
+
+/*
+ * Zero registers and RAM, handlers and hooks are kept
+ */
+S16_API void
+s16_reset(s16vm *vm);
+
+/*
+ * Copy an image in the format s16asm writes, big-endian words, to address 0.
+ *  A trailing odd byte is ignored like s16emu does
+ * Returns zero on success, -1 if the image does not fit into RAM
+ */
+S16_API int
+s16_load(s16vm *vm, const void *image, size_t size);
+
+/*
+ * Same as above for an image file
+ * Returns zero on success, -1 with a message on stderr on error
+ */
+S16_API int
+s16_load_file(s16vm *vm, const char *path);
+
+/*
+ * Run at most budget instructions, 0 is no limit. Runs may be resumed,
+ *  also after S16_EXIT as the program counter is past the trap by then
+ * Returns one of S16_EXIT, S16_BUDGET, S16_STOPPED, S16_ILLEGAL or S16_LIMIT
+ */
+S16_API int
+s16_run(s16vm *vm, unsigned long budget);
+
+/*
+ * Cap s16_steps() for all runs until the next reset, 0 is no limit. Runs
+ *  reaching it return S16_LIMIT. Kept across s16_reset()
+ */
+S16_API void
+s16_set_limit(s16vm *vm, unsigned long long steps);
+
+/*
+ * Make s16_run() return S16_STOPPED once the current instruction is done,
+ *  for use from callbacks
+ */
+S16_API void
+s16_stop(s16vm *vm);
+
+/*
+ * Install a handler for a trap number, NULL restores the built-in one.
+ *  Numbers without either are ignored by the guest
+ */
+S16_API void
+s16_set_trap(s16vm *vm, uint16_t number, s16_trap_fn fn, void *user);
+
+/*
+ * Install a memory access hook, NULL removes it. Runs with a hook are
+ *  slower than those without
+ */
+S16_API void
+s16_set_access(s16vm *vm, s16_access_fn fn, void *user);
+
+/*
+ * Registers, R0 always reads 0 and ignores writes
+ */
+S16_API uint16_t
+s16_reg(const s16vm *vm, unsigned reg);
+
+S16_API void
+s16_set_reg(s16vm *vm, unsigned reg, uint16_t value);
+
+S16_API uint16_t
+s16_pc(const s16vm *vm);
+
+S16_API void
+s16_set_pc(s16vm *vm, uint16_t pc);
+
+/*
+ * Instructions run by all s16_run() calls since creation or reset
+ */
+S16_API unsigned long long
+s16_steps(const s16vm *vm);
+
+/*
+ * Copy count words of RAM from or to addr, wrapping around at the end of
+ *  RAM like the guest does
+ */
+S16_API void
+s16_read(const s16vm *vm, uint16_t addr, uint16_t *buf, size_t count);
+
+S16_API void
+s16_write(s16vm *vm, uint16_t addr, const uint16_t *buf, size_t count);
+
+/*
+ * Scheduler multiplexing many instances on a few worker threads
+ *
+ * Each instance added becomes a session whose traps 1 and 2 read and write
+ *  a pair of descriptors, made non-blocking, instead of stdin and stdout.
+ *  Sessions run for a slice of instructions at a time and a guest waiting
+ *  for input or for its output to drain is parked until epoll finds its
+ *  descriptor ready, so it holds no thread meanwhile. Output is written
+ *  in full before a guest waits for input. Reads and writes
+ *  behave like the built-in traps, a read returns once all bytes asked for
+ *  or EOF arrived. A descriptor of -1 reads as EOF and drops writes.
+ *  A descriptor belongs to one session only. The instance, its handlers
+ *  for traps 1 and 2 and the descriptors are the scheduler's until the
+ *  session is done
+ */
+typedef struct s16sched s16sched;
+
+/*
+ * Called on a worker thread once a session's guest exited, ran an illegal
+ *  instruction or reached its step limit and its output is written, status
+ *  is S16_EXIT, S16_ILLEGAL or S16_LIMIT. The instance has the built-in
+ *  traps 1 and 2 again and may be destroyed
+ */
+typedef void (*s16_done_fn)(s16vm *vm, int status, void *user);
+
+/*
+ * New scheduler with threads workers and slices of slice instructions,
+ *  0 picks one worker or a default slice
+ * Returns NULL if out of memory or threads
+ */
+S16_API s16sched *
+s16_sched_create(unsigned threads, unsigned long slice);
+
+/*
+ * Add an instance reading in_fd and writing out_fd, which may be the same
+ *  socket, to be run from where its program counter is
+ * Returns zero on success, -1 on error
+ */
+S16_API int
+s16_sched_add(s16sched *sched, s16vm *vm, int in_fd, int out_fd,
+	s16_done_fn done, void *user);
+
+/*
+ * Wait until all sessions are done, sessions may be added meanwhile
+ */
+S16_API void
+s16_sched_wait(s16sched *sched);
+
+/*
+ * Stop the workers, sessions not done yet are abandoned without their done
+ *  callback
+ */
+S16_API void
+s16_sched_destroy(s16sched *sched);
+
+#endif
@@ -0,0 +1,478 @@
+/*
+ * Cooperative scheduler running many libs16 instances on a few threads
+ *
+ * Each session is an instance with an input and an output descriptor. It is
+ *  at any time in exactly one of three places: the run queue, a worker
+ *  running it for one slice, or parked in epoll waiting for its descriptor.
+ *  Parking uses EPOLLONESHOT so a wakeup hands the session to one worker
+ *  only, and it is always the last thing a worker does with a session
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/types.h>
+#include <vec.h>
+#include "cpu.h"
+#include "s16.h"
+
+/* Default instructions per slice */
+#define SLICE 10000
+/* Buffered output making a session wait for its descriptor */
+#define OUT_LIMIT 0x10000
+#define READ_CHUNK 4096
+#define EVENTS 64
+
+/* What a parked session waits for */
+#define WAIT_NONE   0
+#define WAIT_INPUT  1
+#define WAIT_OUTPUT 2
+
+VEC_GEN(uint8_t, byte)
+
+struct session {
+	s16sched *sched;
+	s16vm *vm;
+	int in_fd, out_fd;
+	_Bool in_watched, out_watched, in_eof;
+	int wait;
+	/* S16_EXIT, S16_ILLEGAL or S16_LIMIT once the guest is done, otherwise
+	 *  -1 */
+	int status;
+	/* Input read ahead and output not yet written, from *_pos on */
+	bytevec in, out;
+	size_t in_pos, out_pos;
+	s16_done_fn done;
+	void *user;
+	struct session *next;
+};
+
+struct s16sched {
+	pthread_mutex_t lock;
+	/* Signalled when the run queue gets a session or on shutdown */
+	pthread_cond_t ready;
+	/* Signalled when the last session is done */
+	pthread_cond_t idle;
+	struct session *head, *tail;
+	size_t sessions;
+	_Bool stopping;
+	unsigned long slice;
+	int epfd, wakefd;
+	pthread_t poller;
+	pthread_t *workers;
+	unsigned nworkers;
+};
+
+/*
+ * Put a session on the run queue. Sessions woken by their descriptor go
+ *  first so interactive guests answer quickly among busy ones, they rejoin
+ *  at the end after their slice
+ */
+static
+void
+enqueue(s16sched *sched, struct session *s, _Bool first)
+{
+	pthread_mutex_lock(&sched->lock);
+	if (first) {
+		s->next = sched->head;
+		sched->head = s;
+		if (!sched->tail)
+			sched->tail = s;
+	} else {
+		s->next = NULL;
+		if (sched->tail)
+			sched->tail->next = s;
+		else
+			sched->head = s;
+		sched->tail = s;
+	}
+	pthread_cond_signal(&sched->ready);
+	pthread_mutex_unlock(&sched->lock);
+}
+
+/*
+ * Trap 1 handler, delivers b bytes or EOF like the built-in trap does with
+ *  stdin. Short of input it puts the program counter back on the trap and
+ *  stops, the trap runs again once the descriptor is readable
+ */
+static
+int
+session_read(s16vm *vm, uint16_t a, uint16_t b, void *user)
+{
+	struct session *s;
+	uint8_t chunk[READ_CHUNK];
+	uint16_t word;
+	ssize_t n, i;
+
+	s = user;
+	if (a + b > RAM_WORDS)
+		return 0;
+
+	while (s->in.n - s->in_pos < b && !s->in_eof) {
+		if (s->in_fd < 0) {
+			s->in_eof = 1;
+			break;
+		}
+		n = read(s->in_fd, chunk, sizeof chunk);
+		if (n > 0) {
+			for (i = 0; i < n; ++i)
+				bytevec_add(&s->in, chunk[i]);
+		} else if (n < 0 && errno == EINTR) {
+			continue;
+		} else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			s->wait = WAIT_INPUT;
+			s16_set_pc(vm, s16_pc(vm) - 1);
+			return 1;
+		} else {
+			/* Errors read as EOF, as getchar() has them */
+			s->in_eof = 1;
+		}
+	}
+
+	while (b--) {
+		word = s->in_pos < s->in.n ? s->in.arr[s->in_pos++] : 0xffff;
+		s16_write(vm, a++, &word, 1);
+	}
+	memmove(s->in.arr, s->in.arr + s->in_pos, s->in.n - s->in_pos);
+	s->in.n -= s->in_pos;
+	s->in_pos = 0;
+	return 0;
+}
+
+/*
+ * Trap 2 handler, buffers the bytes and stops once there are too many for the
+ *  worker to write them
+ */
+static
+int
+session_write(s16vm *vm, uint16_t a, uint16_t b, void *user)
+{
+	struct session *s;
+	uint16_t word;
+
+	s = user;
+	if (a + b > RAM_WORDS)
+		return 0;
+
+	while (b--) {
+		s16_read(vm, a++, &word, 1);
+		bytevec_add(&s->out, (uint8_t) word);
+	}
+	return s->out.n - s->out_pos >= OUT_LIMIT;
+}
+
+/*
+ * Write buffered output as far as the descriptor takes it. Output nobody
+ *  reads anymore is dropped, send() keeps a closed socket from raising
+ *  SIGPIPE, closed pipes still do
+ */
+static
+void
+flush(struct session *s)
+{
+	ssize_t n;
+
+	while (s->out_pos < s->out.n && s->out_fd >= 0) {
+		n = send(s->out_fd, s->out.arr + s->out_pos,
+			s->out.n - s->out_pos, MSG_NOSIGNAL);
+		if (n < 0 && errno == ENOTSOCK)
+			n = write(s->out_fd, s->out.arr + s->out_pos,
+				s->out.n - s->out_pos);
+		if (n >= 0) {
+			s->out_pos += n;
+		} else if (errno == EAGAIN || errno == EWOULDBLOCK) {
+			/* Keep the buffer to what is pending, the guest
+			 *  goes on appending */
+			memmove(s->out.arr, s->out.arr + s->out_pos,
+				s->out.n - s->out_pos);
+			s->out.n -= s->out_pos;
+			s->out_pos = 0;
+			return;
+		} else if (errno != EINTR) {
+			break;
+		}
+	}
+	s->out.n = 0;
+	s->out_pos = 0;
+}
+
+/*
+ * Wait for events on fd, or run again right away if epoll cannot watch it
+ */
+static
+void
+park(struct session *s, int fd, uint32_t events)
+{
+	struct epoll_event ev;
+	_Bool *watched;
+	int op;
+
+	watched = fd == s->in_fd ? &s->in_watched : &s->out_watched;
+	op = *watched ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+	ev.events = events | EPOLLONESHOT;
+	ev.data.ptr = s;
+	/* Set before, the session may be running elsewhere right after */
+	*watched = 1;
+	if (epoll_ctl(s->sched->epfd, op, fd, &ev) < 0) {
+		*watched = op == EPOLL_CTL_MOD;
+		enqueue(s->sched, s, 0);
+	}
+}
+
+static
+void
+finish(struct session *s)
+{
+	s16sched *sched;
+
+	sched = s->sched;
+	if (s->in_watched)
+		epoll_ctl(sched->epfd, EPOLL_CTL_DEL, s->in_fd, NULL);
+	if (s->out_watched && s->out_fd != s->in_fd)
+		epoll_ctl(sched->epfd, EPOLL_CTL_DEL, s->out_fd, NULL);
+	s16_set_trap(s->vm, S16_TRAP_READ, NULL, NULL);
+	s16_set_trap(s->vm, S16_TRAP_WRITE, NULL, NULL);
+	if (s->done)
+		s->done(s->vm, s->status, s->user);
+	bytevec_free(&s->in);
+	bytevec_free(&s->out);
+	free(s);
+
+	pthread_mutex_lock(&sched->lock);
+	if (!--sched->sessions)
+		pthread_cond_broadcast(&sched->idle);
+	pthread_mutex_unlock(&sched->lock);
+}
+
+/*
+ * Give a session from the run queue one slice and decide where it goes next
+ */
+static
+void
+step(struct session *s)
+{
+	size_t pending;
+	int ret;
+
+	flush(s);
+	if (s->status < 0 && s->out.n - s->out_pos < OUT_LIMIT) {
+		s->wait = WAIT_NONE;
+		ret = s16_run(s->vm, s->sched->slice);
+		if (ret == S16_EXIT || ret == S16_ILLEGAL || ret == S16_LIMIT)
+			s->status = ret;
+		flush(s);
+	}
+
+	/*
+	 * A guest waiting for input may well wait for an answer to the output
+	 *  still buffered, so that goes out first. On one descriptor both
+	 *  events wake the session, on two only the output's does, the input
+	 *  keeps until the next step finds it
+	 */
+	pending = s->out.n - s->out_pos;
+	if (pending && s->wait == WAIT_INPUT && s->in_fd == s->out_fd) {
+		park(s, s->in_fd, EPOLLIN | EPOLLOUT);
+	} else if (pending && (s->status >= 0 || pending >= OUT_LIMIT
+			|| s->wait == WAIT_INPUT)) {
+		s->wait = WAIT_OUTPUT;
+		park(s, s->out_fd, EPOLLOUT);
+	} else if (s->status >= 0) {
+		finish(s);
+	} else if (s->wait == WAIT_INPUT) {
+		park(s, s->in_fd, EPOLLIN);
+	} else {
+		enqueue(s->sched, s, 0);
+	}
+}
+
+static
+void *
+work(void *arg)
+{
+	s16sched *sched;
+	struct session *s;
+
+	sched = arg;
+	for (;;) {
+		pthread_mutex_lock(&sched->lock);
+		while (!sched->head && !sched->stopping)
+			pthread_cond_wait(&sched->ready, &sched->lock);
+		if (sched->stopping) {
+			pthread_mutex_unlock(&sched->lock);
+			return NULL;
+		}
+		s = sched->head;
+		sched->head = s->next;
+		if (!sched->head)
+			sched->tail = NULL;
+		pthread_mutex_unlock(&sched->lock);
+
+		step(s);
+	}
+}
+
+/*
+ * Hand sessions whose descriptor became ready back to the workers, the
+ *  eventfd has a NULL pointer and means shutdown
+ */
+static
+void *
+poll_events(void *arg)
+{
+	struct epoll_event events[EVENTS];
+	s16sched *sched;
+	int i, n;
+
+	sched = arg;
+	for (;;) {
+		n = epoll_wait(sched->epfd, events, EVENTS, -1);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n < 0) {
+			perror("epoll_wait");
+			return NULL;
+		}
+		for (i = 0; i < n; ++i) {
+			if (!events[i].data.ptr)
+				return NULL;
+			enqueue(sched, events[i].data.ptr, 1);
+		}
+	}
+}
+
+S16_API s16sched *
+s16_sched_create(unsigned threads, unsigned long slice)
+{
+	struct epoll_event ev;
+	s16sched *sched;
+	unsigned i;
+
+	sched = calloc(1, sizeof *sched);
+	if (!sched)
+		return NULL;
+	sched->slice = slice ? slice : SLICE;
+	sched->nworkers = threads ? threads : 1;
+	sched->workers = calloc(sched->nworkers, sizeof *sched->workers);
+	pthread_mutex_init(&sched->lock, NULL);
+	pthread_cond_init(&sched->ready, NULL);
+	pthread_cond_init(&sched->idle, NULL);
+
+	sched->epfd = epoll_create1(EPOLL_CLOEXEC);
+	sched->wakefd = eventfd(0, EFD_CLOEXEC);
+	if (!sched->workers || sched->epfd < 0 || sched->wakefd < 0)
+		goto fail;
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(sched->epfd, EPOLL_CTL_ADD, sched->wakefd, &ev) < 0)
+		goto fail;
+
+	if (pthread_create(&sched->poller, NULL, poll_events, sched))
+		goto fail;
+	for (i = 0; i < sched->nworkers; ++i) {
+		if (pthread_create(&sched->workers[i], NULL, work, sched)) {
+			sched->nworkers = i;
+			s16_sched_destroy(sched);
+			return NULL;
+		}
+	}
+	return sched;
+
+fail:
+	if (sched->epfd >= 0)
+		close(sched->epfd);
+	if (sched->wakefd >= 0)
+		close(sched->wakefd);
+	free(sched->workers);
+	free(sched);
+	return NULL;
+}
+
+static
+int
+nonblock(int fd)
+{
+	int flags;
+
+	if (fd < 0)
+		return 0;
+	flags = fcntl(fd, F_GETFL);
+	if (flags < 0)
+		return -1;
+	return fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+}
+
+S16_API int
+s16_sched_add(s16sched *sched, s16vm *vm, int in_fd, int out_fd,
+	s16_done_fn done, void *user)
+{
+	struct session *s;
+
+	if (nonblock(in_fd) < 0 || nonblock(out_fd) < 0)
+		return -1;
+	s = calloc(1, sizeof *s);
+	if (!s)
+		return -1;
+
+	s->sched = sched;
+	s->vm = vm;
+	s->in_fd = in_fd;
+	s->out_fd = out_fd;
+	s->status = -1;
+	s->done = done;
+	s->user = user;
+	bytevec_init(&s->in);
+	bytevec_init(&s->out);
+	s16_set_trap(vm, S16_TRAP_READ, session_read, s);
+	s16_set_trap(vm, S16_TRAP_WRITE, session_write, s);
+
+	pthread_mutex_lock(&sched->lock);
+	++sched->sessions;
+	pthread_mutex_unlock(&sched->lock);
+	enqueue(sched, s, 0);
+	return 0;
+}
+
+S16_API void
+s16_sched_wait(s16sched *sched)
+{
+	pthread_mutex_lock(&sched->lock);
+	while (sched->sessions)
+		pthread_cond_wait(&sched->idle, &sched->lock);
+	pthread_mutex_unlock(&sched->lock);
+}
+
+S16_API void
+s16_sched_destroy(s16sched *sched)
+{
+	uint64_t one;
+	unsigned i;
+
+	if (!sched)
+		return;
+
+	pthread_mutex_lock(&sched->lock);
+	sched->stopping = 1;
+	pthread_cond_broadcast(&sched->ready);
+	pthread_mutex_unlock(&sched->lock);
+	one = 1;
+	if (write(sched->wakefd, &one, sizeof one) == sizeof one)
+		pthread_join(sched->poller, NULL);
+	for (i = 0; i < sched->nworkers; ++i)
+		pthread_join(sched->workers[i], NULL);
+
+	close(sched->epfd);
+	close(sched->wakefd);
+	pthread_cond_destroy(&sched->idle);
+	pthread_cond_destroy(&sched->ready);
+	pthread_mutex_destroy(&sched->lock);
+	free(sched->workers);
+	free(sched);
+}
@@ -0,0 +1,165 @@
+/*
+ * Symbol index
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <vec.h>
+#include "symtab.h"
+
+void
+symtab_init(s16symtab *symtab)
+{
+	symvec_init(&symtab->syms);
+	symtab->map = NULL;
+	symtab->map_size = 0;
+}
+
+void
+symtab_add(s16symtab *symtab, const char *name, size_t len, uint16_t addr)
+{
+	s16sym sym;
+
+	sym.addr = addr;
+	sym.len = len;
+	sym.name = name;
+	symvec_add(&symtab->syms, sym);
+}
+
+static int
+compare_sym(const void *a, const void *b)
+{
+	return (int) ((const s16sym *) a)->addr - ((const s16sym *) b)->addr;
+}
+
+void
+symtab_sort(s16symtab *symtab)
+{
+	size_t i;
+
+	/* Symbol files written in address order need no sorting */
+	for (i = 1; i < symtab->syms.n; ++i)
+		if (symtab->syms.arr[i - 1].addr > symtab->syms.arr[i].addr)
+			break;
+
+	if (i < symtab->syms.n)
+		qsort(symtab->syms.arr, symtab->syms.n,
+			sizeof *symtab->syms.arr, compare_sym);
+}
+
+/*
+ * Add a single "NAME:ADDRESS" line to the table
+ */
+static int
+addline(s16symtab *symtab, const char *line, const char *end)
+{
+	const char *colon, *p;
+	unsigned long addr;
+
+	colon = memchr(line, ':', end - line);
+	if (!colon || colon == line || colon + 1 == end) {
+		fprintf(stderr, "Invalid symbol table entry %.*s\n",
+			(int) (end - line), line);
+		return -1;
+	}
+
+	/* Parse decimal address in place, the mapping is not NUL-terminated */
+	for (addr = 0, p = colon + 1; p < end && '0' <= *p && *p <= '9'; ++p)
+		addr = addr * 10 + *p - '0';
+
+	symtab_add(symtab, line, colon - line, addr);
+	return 0;
+}
+
+int
+symtab_load(s16symtab *symtab, const char *path)
+{
+	int fd;
+	struct stat st;
+	const char *p, *end, *eol;
+
+	fd = open(path, O_RDONLY);
+	if (-1 == fd)
+		goto err;
+
+	if (-1 == fstat(fd, &st))
+		goto err_close;
+
+	if (st.st_size > 0) {
+		symtab->map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+		if (MAP_FAILED == symtab->map) {
+			symtab->map = NULL;
+			goto err_close;
+		}
+		symtab->map_size = st.st_size;
+	}
+	close(fd);
+
+	p = symtab->map;
+	end = p + symtab->map_size;
+	while (p < end) {
+		eol = memchr(p, '\n', end - p);
+		if (!eol)
+			eol = end;
+		if (eol > p)
+			addline(symtab, p, '\r' == eol[-1] ? eol - 1 : eol);
+		p = eol + 1;
+	}
+
+	symtab_sort(symtab);
+	return 0;
+
+err_close:
+	close(fd);
+err:
+	perror(path);
+	return -1;
+}
+
+const s16sym *
+symtab_lookup(const s16symtab *symtab, uint16_t addr)
+{
+	size_t lo, hi, mid;
+
+	/* Find the first symbol above addr */
+	lo = 0;
+	hi = symtab->syms.n;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if (symtab->syms.arr[mid].addr <= addr)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	return lo ? &symtab->syms.arr[lo - 1] : NULL;
+}
+
+int
+symtab_format(const s16symtab *symtab, uint16_t addr, char *str, size_t size)
+{
+	const s16sym *sym;
+
+	if (!symtab || !(sym = symtab_lookup(symtab, addr)))
+		return -1;
+
+	if (sym->addr == addr)
+		snprintf(str, size, "%.*s", sym->len, sym->name);
+	else
+		snprintf(str, size, "%.*s+%d", sym->len, sym->name, addr - sym->addr);
+	return 0;
+}
+
+void
+symtab_free(s16symtab *symtab)
+{
+	symvec_free(&symtab->syms);
+	if (symtab->map)
+		munmap(symtab->map, symtab->map_size);
+}
@@ -0,0 +1,72 @@
+#ifndef SYMTAB_H
+#define SYMTAB_H
+
+typedef struct {
+	/* Address of the symbol */
+	uint16_t addr;
+	/* Length of the name, names are not NUL-terminated */
+	uint16_t len;
+	const char *name;
+} s16sym;
+
+VEC_GEN(s16sym, sym)
+
+/*
+ * Symbol index sorted by address, read-only once loaded so it can be shared
+ *  between any number of emulator instances
+ */
+typedef struct {
+	symvec syms;
+	/* Memory mapping the names point into, if loaded from a file */
+	void *map;
+	size_t map_size;
+} s16symtab;
+
+/*
+ * Create an empty symbol table
+ */
+void
+symtab_init(s16symtab *symtab);
+
+/*
+ * Load a symbol table file of "NAME:ADDRESS" lines in one pass over a
+ *  read-only mapping of it
+ * Returns zero on success, -1 on error
+ */
+int
+symtab_load(s16symtab *symtab, const char *path);
+
+/*
+ * Add a symbol, the name must outlive the table
+ *  symtab_sort must be called before the next lookup
+ */
+void
+symtab_add(s16symtab *symtab, const char *name, size_t len, uint16_t addr);
+
+/*
+ * Sort symbols by address
+ */
+void
+symtab_sort(s16symtab *symtab);
+
+/*
+ * Find the symbol with the highest address not above addr
+ *  Returns NULL if there is none
+ */
+const s16sym *
+symtab_lookup(const s16symtab *symtab, uint16_t addr);
+
+/*
+ * Format addr as "symbol" or "symbol+offset"
+ *  Returns zero on success, -1 if no symbol precedes addr
+ */
+int
+symtab_format(const s16symtab *symtab, uint16_t addr, char *str, size_t size);
+
+/*
+ * Free a symbol table
+ */
+void
+symtab_free(s16symtab *symtab);
+
+#endif
@@ -0,0 +1,167 @@
+/*
+ * Timing model
+ */
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <vec.h>
+#include "cpu.h"
+#include "decode.h"
+#include "symtab.h"
+#include "timing.h"
+
+#define ADDR_COUNT 0x10000
+
+/*
+ * Default costs, roughly those of a simple in-order core without a
+ *  hardware divider
+ */
+static
+void
+timing_defaults(s16timing *timing)
+{
+	size_t op;
+
+	for (op = 0; op < OP_COUNT; ++op)
+		timing->op[op] = 1;
+	timing->op[OP_MUL] = 4;
+	timing->op[OP_DIV] = 20;
+	timing->op[OP_LOAD] = 2;
+	timing->op[OP_STORE] = 2;
+	timing->op[OP_TRAP] = 10;
+	timing->fetch = 1;
+	timing->taken = 2;
+	timing->hazard = 1;
+	timing->miss = 10;
+}
+
+/*
+ * Cost a NAME in the table stands for, NULL if there is no such name
+ */
+static
+unsigned *
+cost_of(s16timing *timing, const char *name)
+{
+	size_t op;
+
+	if (!strcmp(name, "fetch"))
+		return &timing->fetch;
+	if (!strcmp(name, "taken"))
+		return &timing->taken;
+	if (!strcmp(name, "hazard"))
+		return &timing->hazard;
+	if (!strcmp(name, "miss"))
+		return &timing->miss;
+
+	for (op = 0; op < OP_COUNT; ++op)
+		if (op_mnemonic[op] && !strcmp(name, op_mnemonic[op]))
+			return &timing->op[op];
+	return NULL;
+}
+
+static
+int
+load_costs(s16timing *timing, const char *path)
+{
+	FILE *file;
+	char buf[128], name[16], *comment;
+	unsigned cycles, *cost;
+	long line;
+	int n;
+
+	file = fopen(path, "r");
+	if (!file) {
+		perror(path);
+		return -1;
+	}
+
+	for (line = 1; fgets(buf, sizeof buf, file); ++line) {
+		comment = strchr(buf, ';');
+		if (comment)
+			*comment = 0;
+
+		n = sscanf(buf, "%15s %u", name, &cycles);
+		if (n <= 0)
+			continue;
+		if (2 != n || !(cost = cost_of(timing, name))) {
+			fprintf(stderr, "%s: Invalid cost on line %ld\n", path, line);
+			fclose(file);
+			return -1;
+		}
+		*cost = cycles;
+	}
+
+	fclose(file);
+	return 0;
+}
+
+int
+timing_init(s16timing *timing, const char *path)
+{
+	timing_defaults(timing);
+	if (path && -1 == load_costs(timing, path))
+		return -1;
+
+	timing->insns = 0;
+	timing->cycles = 0;
+	timing->fetch_cycles = 0;
+	timing->taken_cycles = 0;
+	timing->hazard_cycles = 0;
+	timing->miss_cycles = 0;
+	timing->fwrite = 0;
+	timing->by_addr = calloc(ADDR_COUNT, sizeof *timing->by_addr);
+	if (!timing->by_addr)
+		abort();
+	return 0;
+}
+
+static
+void
+report_symbol(FILE *fp, const s16sym *sym, unsigned long long cycles,
+	unsigned long long total)
+{
+	if (!cycles)
+		return;
+
+	fprintf(fp, "  %-20.*s %14llu %7.2f%%\n",
+		sym ? (int) sym->len : 11, sym ? sym->name : "(no symbol)",
+		cycles, 100.0 * cycles / total);
+}
+
+void
+timing_report(FILE *fp, const s16timing *timing, const s16symtab *symtab)
+{
+	unsigned long long cycles;
+	const s16sym *sym, *next;
+	size_t addr;
+
+	fprintf(fp, "Timing: %llu instructions, %llu cycles, %.3f CPI\n",
+		timing->insns, timing->cycles,
+		timing->insns ? (double) timing->cycles / timing->insns : 0.0);
+	fprintf(fp, "  fetch %llu, taken %llu, hazard %llu, miss %llu cycles\n",
+		timing->fetch_cycles, timing->taken_cycles, timing->hazard_cycles,
+		timing->miss_cycles);
+	if (!symtab || !timing->cycles)
+		return;
+
+	sym = symtab_lookup(symtab, 0);
+	cycles = 0;
+	for (addr = 0; addr < ADDR_COUNT; ++addr) {
+		next = symtab_lookup(symtab, addr);
+		if (next != sym) {
+			report_symbol(fp, sym, cycles, timing->cycles);
+			sym = next;
+			cycles = 0;
+		}
+		cycles += timing->by_addr[addr];
+	}
+	report_symbol(fp, sym, cycles, timing->cycles);
+}
+
+void
+timing_free(s16timing *timing)
+{
+	free(timing->by_addr);
+}
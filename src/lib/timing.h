@@ -0,0 +1,78 @@
+#ifndef TIMING_H
+#define TIMING_H
+
+/*
+ * Cycle-approximate timing model, instructions cost a fixed number of
+ *  cycles per handler plus penalties for what happened while running them
+ */
+typedef struct {
+	/* Cycles of each handler */
+	unsigned op[OP_COUNT];
+	/* Penalties for the displacement fetch of RX instructions, a taken
+	 *  jump, reading R15 flags written by the previous instruction and
+	 *  each cache miss */
+	unsigned fetch, taken, hazard, miss;
+
+	/* Totals so far */
+	unsigned long long insns, cycles;
+	unsigned long long fetch_cycles, taken_cycles, hazard_cycles,
+		miss_cycles;
+	/* R15 bits written by the previous instruction */
+	uint16_t fwrite;
+	/* Cycles spent at each address */
+	unsigned long *by_addr;
+} s16timing;
+
+/*
+ * Set up the default costs, then override them from a cost table file
+ *  unless path is NULL. Each line of the file is "NAME CYCLES" where NAME
+ *  is a mnemonic, or fetch, taken, hazard or miss for the penalties,
+ *  anything after a ; is a comment
+ * Returns zero on success, -1 with a message on stderr on error
+ */
+int
+timing_init(s16timing *timing, const char *path);
+
+/*
+ * Account for an instruction at pc that has just run, taken is nonzero if
+ *  it jumped and misses is how many cache misses it caused
+ */
+static inline void
+timing_step(s16timing *timing, const s16insn *insn, uint16_t pc,
+	int taken, unsigned long misses)
+{
+	unsigned long cycles, extra;
+
+	cycles = timing->op[insn->op];
+	if (insn->len > 1) {
+		cycles += timing->fetch;
+		timing->fetch_cycles += timing->fetch;
+	}
+	if (taken) {
+		cycles += timing->taken;
+		timing->taken_cycles += timing->taken;
+	}
+	if (insn->fread & timing->fwrite) {
+		cycles += timing->hazard;
+		timing->hazard_cycles += timing->hazard;
+	}
+	extra = misses * timing->miss;
+	cycles += extra;
+	timing->miss_cycles += extra;
+
+	timing->fwrite = insn->fwrite;
+	timing->by_addr[pc] += cycles;
+	timing->cycles += cycles;
+	++timing->insns;
+}
+
+/*
+ * Print the totals, and cycles per symbol unless symtab is NULL
+ */
+void
+timing_report(FILE *fp, const s16timing *timing, const s16symtab *symtab);
+
+void
+timing_free(s16timing *timing);
+
+#endif
@@ -0,0 +1,214 @@
+/*
+ * Client running a program on s16emud as if it were s16emu
+ */
+
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/un.h>
+#include "lib/s16.h"
+#include "lib/job.h"
+
+#define IMAGE_MAX (0x10000 * 2)
+#define BUF_SIZE  0x4000
+
+/*
+ * Copy stdin to io and io to stdout until the daemon closes io, then stdin
+ *  is no longer read
+ * Returns zero on success, -1 with a message on stderr on error
+ */
+static
+int
+relay(int io)
+{
+	static char in[BUF_SIZE], out[BUF_SIZE];
+	struct pollfd fds[2];
+	size_t pending, pos;
+	ssize_t n;
+	_Bool eof;
+
+	pending = 0;
+	pos = 0;
+	eof = 0;
+	for (;;) {
+		/* Either read more input or wait until io takes what is left */
+		fds[0].fd = eof || pending ? -1 : STDIN_FILENO;
+		fds[0].events = POLLIN;
+		fds[1].fd = io;
+		fds[1].events = POLLIN | (pending ? POLLOUT : 0);
+		if (poll(fds, 2, -1) < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("poll");
+			return -1;
+		}
+
+		if (fds[0].revents) {
+			n = read(STDIN_FILENO, in, sizeof in);
+			if (n > 0) {
+				pending = n;
+				pos = 0;
+			} else if (n == 0 || errno != EINTR) {
+				eof = 1;
+				shutdown(io, SHUT_WR);
+			}
+		}
+
+		if (fds[1].revents & POLLOUT) {
+			n = send(io, in + pos, pending, MSG_NOSIGNAL | MSG_DONTWAIT);
+			if (n > 0) {
+				pos += n;
+				pending -= n;
+			} else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+				/* The guest is gone, its input does not matter */
+				pending = 0;
+				eof = 1;
+			}
+		}
+
+		if (fds[1].revents & (POLLIN | POLLHUP | POLLERR)) {
+			n = recv(io, out, sizeof out, MSG_DONTWAIT);
+			if (n == 0)
+				return 0;
+			if (n < 0 && errno != EAGAIN && errno != EINTR) {
+				perror("recv");
+				return -1;
+			}
+			if (n > 0 && -1 == job_write(STDOUT_FILENO, out, n)) {
+				perror("write");
+				return -1;
+			}
+		}
+	}
+}
+
+int
+main(int argc, char *argv[])
+{
+	static uint8_t image[IMAGE_MAX];
+	struct sockaddr_un addr;
+	struct job_request req;
+	struct job_reply rep;
+	const char *path;
+	char *payload, resolved[PATH_MAX];
+	_Bool copy;
+	int opt, fd, conn, io[2];
+	ssize_t n;
+
+	path = getenv(JOB_SOCKET_ENV);
+	if (!path)
+		path = JOB_SOCKET;
+	memset(&req, 0, sizeof req);
+	req.magic = JOB_MAGIC;
+	copy = 0;
+	while (-1 != (opt = getopt(argc, argv, "hS:b:c")))
+		switch (opt) {
+		case 'S':
+			path = optarg;
+			break;
+		case 'b':
+			req.limit = strtoull(optarg, NULL, 0);
+			break;
+		case 'c':
+			copy = 1;
+			break;
+		default:
+		case 'h':
+			goto print_usage;
+		}
+
+	if (optind + 1 != argc || strlen(path) >= sizeof addr.sun_path)
+		goto print_usage;
+
+	if (copy) {
+		fd = open(argv[optind], O_RDONLY);
+		n = fd < 0 ? -1 : read(fd, image, sizeof image);
+		if (n < 0) {
+			perror(argv[optind]);
+			return 1;
+		}
+		if (n == sizeof image && read(fd, resolved, 1) > 0) {
+			fprintf(stderr, "%s: Image does not fit into RAM\n",
+				argv[optind]);
+			return 1;
+		}
+		close(fd);
+		req.kind = JOB_IMAGE;
+		req.size = n;
+		payload = (char *) image;
+	} else {
+		if (!realpath(argv[optind], resolved)) {
+			perror(argv[optind]);
+			return 1;
+		}
+		req.kind = JOB_PATH;
+		req.size = strlen(resolved);
+		payload = resolved;
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+
+	memset(&addr, 0, sizeof addr);
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, path);
+	conn = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (conn < 0 || connect(conn, (struct sockaddr *) &addr,
+			sizeof addr) < 0) {
+		perror(path);
+		return 1;
+	}
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, io) < 0) {
+		perror("socketpair");
+		return 1;
+	}
+	if (-1 == job_send(conn, &req, io[0])
+			|| -1 == job_write(conn, payload, req.size)) {
+		perror("send");
+		return 1;
+	}
+	close(io[0]);
+
+	if (-1 == relay(io[1]))
+		return 1;
+	if (-1 == job_read(conn, &rep, sizeof rep, NULL)) {
+		fprintf(stderr, "%s: No reply\n", path);
+		return 1;
+	}
+
+	switch (rep.status) {
+	case S16_EXIT:
+		return 0;
+	case S16_ILLEGAL:
+		fprintf(stderr, "Illegal instruction %04x at %04x\n",
+			rep.ir, (uint16_t) (rep.pc - 1));
+		break;
+	case S16_LIMIT:
+		fprintf(stderr, "Stopped after %llu instructions\n",
+			(unsigned long long) rep.steps);
+		break;
+	default:
+		fprintf(stderr, "Job rejected, see the daemon's messages\n");
+		break;
+	}
+	return 1;
+
+print_usage:
+	fprintf(stderr,
+		"Usage: %s [-S SOCKET] [-b LIMIT] [-c] BIN\n"
+		"  -S      connect here instead of $" JOB_SOCKET_ENV " or "
+		JOB_SOCKET "\n"
+		"  -b      instructions the program may run at most\n"
+		"  -c      send the image itself instead of its path\n",
+		argv[0]);
+	return 1;
+}
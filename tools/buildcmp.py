@@ -0,0 +1,83 @@
+#!/usr/bin/python3
+# Build every profile of the Makefile and compare startup latency, emulator
+#  MIPS on tools/workloads and assembler throughput between them
+#  Usage: tools/buildcmp.py [MAKE ARGS...], e.g. tools/buildcmp.py LIBKM=...
+#  NOTE: this runs make clean, the tree is left with the last profile built
+import os
+import shutil
+import subprocess
+import sys
+import tempfile
+import time
+
+PROFILES = [("default", ["all"]), ("release", ["release"]), ("pgo", ["pgo"])]
+STARTUP_RUNS = 200
+REPEAT = 5
+
+def run(argv, stdout=subprocess.DEVNULL):
+	subprocess.run(argv, stdout=stdout, check=True)
+
+def best(argv):
+	times = []
+	for _ in range(REPEAT):
+		start = time.perf_counter()
+		run(argv)
+		times.append(time.perf_counter() - start)
+	return min(times)
+
+def startup(argv):
+	start = time.perf_counter()
+	for _ in range(STARTUP_RUNS):
+		pid = os.posix_spawn(argv[0], argv, os.environ)
+		os.waitpid(pid, 0)
+	return (time.perf_counter() - start) / STARTUP_RUNS
+
+tmp = tempfile.mkdtemp()
+workloads = sorted(f for f in os.listdir("tools/workloads") if f.endswith(".s"))
+
+# A single EXIT trap, so only process startup is measured
+exit_bin = os.path.join(tmp, "exit.bin")
+with open(exit_bin, "wb") as f:
+	f.write(bytes([0xd0, 0x00]))
+exit_src = os.path.join(tmp, "exit.s")
+with open(exit_src, "w") as f:
+	f.write("\ttrap R0,R0,R0\n")
+source = os.path.join(tmp, "gen.s")
+with open(source, "w") as f:
+	run(["python3", "tools/gensrc.py", "-n", "200000"], stdout=f)
+
+results = {}
+for name, targets in PROFILES:
+	run(["make", "clean"])
+	run(["make"] + targets + sys.argv[1:])
+	bindir = os.path.join(tmp, name)
+	os.mkdir(bindir)
+	for prog in ("s16asm", "s16emu"):
+		shutil.copy(prog, bindir)
+	results[name] = bindir
+
+# Instruction counts do not depend on the build
+binaries, counts = {}, {}
+emu = os.path.join(results["default"], "s16emu")
+asm = os.path.join(results["default"], "s16asm")
+for w in workloads:
+	binaries[w] = os.path.join(tmp, w + ".bin")
+	profile = os.path.join(tmp, w + ".prof")
+	run([asm, "-o", binaries[w], os.path.join("tools/workloads", w)])
+	run([emu, "-p", profile, binaries[w]])
+	with open(profile) as f:
+		counts[w] = sum(int(line.split()[1]) for line in f)
+
+print("%-8s %12s %12s" %("profile", "emu start", "asm start")
+	+ "".join(" %10s" %w[:-2] for w in workloads) + " %12s" %"asm lines/s")
+for name, _ in PROFILES:
+	emu = os.path.join(results[name], "s16emu")
+	asm = os.path.join(results[name], "s16asm")
+	line = "%-8s %10.0fus %10.0fus" %(name, startup([emu, exit_bin]) * 1e6,
+		startup([asm, "-o", os.devnull, exit_src]) * 1e6)
+	for w in workloads:
+		line += " %6.1f MIPS" %(counts[w] / best([emu, binaries[w]]) / 1e6)
+	line += " %12.0f" %(200000 / best([asm, "-o", os.devnull, source]))
+	print(line)
+
+shutil.rmtree(tmp)
@@ -0,0 +1,73 @@
+#!/usr/bin/python3
+# Generate a synthetic s16asm source for benchmarking
+#  e.g. tools/gensrc.py -n 1000000 > big.s && ./s16asmbench big.s
+import argparse
+import bisect
+import random
+
+parser = argparse.ArgumentParser(
+	description="Generate a synthetic Sigma16 program in s16asm syntax")
+parser.add_argument("-n", type=int, default=100000, metavar="LINES",
+	help="Number of instruction lines")
+parser.add_argument("--labels", type=float, default=0.1, metavar="RATIO",
+	help="Fraction of lines with a label")
+parser.add_argument("--rx", type=float, default=0.4, metavar="RATIO",
+	help="Fraction of RX instructions, the rest are RRR or data")
+parser.add_argument("--forward", type=float, default=0.5, metavar="RATIO",
+	help="Fraction of label references that point forward")
+parser.add_argument("--ascii", type=float, default=0.02, metavar="RATIO",
+	help="Fraction of ascii strings")
+parser.add_argument("--data", type=float, default=0.05, metavar="RATIO",
+	help="Fraction of data words")
+parser.add_argument("--comments", type=float, default=0.3, metavar="RATIO",
+	help="Fraction of lines with a trailing comment")
+parser.add_argument("--seed", type=int, default=0, help="Random seed")
+args = parser.parse_args()
+
+random.seed(args.seed)
+
+RRR = ["add", "sub", "mul", "div", "cmplt", "cmpeq", "cmpgt",
+	"and", "or", "xor", "addc"]
+RX = ["lea", "load", "store", "jumpf", "jumpt", "jal"]
+
+# Label positions are picked up front so references can point either way
+labelled = sorted(random.sample(range(args.n), max(1, int(args.n * args.labels))))
+labels = ["L%d" %i for i in labelled]
+label_at = dict(zip(labelled, labels))
+
+def reg():
+	return "R%d" %random.randrange(16)
+
+def target(line):
+	# Labels after the line are forward references, the rest backward ones
+	split = bisect.bisect_right(labelled, line)
+	if random.random() < args.forward and split < len(labels):
+		return labels[random.randrange(split, len(labels))]
+	elif split > 0:
+		return labels[random.randrange(split)]
+	return labels[random.randrange(len(labels))]
+
+out = []
+for i in range(args.n):
+	line = label_at.get(i, "")
+	if line:
+		line += ":"
+	line += "\t"
+
+	r = random.random()
+	if r < args.ascii:
+		line += 'ascii "%s\\n"' %("x" * random.randrange(1, 24))
+	elif r < args.ascii + args.data:
+		line += "data %d" %random.randrange(-32768, 65536)
+	elif r < args.ascii + args.data + args.rx:
+		op = random.choice(RX)
+		line += "%s %s,%s[%s]" %(op, reg(), target(i), reg())
+	else:
+		op = random.choice(RRR)
+		line += "%s %s,%s,%s" %(op, reg(), reg(), reg())
+
+	if random.random() < args.comments:
+		line += " ; generated comment"
+	out.append(line)
+
+print("\n".join(out))
@@ -0,0 +1,50 @@
+#!/usr/bin/python3
+# Generate the perfect hash used by s16asm to look up mnemonics
+#  Usage: tools/ophash.py src/asm/insn.c > src/asm/ophash.h
+import re
+import sys
+import itertools
+
+with open(sys.argv[1]) as f:
+	mnemonics = re.findall(r'^\t\{ "(\w+)"', f.read(), re.M)
+
+def key(s, size, k):
+	return (len(s) * k[0] + ord(s[0]) * k[1] + ord(s[-2]) * k[2]
+		+ ord(s[-1]) * k[3]) & (size - 1)
+
+def search():
+	size = 32
+	while size < len(mnemonics):
+		size *= 2
+	while True:
+		for k in itertools.product(range(1, 32), repeat=4):
+			if len({ key(s, size, k) for s in mnemonics }) == len(mnemonics):
+				return size, k
+		size *= 2
+
+size, k = search()
+table = [-1] * size
+for i, s in enumerate(mnemonics):
+	table[key(s, size, k)] = i
+
+print("/* Generated by tools/ophash.py from insn.c, do not edit */")
+print("#ifndef OPHASH_H")
+print("#define OPHASH_H")
+print()
+print("#define OPHASH_MIN %d" %min(map(len, mnemonics)))
+print("#define OPHASH_MAX %d" %max(map(len, mnemonics)))
+print("#define OPHASH_SIZE %d" %size)
+print()
+print("/* Only valid for OPHASH_MIN <= len <= OPHASH_MAX */")
+print("#define OPHASH(s, len) \\")
+print("\t(((len) * %d + (unsigned char) (s)[0] * %d + \\" %k[:2])
+print("\t\t(unsigned char) (s)[(len) - 2] * %d + \\" %k[2])
+print("\t\t(unsigned char) (s)[(len) - 1] * %d) & (OPHASH_SIZE - 1))" %k[3])
+print()
+print("/* Index into opdefs, or -1 if no mnemonic hashes to the slot */")
+print("static const int8_t ophash_table[OPHASH_SIZE] = {")
+for i in range(0, size, 8):
+	print("\t" + " ".join("%2d," %x for x in table[i:i + 8]))
+print("};")
+print()
+print("#endif")
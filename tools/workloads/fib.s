@@ -0,0 +1,67 @@
+; naive recursive fib(23) 4 times, mostly calls and returns
+	lea R13,stack[R0]
+	lea R12,4[R0]
+again:
+	lea R1,23[R0]
+	jal R14,fib[R0]
+	lea R4,1[R0]
+	sub R12,R12,R4
+	jumpt R12,again[R0]
+	add R1,R2,R0
+	jal R14,printnum[R0]
+	trap R0,R0,R0
+
+; R2 = fib(R1), the stack in R13 grows upwards
+fib:
+	lea R3,2[R0]
+	cmp R1,R3
+	jumpge fib_rec[R0]
+	add R2,R1,R0
+	jump 0[R14]
+fib_rec:
+	store R14,0[R13]
+	store R1,1[R13]
+	lea R13,3[R13]
+	lea R4,1[R0]
+	sub R1,R1,R4
+	jal R14,fib[R0]
+	store R2,-1[R13]
+	load R1,-2[R13]
+	lea R4,2[R0]
+	sub R1,R1,R4
+	jal R14,fib[R0]
+	load R5,-1[R13]
+	add R2,R2,R5
+	lea R4,3[R0]
+	sub R13,R13,R4
+	load R14,0[R13]
+	jump 0[R14]
+
+; print R1 in decimal followed by a newline, clobbers R1 to R6
+printnum:
+	lea R2,10[R0]
+	lea R3,buf_end[R0]
+	lea R4,1[R0]
+pn_digit:
+	sub R3,R3,R4
+	div R1,R1,R2
+	lea R5,48[R15]
+	store R5,0[R3]
+	jumpt R1,pn_digit[R0]
+	lea R5,buf_end[R0]
+	sub R6,R5,R3
+	add R6,R6,R4
+	lea R5,2[R0]
+	trap R5,R3,R6
+	jump 0[R14]
+buf:
+	data 0
+	data 0
+	data 0
+	data 0
+	data 0
+buf_end:
+	data 10
+
+stack:
+	data 0
@@ -0,0 +1,72 @@
+; count the primes below 30000 with the sieve of Eratosthenes, 40 times
+	lea R1,1[R0]
+	lea R7,30000[R0]
+	lea R13,174[R0]
+	lea R14,40[R0]
+round:
+	; clear the sieve
+	add R9,R0,R0
+clear:
+	store R0,sieve[R9]
+	add R9,R9,R1
+	cmp R9,R7
+	jumplt clear[R0]
+
+	lea R9,2[R0]
+	add R10,R0,R0
+outer:
+	cmp R9,R7
+	jumpge counted[R0]
+	load R11,sieve[R9]
+	jumpt R11,next[R0]
+	add R10,R10,R1
+	; multiples start at i*i, which is past the end from 174 on
+	cmp R9,R13
+	jumpge next[R0]
+	mul R12,R9,R9
+mark:
+	cmp R12,R7
+	jumpge next[R0]
+	store R1,sieve[R12]
+	add R12,R12,R9
+	jump mark[R0]
+next:
+	add R9,R9,R1
+	jump outer[R0]
+counted:
+	sub R14,R14,R1
+	jumpt R14,round[R0]
+
+	add R1,R10,R0
+	jal R14,printnum[R0]
+	trap R0,R0,R0
+
+; print R1 in decimal followed by a newline, clobbers R1 to R6
+printnum:
+	lea R2,10[R0]
+	lea R3,buf_end[R0]
+	lea R4,1[R0]
+pn_digit:
+	sub R3,R3,R4
+	div R1,R1,R2
+	lea R5,48[R15]
+	store R5,0[R3]
+	jumpt R1,pn_digit[R0]
+	lea R5,buf_end[R0]
+	sub R6,R5,R3
+	add R6,R6,R4
+	lea R5,2[R0]
+	trap R5,R3,R6
+	jump 0[R14]
+buf:
+	data 0
+	data 0
+	data 0
+	data 0
+	data 0
+buf_end:
+	data 10
+
+; the sieve runs past the end of the image
+sieve:
+	data 0
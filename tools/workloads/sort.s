@@ -0,0 +1,92 @@
+; insertion sort 400 pseudo-random words 40 times, print how many came out
+;  sorted
+	lea R1,1[R0]
+	lea R7,400[R0]
+	lea R13,40[R0]
+	add R12,R0,R0
+	lea R8,12345[R0]
+	lea R6,array[R0]
+round:
+	; fill with a linear congruential generator
+	lea R2,25173[R0]
+	lea R3,13849[R0]
+	add R9,R0,R0
+fill:
+	mul R8,R8,R2
+	add R8,R8,R3
+	store R8,array[R9]
+	add R9,R9,R1
+	cmp R9,R7
+	jumplt fill[R0]
+
+	lea R9,1[R0]
+insert:
+	cmp R9,R7
+	jumpge sorted[R0]
+	load R4,array[R9]
+	add R10,R9,R0
+shift:
+	jumpf R10,place[R0]
+	add R11,R6,R10
+	load R5,-1[R11]
+	cmp R5,R4
+	jumple place[R0]
+	store R5,array[R10]
+	sub R10,R10,R1
+	jump shift[R0]
+place:
+	store R4,array[R10]
+	add R9,R9,R1
+	jump insert[R0]
+
+	; check the order
+sorted:
+	lea R9,1[R0]
+check:
+	cmp R9,R7
+	jumpge good[R0]
+	add R11,R6,R9
+	load R5,-1[R11]
+	load R4,0[R11]
+	cmp R5,R4
+	jumpgt bad[R0]
+	add R9,R9,R1
+	jump check[R0]
+good:
+	add R12,R12,R1
+bad:
+	sub R13,R13,R1
+	jumpt R13,round[R0]
+
+	add R1,R12,R0
+	jal R14,printnum[R0]
+	trap R0,R0,R0
+
+; print R1 in decimal followed by a newline, clobbers R1 to R6
+printnum:
+	lea R2,10[R0]
+	lea R3,buf_end[R0]
+	lea R4,1[R0]
+pn_digit:
+	sub R3,R3,R4
+	div R1,R1,R2
+	lea R5,48[R15]
+	store R5,0[R3]
+	jumpt R1,pn_digit[R0]
+	lea R5,buf_end[R0]
+	sub R6,R5,R3
+	add R6,R6,R4
+	lea R5,2[R0]
+	trap R5,R3,R6
+	jump 0[R14]
+buf:
+	data 0
+	data 0
+	data 0
+	data 0
+	data 0
+buf_end:
+	data 10
+
+array:
+	data 0